@@ -0,0 +1,484 @@
+#include "utils/parallel.h"
+#include "utils/blp.h"
+
+#include "explorer.h"
+#include "convert.h"
+#include "mpq_map.h"
+#include "nodes.h"
+
+#include <libwow/blp.h>
+#include <libwow/mpq.h>
+
+#include <jks/array.h>
+
+#include <inttypes.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <strings.h>
+#include <string.h>
+#include <ctype.h>
+#include <stdio.h>
+
+#define VK_FORMAT_R8G8B8A8_SRGB 43
+
+enum convert_format
+{
+	CONVERT_PNG,
+	CONVERT_KTX2,
+};
+
+/* encoded file waiting to be written */
+struct convert_output
+{
+	char *path;
+	uint8_t *data;
+	size_t size;
+};
+
+/* bounded queue between the decoding threads and the writer
+ * producers block while it is full, so at most capacity encoded files are
+ * held in memory whatever the number of files converted
+ */
+struct convert_queue
+{
+	struct convert_output *outputs;
+	size_t capacity;
+	size_t head;
+	size_t count;
+	size_t producers;
+	GMutex mutex;
+	GCond not_full;
+	GCond not_empty;
+};
+
+struct convert
+{
+	struct explorer *explorer;
+	enum convert_format format;
+	const char *output_dir;
+	struct jks_array paths; /* char* */
+	struct convert_queue queue;
+	gint next;
+	gint failed;
+};
+
+static void path_delete(void *ptr)
+{
+	free(*(char**)ptr);
+}
+
+static bool queue_init(struct convert_queue *queue, size_t capacity, size_t producers)
+{
+	queue->outputs = malloc(sizeof(*queue->outputs) * capacity);
+	if (!queue->outputs)
+	{
+		fprintf(stderr, "convert queue allocation failed\n");
+		return false;
+	}
+	queue->capacity = capacity;
+	queue->head = 0;
+	queue->count = 0;
+	queue->producers = producers;
+	g_mutex_init(&queue->mutex);
+	g_cond_init(&queue->not_full);
+	g_cond_init(&queue->not_empty);
+	return true;
+}
+
+static void queue_destroy(struct convert_queue *queue)
+{
+	free(queue->outputs);
+	g_mutex_clear(&queue->mutex);
+	g_cond_clear(&queue->not_full);
+	g_cond_clear(&queue->not_empty);
+}
+
+static void queue_push(struct convert_queue *queue, const struct convert_output *output)
+{
+	g_mutex_lock(&queue->mutex);
+	while (queue->count == queue->capacity)
+		g_cond_wait(&queue->not_full, &queue->mutex);
+	queue->outputs[(queue->head + queue->count) % queue->capacity] = *output;
+	queue->count++;
+	g_cond_signal(&queue->not_empty);
+	g_mutex_unlock(&queue->mutex);
+}
+
+static void queue_producer_done(struct convert_queue *queue)
+{
+	g_mutex_lock(&queue->mutex);
+	queue->producers--;
+	g_cond_broadcast(&queue->not_empty);
+	g_mutex_unlock(&queue->mutex);
+}
+
+/* returns false once every producer is done and the queue is drained */
+static bool queue_pop(struct convert_queue *queue, struct convert_output *output)
+{
+	g_mutex_lock(&queue->mutex);
+	while (!queue->count && queue->producers)
+		g_cond_wait(&queue->not_empty, &queue->mutex);
+	if (!queue->count)
+	{
+		g_mutex_unlock(&queue->mutex);
+		return false;
+	}
+	*output = queue->outputs[queue->head];
+	queue->head = (queue->head + 1) % queue->capacity;
+	queue->count--;
+	g_cond_signal(&queue->not_full);
+	g_mutex_unlock(&queue->mutex);
+	return true;
+}
+
+static void collect_paths(struct convert *convert, struct node *node, GPatternSpec **patterns, int patterns_nb)
+{
+	if (node_is_dir(node))
+	{
+		for (uint32_t i = 0; i < node->childs_nb; ++i)
+			collect_paths(convert, node->childs[i], patterns, patterns_nb);
+		return;
+	}
+	char path[512];
+	node_get_path(node, path, sizeof(path));
+	size_t len = strlen(path);
+	if (len < 4 || strcasecmp(&path[len - 4], ".blp"))
+		return;
+	for (size_t i = 0; i < len; ++i)
+		path[i] = tolower((unsigned char)path[i]);
+	for (int i = 0; i < patterns_nb; ++i)
+	{
+		if (!g_pattern_match_string(patterns[i], path))
+			continue;
+		char *dup = strdup(path);
+		if (!dup || !jks_array_push_back(&convert->paths, &dup))
+		{
+			fprintf(stderr, "convert path allocation failed\n");
+			free(dup);
+		}
+		return;
+	}
+}
+
+static bool encode_png(const struct blp_rgba *rgba, struct convert_output *output)
+{
+	GdkPixbuf *pixbuf = gdk_pixbuf_new_from_data(rgba->data, GDK_COLORSPACE_RGB, true, 8, rgba->width, rgba->height, rgba->width * 4, NULL, NULL);
+	if (!pixbuf)
+		return false;
+	gchar *buffer;
+	gsize size;
+	GError *error = NULL;
+	bool ret = gdk_pixbuf_save_to_buffer(pixbuf, &buffer, &size, "png", &error, NULL);
+	g_object_unref(pixbuf);
+	if (!ret)
+	{
+		fprintf(stderr, "png encoding failed: %s\n", error ? error->message : "");
+		g_clear_error(&error);
+		return false;
+	}
+	output->data = (uint8_t*)buffer;
+	output->size = size;
+	return true;
+}
+
+static void put_u32(uint8_t *data, uint32_t v)
+{
+	data[0] = v;
+	data[1] = v >> 8;
+	data[2] = v >> 16;
+	data[3] = v >> 24;
+}
+
+static void put_u64(uint8_t *data, uint64_t v)
+{
+	put_u32(data, v);
+	put_u32(data + 4, v >> 32);
+}
+
+/* uncompressed R8G8B8A8 KTX2 with the whole mipmap chain
+ * levels are stored from the smallest to the base one
+ */
+static bool encode_ktx2(const struct blp_rgba *mipmaps, uint32_t levels, struct convert_output *output)
+{
+	static const uint8_t identifier[12] = {0xAB, 'K', 'T', 'X', ' ', '2', '0', 0xBB, '\r', '\n', 0x1A, '\n'};
+	/* R, G, B, A; the alpha of sRGB formats is flagged linear */
+	static const uint8_t channels[4] = {0, 1, 2, 15 | 0x10};
+	size_t header_size = 80;
+	size_t index_size = levels * 24;
+	size_t dfd_size = 4 + 24 + 16 * 4;
+	size_t size = header_size + index_size + dfd_size;
+	for (uint32_t i = 0; i < levels; ++i)
+		size += mipmaps[i].width * mipmaps[i].height * 4;
+	uint8_t *data = g_try_malloc0(size);
+	if (!data)
+	{
+		fprintf(stderr, "ktx2 allocation failed\n");
+		return false;
+	}
+	memcpy(data, identifier, sizeof(identifier));
+	put_u32(&data[12], VK_FORMAT_R8G8B8A8_SRGB);
+	put_u32(&data[16], 1); /* type size */
+	put_u32(&data[20], mipmaps[0].width);
+	put_u32(&data[24], mipmaps[0].height);
+	put_u32(&data[28], 0); /* depth */
+	put_u32(&data[32], 0); /* layers */
+	put_u32(&data[36], 1); /* faces */
+	put_u32(&data[40], levels);
+	put_u32(&data[44], 0); /* supercompression */
+	put_u32(&data[48], header_size + index_size);
+	put_u32(&data[52], dfd_size);
+	/* no key/value nor supercompression data */
+	uint8_t *dfd = &data[header_size + index_size];
+	put_u32(&dfd[0], dfd_size);
+	put_u32(&dfd[4], 0); /* khronos vendor, basic descriptor */
+	put_u32(&dfd[8], 2 | ((dfd_size - 4) << 16)); /* version 2, block size */
+	put_u32(&dfd[12], 1 | (1 << 8) | (2 << 16)); /* RGBSDA, BT709, sRGB */
+	put_u32(&dfd[16], 0); /* 1x1x1x1 texel block */
+	put_u32(&dfd[20], 4); /* bytes plane 0 */
+	put_u32(&dfd[24], 0);
+	for (uint32_t i = 0; i < 4; ++i)
+	{
+		uint8_t *sample = &dfd[28 + i * 16];
+		put_u32(&sample[0], (i * 8) | (7 << 16) | ((uint32_t)channels[i] << 24));
+		put_u32(&sample[4], 0);
+		put_u32(&sample[8], 0);
+		put_u32(&sample[12], 255);
+	}
+	size_t offset = header_size + index_size + dfd_size;
+	for (uint32_t i = levels; i > 0; --i)
+	{
+		const struct blp_rgba *mipmap = &mipmaps[i - 1];
+		size_t level_size = mipmap->width * mipmap->height * 4;
+		uint8_t *level = &data[header_size + (i - 1) * 24];
+		put_u64(&level[0], offset);
+		put_u64(&level[8], level_size);
+		put_u64(&level[16], level_size);
+		memcpy(&data[offset], mipmap->data, level_size);
+		offset += level_size;
+	}
+	output->data = data;
+	output->size = size;
+	return true;
+}
+
+static bool convert_file(struct convert *convert, const char *path, struct convert_output *output)
+{
+	struct wow_mpq_file *file = mpq_map_get_file(convert->explorer->mpq_map, path);
+	if (!file)
+	{
+		fprintf(stderr, "can't open file \"%s\"\n", path);
+		return false;
+	}
+	struct wow_blp_file *blp = wow_blp_file_new(file);
+	mpq_map_release_file(convert->explorer->mpq_map, file);
+	if (!blp)
+	{
+		fprintf(stderr, "can't parse blp \"%s\"\n", path);
+		return false;
+	}
+	bool ret = false;
+	struct blp_rgba *mipmaps = NULL;
+	uint32_t levels = convert->format == CONVERT_KTX2 ? blp->mipmaps_nb : 1;
+	if (!levels)
+		goto end;
+	mipmaps = malloc(sizeof(*mipmaps) * levels);
+	if (!mipmaps)
+		goto end;
+	if (convert->format == CONVERT_KTX2)
+	{
+		if (!blp_decode_rgba_mipmaps(blp, mipmaps))
+			goto end;
+	}
+	else
+	{
+		if (!blp_decode_rgba(blp, 0, &mipmaps[0].width, &mipmaps[0].height, &mipmaps[0].data))
+			goto end;
+	}
+	if (convert->format == CONVERT_KTX2)
+		ret = encode_ktx2(mipmaps, levels, output);
+	else
+		ret = encode_png(&mipmaps[0], output);
+	for (uint32_t i = 0; i < levels; ++i)
+		free(mipmaps[i].data);
+
+end:
+	free(mipmaps);
+	wow_blp_file_delete(blp);
+	if (!ret)
+		fprintf(stderr, "can't convert \"%s\"\n", path);
+	return ret;
+}
+
+static char *output_path(struct convert *convert, const char *path)
+{
+	const char *ext = convert->format == CONVERT_KTX2 ? "ktx2" : "png";
+	size_t len = strlen(path);
+	char *ret = malloc(strlen(convert->output_dir) + len + 8);
+	if (!ret)
+		return NULL;
+	size_t pos = sprintf(ret, "%s/", convert->output_dir);
+	for (size_t i = 0; i < len - 3; ++i)
+		ret[pos++] = path[i] == '\\' ? '/' : path[i];
+	strcpy(&ret[pos], ext);
+	return ret;
+}
+
+static gpointer convert_worker(gpointer data)
+{
+	struct convert *convert = data;
+	while (1)
+	{
+		size_t i = g_atomic_int_add(&convert->next, 1);
+		if (i >= convert->paths.size)
+			break;
+		const char *path = *JKS_ARRAY_GET(&convert->paths, i, char*);
+		struct convert_output output;
+		output.path = output_path(convert, path);
+		if (!output.path || !convert_file(convert, path, &output))
+		{
+			free(output.path);
+			g_atomic_int_inc(&convert->failed);
+			continue;
+		}
+		queue_push(&convert->queue, &output);
+	}
+	queue_producer_done(&convert->queue);
+	return NULL;
+}
+
+static bool write_output(const struct convert_output *output)
+{
+	char *dir = g_path_get_dirname(output->path);
+	int res = g_mkdir_with_parents(dir, 0755);
+	g_free(dir);
+	if (res)
+	{
+		fprintf(stderr, "can't create directory for \"%s\"\n", output->path);
+		return false;
+	}
+	FILE *fp = fopen(output->path, "wb");
+	if (!fp)
+	{
+		fprintf(stderr, "can't open \"%s\"\n", output->path);
+		return false;
+	}
+	bool ret = fwrite(output->data, 1, output->size, fp) == output->size;
+	if (!ret)
+		fprintf(stderr, "can't write \"%s\"\n", output->path);
+	fclose(fp);
+	return ret;
+}
+
+static void usage(void)
+{
+	printf("explorer [-p <path>] [-l <locale>] convert [-h] [-f <format>] [-o <dir>] <glob>...\n");
+	printf("-h: show this help\n");
+	printf("-f: set the output format (png, ktx2), defaults to png\n");
+	printf("-o: set the output directory, defaults to the current one\n");
+	printf("globs are matched against the mpq paths, e.g. \"textures\\\\minimap\\\\*.blp\"\n");
+}
+
+int convert_run(struct explorer *explorer, int argc, char **argv)
+{
+	struct convert convert;
+	convert.explorer = explorer;
+	convert.format = CONVERT_PNG;
+	convert.output_dir = ".";
+	convert.next = 0;
+	convert.failed = 0;
+	int c;
+	optind = 1;
+	while ((c = getopt(argc, argv, "hf:o:")) != -1)
+	{
+		switch (c)
+		{
+			case 'h':
+				usage();
+				return EXIT_SUCCESS;
+			case 'f':
+				if (!strcmp(optarg, "png"))
+					convert.format = CONVERT_PNG;
+				else if (!strcmp(optarg, "ktx2") || !strcmp(optarg, "ktx"))
+					convert.format = CONVERT_KTX2;
+				else
+				{
+					fprintf(stderr, "unknown format \"%s\"\n", optarg);
+					return EXIT_FAILURE;
+				}
+				break;
+			case 'o':
+				convert.output_dir = optarg;
+				break;
+			default:
+				usage();
+				return EXIT_FAILURE;
+		}
+	}
+	if (optind >= argc)
+	{
+		usage();
+		return EXIT_FAILURE;
+	}
+	int patterns_nb = argc - optind;
+	GPatternSpec **patterns = malloc(sizeof(*patterns) * patterns_nb);
+	if (!patterns)
+	{
+		fprintf(stderr, "patterns allocation failed\n");
+		return EXIT_FAILURE;
+	}
+	for (int i = 0; i < patterns_nb; ++i)
+	{
+		/* listfile paths are lowercase and backslash separated */
+		char *pattern = g_ascii_strdown(argv[optind + i], -1);
+		for (char *p = pattern; *p; ++p)
+		{
+			if (*p == '/')
+				*p = '\\';
+		}
+		patterns[i] = g_pattern_spec_new(pattern);
+		g_free(pattern);
+	}
+	jks_array_init(&convert.paths, sizeof(char*), path_delete, NULL);
+	collect_paths(&convert, explorer->root, patterns, patterns_nb);
+	for (int i = 0; i < patterns_nb; ++i)
+		g_pattern_spec_free(patterns[i]);
+	free(patterns);
+	size_t threads_nb = parallel_threads();
+	if (!threads_nb)
+		threads_nb = 1;
+	if (!queue_init(&convert.queue, threads_nb * 2, threads_nb))
+	{
+		jks_array_destroy(&convert.paths);
+		return EXIT_FAILURE;
+	}
+	printf("converting %zu files\n", convert.paths.size);
+	GThread **threads = malloc(sizeof(*threads) * threads_nb);
+	if (!threads)
+	{
+		fprintf(stderr, "threads allocation failed\n");
+		queue_destroy(&convert.queue);
+		jks_array_destroy(&convert.paths);
+		return EXIT_FAILURE;
+	}
+	for (size_t i = 0; i < threads_nb; ++i)
+		threads[i] = g_thread_new("convert", convert_worker, &convert);
+	/* the calling thread is the only writer */
+	size_t written = 0;
+	struct convert_output output;
+	while (queue_pop(&convert.queue, &output))
+	{
+		if (write_output(&output))
+			written++;
+		else
+			g_atomic_int_inc(&convert.failed);
+		free(output.path);
+		g_free(output.data);
+	}
+	for (size_t i = 0; i < threads_nb; ++i)
+		g_thread_join(threads[i]);
+	free(threads);
+	queue_destroy(&convert.queue);
+	printf("converted %zu files, %" PRId32 " failed\n", written, (int32_t)g_atomic_int_get(&convert.failed));
+	jks_array_destroy(&convert.paths);
+	return g_atomic_int_get(&convert.failed) ? EXIT_FAILURE : EXIT_SUCCESS;
+}
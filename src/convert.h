@@ -0,0 +1,11 @@
+#ifndef EXPLORER_CONVERT_H
+#define EXPLORER_CONVERT_H
+
+struct explorer;
+
+/* headless conversion of the BLP files matching the given globs to PNG or KTX2
+ * argv[0] is the "convert" command itself
+ */
+int convert_run(struct explorer *explorer, int argc, char **argv);
+
+#endif
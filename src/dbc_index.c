@@ -0,0 +1,381 @@
+#include "utils/dbc_layout.h"
+
+#include "dbc_index.h"
+
+#include <libwow/dbc.h>
+
+#include <jks/array.h>
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+
+#define TRIGRAM(a, b, c) (((uint32_t)(uint8_t)(a) << 16) | ((uint32_t)(uint8_t)(b) << 8) | (uint32_t)(uint8_t)(c))
+
+struct dbc_index
+{
+	DbcModel *model;
+	const struct wow_dbc_file *file;
+	const struct dbc_layout *layout;
+	dbc_index_ready_t on_ready;
+	void *userdata;
+	gint refs;
+	gint ready;
+	/* primary key, open addressing of record + 1 */
+	uint32_t *keys;
+	uint32_t keys_mask;
+	bool has_key;
+	/* trigrams, sorted, with their records in offsets[i]..offsets[i + 1] */
+	uint32_t *trigrams;
+	uint32_t *offsets;
+	uint32_t *postings;
+	uint32_t trigrams_nb;
+};
+
+static void index_unref(struct dbc_index *index)
+{
+	if (!g_atomic_int_dec_and_test(&index->refs))
+		return;
+	free(index->keys);
+	free(index->trigrams);
+	free(index->offsets);
+	free(index->postings);
+	g_object_unref(index->model);
+	free(index);
+}
+
+static uint32_t key_hash(uint64_t key)
+{
+	key *= 0x9E3779B97F4A7C15ull;
+	return key >> 32;
+}
+
+static uint64_t record_key(struct dbc_index *index, uint32_t record)
+{
+	return dbc_layout_get(index->layout, index->file, record, 0).u;
+}
+
+static void build_keys(struct dbc_index *index)
+{
+	uint32_t count = index->file->header.record_count;
+	if (!index->layout->columns_nb
+	 || (index->layout->columns[0].kind != DBC_VALUE_INT
+	  && index->layout->columns[0].kind != DBC_VALUE_UINT))
+		return;
+	uint32_t size = 16;
+	while (size < count * 2)
+		size *= 2;
+	index->keys = calloc(size, sizeof(*index->keys));
+	if (!index->keys)
+	{
+		fprintf(stderr, "dbc index keys allocation failed\n");
+		return;
+	}
+	index->keys_mask = size - 1;
+	struct dbc_column_scan scan;
+	dbc_layout_scan(index->layout, index->file, 0, &scan);
+	for (uint32_t i = 0; i < count; ++i)
+	{
+		uint32_t slot = key_hash(dbc_scan_get(&scan, i).u) & index->keys_mask;
+		while (index->keys[slot])
+			slot = (slot + 1) & index->keys_mask;
+		index->keys[slot] = i + 1;
+	}
+	index->has_key = true;
+}
+
+static int cmp_u64(const void *a, const void *b)
+{
+	uint64_t va = *(const uint64_t*)a;
+	uint64_t vb = *(const uint64_t*)b;
+	return (va > vb) - (va < vb);
+}
+
+static int cmp_u32(const void *a, const void *b)
+{
+	uint32_t va = *(const uint32_t*)a;
+	uint32_t vb = *(const uint32_t*)b;
+	return (va > vb) - (va < vb);
+}
+
+/* utf-8 bytes >= 0x80 are kept as is */
+static char ascii_lower(char c)
+{
+	if (c >= 'A' && c <= 'Z')
+		return c - 'A' + 'a';
+	return c;
+}
+
+static void add_trigrams(struct jks_array *record_trigrams, const char *str)
+{
+	size_t len = strlen(str);
+	for (size_t i = 0; i + 3 <= len; ++i)
+	{
+		uint32_t trigram = TRIGRAM(ascii_lower(str[i]), ascii_lower(str[i + 1]), ascii_lower(str[i + 2]));
+		if (!jks_array_push_back(record_trigrams, &trigram))
+			return;
+	}
+}
+
+static void build_trigrams(struct dbc_index *index)
+{
+	struct jks_array pairs; /* uint64_t trigram << 32 | record */
+	struct jks_array record_trigrams; /* uint32_t */
+	jks_array_init(&pairs, sizeof(uint64_t), NULL, NULL);
+	jks_array_init(&record_trigrams, sizeof(uint32_t), NULL, NULL);
+	for (uint32_t record = 0; record < index->file->header.record_count; ++record)
+	{
+		jks_array_resize(&record_trigrams, 0);
+		for (uint32_t column = 0; column < index->layout->columns_nb; ++column)
+		{
+			if (index->layout->columns[column].kind != DBC_VALUE_STRING)
+				continue;
+			add_trigrams(&record_trigrams, dbc_layout_get_str(index->layout, index->file, record, column));
+		}
+		if (!record_trigrams.size)
+			continue;
+		uint32_t *trigrams = record_trigrams.data;
+		qsort(trigrams, record_trigrams.size, sizeof(*trigrams), cmp_u32);
+		for (size_t i = 0; i < record_trigrams.size; ++i)
+		{
+			if (i && trigrams[i] == trigrams[i - 1])
+				continue;
+			uint64_t pair = ((uint64_t)trigrams[i] << 32) | record;
+			if (!jks_array_push_back(&pairs, &pair))
+			{
+				fprintf(stderr, "dbc index trigrams allocation failed\n");
+				goto end;
+			}
+		}
+	}
+	/* records are visited in order, sorting on the whole pair keeps the postings sorted */
+	qsort(pairs.data, pairs.size, sizeof(uint64_t), cmp_u64);
+	index->postings = malloc(sizeof(*index->postings) * (pairs.size ? pairs.size : 1));
+	index->trigrams = malloc(sizeof(*index->trigrams) * (pairs.size ? pairs.size : 1));
+	index->offsets = malloc(sizeof(*index->offsets) * (pairs.size + 1));
+	if (!index->postings || !index->trigrams || !index->offsets)
+	{
+		fprintf(stderr, "dbc index postings allocation failed\n");
+		free(index->postings);
+		free(index->trigrams);
+		free(index->offsets);
+		index->postings = NULL;
+		index->trigrams = NULL;
+		index->offsets = NULL;
+		goto end;
+	}
+	const uint64_t *data = pairs.data;
+	for (size_t i = 0; i < pairs.size; ++i)
+	{
+		uint32_t trigram = data[i] >> 32;
+		if (!index->trigrams_nb || index->trigrams[index->trigrams_nb - 1] != trigram)
+		{
+			index->trigrams[index->trigrams_nb] = trigram;
+			index->offsets[index->trigrams_nb] = i;
+			index->trigrams_nb++;
+		}
+		index->postings[i] = (uint32_t)data[i];
+	}
+	index->offsets[index->trigrams_nb] = pairs.size;
+
+end:
+	jks_array_destroy(&record_trigrams);
+	jks_array_destroy(&pairs);
+}
+
+static gboolean notify_ready(gpointer data)
+{
+	struct dbc_index *index = data;
+	if (index->on_ready)
+		index->on_ready(index, index->userdata);
+	index_unref(index);
+	return G_SOURCE_REMOVE;
+}
+
+static gpointer build_index(gpointer data)
+{
+	struct dbc_index *index = data;
+	build_keys(index);
+	build_trigrams(index);
+	g_atomic_int_set(&index->ready, 1);
+	g_idle_add(notify_ready, index);
+	return NULL;
+}
+
+struct dbc_index *dbc_index_new(DbcModel *model, dbc_index_ready_t on_ready, void *userdata)
+{
+	struct dbc_index *index = calloc(1, sizeof(*index));
+	if (!index)
+	{
+		fprintf(stderr, "dbc index allocation failed\n");
+		return NULL;
+	}
+	index->model = g_object_ref(model);
+	index->file = dbc_model_get_file(model);
+	index->layout = dbc_model_get_layout(model);
+	index->on_ready = on_ready;
+	index->userdata = userdata;
+	index->refs = 2; /* caller and builder */
+	g_thread_unref(g_thread_new("dbc index", build_index, index));
+	return index;
+}
+
+void dbc_index_detach(struct dbc_index *index)
+{
+	if (!index)
+		return;
+	index->on_ready = NULL;
+	index->userdata = NULL;
+	index_unref(index);
+}
+
+bool dbc_index_ready(struct dbc_index *index)
+{
+	return g_atomic_int_get(&index->ready);
+}
+
+static const uint32_t *get_postings(struct dbc_index *index, uint32_t trigram, uint32_t *count)
+{
+	uint32_t *it = bsearch(&trigram, index->trigrams, index->trigrams_nb, sizeof(*index->trigrams), cmp_u32);
+	if (!it)
+	{
+		*count = 0;
+		return NULL;
+	}
+	size_t i = it - index->trigrams;
+	*count = index->offsets[i + 1] - index->offsets[i];
+	return &index->postings[index->offsets[i]];
+}
+
+static bool contains(const char *str, const char *needle, size_t needle_len)
+{
+	if (!needle_len)
+		return true;
+	for (; *str; ++str)
+	{
+		size_t i = 0;
+		while (i < needle_len && str[i] && ascii_lower(str[i]) == needle[i])
+			i++;
+		if (i == needle_len)
+			return true;
+	}
+	return false;
+}
+
+static bool record_matches(struct dbc_index *index, uint32_t record, const char *needle, size_t needle_len)
+{
+	for (uint32_t column = 0; column < index->layout->columns_nb; ++column)
+	{
+		if (index->layout->columns[column].kind != DBC_VALUE_STRING)
+			continue;
+		if (contains(dbc_layout_get_str(index->layout, index->file, record, column), needle, needle_len))
+			return true;
+	}
+	return false;
+}
+
+/* candidates are the intersection of the postings of every query trigram,
+ * verified against the strings to drop the false positives
+ * queries without a trigram don't match strings: a full scan on every
+ * keystroke would stall the main thread on the large files
+ */
+static bool query_strings(struct dbc_index *index, const char *needle, size_t needle_len, struct jks_array *records)
+{
+	if (needle_len < 3)
+		return true;
+	const uint32_t *shortest = NULL;
+	uint32_t shortest_nb = UINT32_MAX;
+	for (size_t i = 0; i + 3 <= needle_len; ++i)
+	{
+		uint32_t count;
+		const uint32_t *postings = get_postings(index, TRIGRAM(needle[i], needle[i + 1], needle[i + 2]), &count);
+		if (!count)
+			return true;
+		if (count < shortest_nb)
+		{
+			shortest = postings;
+			shortest_nb = count;
+		}
+	}
+	for (uint32_t i = 0; i < shortest_nb; ++i)
+	{
+		uint32_t record = shortest[i];
+		bool found = true;
+		for (size_t j = 0; found && j + 3 <= needle_len; ++j)
+		{
+			uint32_t count;
+			const uint32_t *postings = get_postings(index, TRIGRAM(needle[j], needle[j + 1], needle[j + 2]), &count);
+			if (postings != shortest && !bsearch(&record, postings, count, sizeof(*postings), cmp_u32))
+				found = false;
+		}
+		if (found && record_matches(index, record, needle, needle_len) && !jks_array_push_back(records, &record))
+			return false;
+	}
+	return true;
+}
+
+static bool query_key(struct dbc_index *index, const char *query, uint32_t *record)
+{
+	if (!index->has_key || !*query)
+		return false;
+	char *end;
+	long long value = strtoll(query, &end, 10);
+	if (*end)
+		return false;
+	uint64_t key = value;
+	uint32_t slot = key_hash(key) & index->keys_mask;
+	while (index->keys[slot])
+	{
+		if (record_key(index, index->keys[slot] - 1) == key)
+		{
+			*record = index->keys[slot] - 1;
+			return true;
+		}
+		slot = (slot + 1) & index->keys_mask;
+	}
+	return false;
+}
+
+bool dbc_index_query(struct dbc_index *index, const char *query, uint32_t **records, uint32_t *count)
+{
+	if (!dbc_index_ready(index))
+		return false;
+	struct jks_array result; /* uint32_t */
+	jks_array_init(&result, sizeof(uint32_t), NULL, NULL);
+	size_t needle_len = strlen(query);
+	char *needle = malloc(needle_len + 1);
+	if (!needle)
+	{
+		fprintf(stderr, "dbc index query allocation failed\n");
+		return false;
+	}
+	for (size_t i = 0; i <= needle_len; ++i)
+		needle[i] = ascii_lower(query[i]);
+	uint32_t key_record;
+	bool has_key = query_key(index, query, &key_record);
+	if (!query_strings(index, needle, needle_len, &result))
+		fprintf(stderr, "dbc index query allocation failed\n");
+	free(needle);
+	/* the primary key match goes at its place in the records order */
+	if (has_key)
+	{
+		uint32_t *data = result.data;
+		size_t pos = 0;
+		while (pos < result.size && data[pos] < key_record)
+			pos++;
+		if (pos == result.size || data[pos] != key_record)
+			jks_array_push(&result, &key_record, pos);
+	}
+	*count = result.size;
+	*records = malloc(sizeof(**records) * (result.size ? result.size : 1));
+	if (!*records)
+	{
+		fprintf(stderr, "dbc index query allocation failed\n");
+		jks_array_destroy(&result);
+		return false;
+	}
+	if (result.size)
+		memcpy(*records, result.data, sizeof(**records) * result.size);
+	jks_array_destroy(&result);
+	return true;
+}
@@ -0,0 +1,30 @@
+#ifndef EXPLORER_DBC_INDEX_H
+#define EXPLORER_DBC_INDEX_H
+
+#include "dbc_model.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+
+struct dbc_index;
+
+typedef void (*dbc_index_ready_t)(struct dbc_index *index, void *userdata);
+
+/* search index of a dbc: hash of the primary key (first column) and trigrams
+ * of the string columns
+ * it is built on a background thread, on_ready is then called on the main thread
+ */
+struct dbc_index *dbc_index_new(DbcModel *model, dbc_index_ready_t on_ready, void *userdata);
+
+/* drop the ready callback and the caller reference */
+void dbc_index_detach(struct dbc_index *index);
+bool dbc_index_ready(struct dbc_index *index);
+
+/* records whose primary key equals the query, or with a string column
+ * containing it (ascii case insensitive), in records order
+ * strings are only matched by queries of at least 3 characters
+ * records must be freed, returns false if the index isn't built yet
+ */
+bool dbc_index_query(struct dbc_index *index, const char *query, uint32_t **records, uint32_t *count);
+
+#endif
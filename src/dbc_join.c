@@ -0,0 +1,590 @@
+#include "utils/dbc_layout.h"
+
+#include "file_cache.h"
+#include "explorer.h"
+#include "dbc_join.h"
+
+#include <libwow/dbc.h>
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+
+static const struct
+{
+	const char *file;
+	const struct wow_dbc_def *def;
+} defs[] =
+{
+	{"animationdata.dbc"            , wow_dbc_animation_data_def},
+	{"areapoi.dbc"                  , wow_dbc_area_poi_def},
+	{"areatable.dbc"                , wow_dbc_area_table_def},
+	{"auctionhouse.dbc"             , wow_dbc_auction_house_def},
+	{"charbaseinfo.dbc"             , wow_dbc_char_base_info_def},
+	{"charhairgeosets.dbc"          , wow_dbc_char_hair_geosets_def},
+	{"charhairtextures.dbc"         , wow_dbc_char_hair_textures_def},
+	{"charsections.dbc"             , wow_dbc_char_sections_def},
+	{"charstartoutfit.dbc"          , wow_dbc_char_start_outfit_def},
+	{"chartitles.dbc"               , wow_dbc_char_titles_def},
+	{"characterfacialhairstyles.dbc", wow_dbc_character_facial_hair_styles_def},
+	{"chatprofanity.dbc"            , wow_dbc_chat_profanity_def},
+	{"chrclasses.dbc"               , wow_dbc_chr_classes_def},
+	{"chrraces.dbc"                 , wow_dbc_chr_races_def},
+	{"creaturedisplayinfo.dbc"      , wow_dbc_creature_display_info_def},
+	{"creaturedisplayinfoextra.dbc" , wow_dbc_creature_display_info_extra_def},
+	{"creaturemodeldata.dbc"        , wow_dbc_creature_model_data_def},
+	{"gameobjectdisplayinfo.dbc"    , wow_dbc_game_object_display_info_def},
+	{"groundeffecttexture.dbc"      , wow_dbc_ground_effect_texture_def},
+	{"groundeffectdoodad.dbc"       , wow_dbc_ground_effect_doodad_def},
+	{"helmetgeosetvisdata.dbc"      , wow_dbc_helmet_geoset_vis_data_def},
+	{"item.dbc"                     , wow_dbc_item_def},
+	{"itemclass.dbc"                , wow_dbc_item_class_def},
+	{"itemdisplayinfo.dbc"          , wow_dbc_item_display_info_def},
+	{"itemset.dbc"                  , wow_dbc_item_set_def},
+	{"itemsubclass.dbc"             , wow_dbc_item_sub_class_def},
+	{"light.dbc"                    , wow_dbc_light_def},
+	{"lightfloatband.dbc"           , wow_dbc_light_float_band_def},
+	{"lightintband.dbc"             , wow_dbc_light_int_band_def},
+	{"lightparams.dbc"              , wow_dbc_light_params_def},
+	{"lightskybox.dbc"              , wow_dbc_light_skybox_def},
+	{"liquidtype.dbc"               , wow_dbc_liquid_type_def},
+	{"loadingscreens.dbc"           , wow_dbc_loading_screens_def},
+	{"loadingscreentaxisplines.dbc" , wow_dbc_loading_screen_taxi_splines_def},
+	{"map.dbc"                      , wow_dbc_map_def},
+	{"namegen.dbc"                  , wow_dbc_name_gen_def},
+	{"soundentries.dbc"             , wow_dbc_sound_entries_def},
+	{"spell.dbc"                    , wow_dbc_spell_def},
+	{"spellicon.dbc"                , wow_dbc_spell_icon_def},
+	{"talent.dbc"                   , wow_dbc_talent_def},
+	{"talenttab.dbc"                , wow_dbc_talent_tab_def},
+	{"taxinodes.dbc"                , wow_dbc_taxi_nodes_def},
+	{"taxipath.dbc"                 , wow_dbc_taxi_path_def},
+	{"taxipathnode.dbc"             , wow_dbc_taxi_path_node_def},
+	{"worldmaparea.dbc"             , wow_dbc_world_map_area_def},
+	{"worldmapcontinent.dbc"        , wow_dbc_world_map_continent_def},
+	{"worldmapoverlay.dbc"          , wow_dbc_world_map_overlay_def},
+	{"worldmaptransforms.dbc"       , wow_dbc_world_map_transforms_def},
+	{"wowerror_strings.dbc"         , wow_dbc_wow_error_strings_def},
+};
+
+static const struct
+{
+	const char *file;
+	const char *column;
+	const char *target;
+} foreign_keys[] =
+{
+	{"areapoi.dbc"                 , "area"                 , "areatable.dbc"},
+	{"areatable.dbc"               , "map"                  , "map.dbc"},
+	{"areatable.dbc"               , "parent"               , "areatable.dbc"},
+	{"charbaseinfo.dbc"            , "race"                 , "chrraces.dbc"},
+	{"charbaseinfo.dbc"            , "class"                , "chrclasses.dbc"},
+	{"charhairgeosets.dbc"         , "race"                 , "chrraces.dbc"},
+	{"charsections.dbc"            , "race"                 , "chrraces.dbc"},
+	{"charstartoutfit.dbc"         , "race"                 , "chrraces.dbc"},
+	{"charstartoutfit.dbc"         , "class"                , "chrclasses.dbc"},
+	{"creaturedisplayinfo.dbc"     , "model"                , "creaturemodeldata.dbc"},
+	{"creaturedisplayinfo.dbc"     , "extra"                , "creaturedisplayinfoextra.dbc"},
+	{"creaturedisplayinfoextra.dbc", "race"                 , "chrraces.dbc"},
+	{"item.dbc"                    , "display_info"         , "itemdisplayinfo.dbc"},
+	{"itemsubclass.dbc"            , "class"                , "itemclass.dbc"},
+	{"light.dbc"                   , "map"                  , "map.dbc"},
+	{"spell.dbc"                   , "spell_icon"           , "spellicon.dbc"},
+	{"talent.dbc"                  , "tab"                  , "talenttab.dbc"},
+	{"taxinodes.dbc"               , "map"                  , "map.dbc"},
+	{"taxipath.dbc"                , "from"                 , "taxinodes.dbc"},
+	{"taxipath.dbc"                , "to"                   , "taxinodes.dbc"},
+	{"taxipathnode.dbc"            , "path"                 , "taxipath.dbc"},
+	{"taxipathnode.dbc"            , "map"                  , "map.dbc"},
+	{"worldmaparea.dbc"            , "map"                  , "map.dbc"},
+	{"worldmaparea.dbc"            , "area"                 , "areatable.dbc"},
+	{"worldmapoverlay.dbc"         , "map_area"             , "worldmaparea.dbc"},
+};
+
+struct dbc_table
+{
+	struct wow_dbc_file *file;
+	const struct wow_dbc_def *def;
+	struct dbc_layout layout;
+	uint32_t *ids; /* open addressing of record + 1 */
+	uint32_t ids_mask;
+	int32_t label; /* first string column */
+};
+
+/* (value << 32 | record) of a referencing column, sorted */
+struct dbc_reverse
+{
+	uint64_t *pairs;
+	uint32_t count;
+};
+
+/* tables and reverses are built by the requests workers, then never change:
+ * the mutex only guards the hash tables
+ */
+struct dbc_join
+{
+	GHashTable *tables; /* file to struct dbc_table*, files failing to load have no dbc */
+	GHashTable *reverses; /* foreign key index to struct dbc_reverse* */
+	GMutex mutex;
+	GCond cond;
+	gint loads; /* running workers, waited for by dbc_join_delete */
+};
+
+struct dbc_join_request
+{
+	struct dbc_join *join;
+	char *file;
+	bool referrers;
+	dbc_join_ready_t on_ready;
+	void *userdata;
+	gint refs;
+	gint ready;
+};
+
+static void table_delete(gpointer data)
+{
+	struct dbc_table *table = data;
+	if (table->file)
+		wow_dbc_file_delete(table->file);
+	dbc_layout_destroy(&table->layout);
+	free(table->ids);
+	free(table);
+}
+
+static void reverse_delete(gpointer data)
+{
+	struct dbc_reverse *reverse = data;
+	free(reverse->pairs);
+	free(reverse);
+}
+
+static bool has_column(const struct wow_dbc_def *def, const char *name)
+{
+	for (size_t i = 0; def[i].type != WOW_DBC_TYPE_END; ++i)
+	{
+		if (!strcmp(def[i].name, name))
+			return true;
+	}
+	return false;
+}
+
+/* a key naming a missing column or file would never resolve, report it */
+static void check_foreign_keys(void)
+{
+	for (size_t i = 0; i < sizeof(foreign_keys) / sizeof(*foreign_keys); ++i)
+	{
+		const struct wow_dbc_def *def = dbc_join_get_def(foreign_keys[i].file);
+		if (!def)
+			g_warning("dbc join: unknown file %s", foreign_keys[i].file);
+		else if (!has_column(def, foreign_keys[i].column))
+			g_warning("dbc join: %s has no column %s", foreign_keys[i].file, foreign_keys[i].column);
+		if (!dbc_join_get_def(foreign_keys[i].target))
+			g_warning("dbc join: unknown target %s of %s %s", foreign_keys[i].target, foreign_keys[i].file, foreign_keys[i].column);
+	}
+}
+
+struct dbc_join *dbc_join_new(void)
+{
+	struct dbc_join *join = malloc(sizeof(*join));
+	if (!join)
+	{
+		fprintf(stderr, "dbc join allocation failed\n");
+		return NULL;
+	}
+	join->tables = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, table_delete);
+	join->reverses = g_hash_table_new_full(g_direct_hash, g_direct_equal, NULL, reverse_delete);
+	g_mutex_init(&join->mutex);
+	g_cond_init(&join->cond);
+	join->loads = 0;
+	check_foreign_keys();
+	return join;
+}
+
+void dbc_join_delete(struct dbc_join *join)
+{
+	if (!join)
+		return;
+	g_mutex_lock(&join->mutex);
+	while (join->loads)
+		g_cond_wait(&join->cond, &join->mutex);
+	g_mutex_unlock(&join->mutex);
+	g_hash_table_destroy(join->reverses);
+	g_hash_table_destroy(join->tables);
+	g_cond_clear(&join->cond);
+	g_mutex_clear(&join->mutex);
+	free(join);
+}
+
+const struct wow_dbc_def *dbc_join_get_def(const char *file)
+{
+	for (size_t i = 0; i < sizeof(defs) / sizeof(*defs); ++i)
+	{
+		if (!strcmp(defs[i].file, file))
+			return defs[i].def;
+	}
+	return NULL;
+}
+
+const char *dbc_join_get_target(const char *file, const char *column)
+{
+	for (size_t i = 0; i < sizeof(foreign_keys) / sizeof(*foreign_keys); ++i)
+	{
+		if (!strcmp(foreign_keys[i].file, file) && !strcmp(foreign_keys[i].column, column))
+			return foreign_keys[i].target;
+	}
+	return NULL;
+}
+
+static int32_t get_column(const struct dbc_table *table, const char *name)
+{
+	for (uint32_t i = 0; i < table->layout.columns_nb; ++i)
+	{
+		if (!strcmp(table->def[i].name, name))
+			return i;
+	}
+	return -1;
+}
+
+static bool is_integer(const struct dbc_table *table, int32_t column)
+{
+	return column >= 0
+	    && (table->layout.columns[column].kind == DBC_VALUE_INT
+	     || table->layout.columns[column].kind == DBC_VALUE_UINT);
+}
+
+static uint32_t id_hash(uint64_t id)
+{
+	id *= 0x9E3779B97F4A7C15ull;
+	return id >> 32;
+}
+
+static bool build_ids(struct dbc_table *table)
+{
+	uint32_t count = table->file->header.record_count;
+	uint32_t size = 16;
+	while (size < count * 2)
+		size *= 2;
+	table->ids = calloc(size, sizeof(*table->ids));
+	if (!table->ids)
+		return false;
+	table->ids_mask = size - 1;
+	struct dbc_column_scan scan;
+	dbc_layout_scan(&table->layout, table->file, 0, &scan);
+	for (uint32_t i = 0; i < count; ++i)
+	{
+		uint32_t slot = id_hash(dbc_scan_get(&scan, i).u) & table->ids_mask;
+		while (table->ids[slot])
+			slot = (slot + 1) & table->ids_mask;
+		table->ids[slot] = i + 1;
+	}
+	return true;
+}
+
+static bool load_table(struct dbc_table *table, const char *name)
+{
+	table->def = dbc_join_get_def(name);
+	if (!table->def)
+		return false;
+	char path[512];
+	snprintf(path, sizeof(path), "DBFilesClient\\%s", name);
+	normalize_mpq_filename(path, sizeof(path));
+	struct wow_mpq_file *mpq_file = file_cache_get(g_explorer->file_cache, path);
+	if (!mpq_file)
+	{
+		fprintf(stderr, "failed to get dbc file '%s'\n", path);
+		return false;
+	}
+	table->file = wow_dbc_file_new(mpq_file);
+	file_cache_release(g_explorer->file_cache, mpq_file);
+	if (!table->file)
+	{
+		fprintf(stderr, "failed to parse dbc file '%s'\n", path);
+		return false;
+	}
+	if (!dbc_layout_init(&table->layout, table->def, table->file)
+	 || !is_integer(table, 0)
+	 || !build_ids(table))
+	{
+		fprintf(stderr, "failed to index dbc file '%s'\n", path);
+		wow_dbc_file_delete(table->file);
+		table->file = NULL;
+		return false;
+	}
+	for (uint32_t i = 0; i < table->layout.columns_nb; ++i)
+	{
+		if (table->layout.columns[i].kind == DBC_VALUE_STRING)
+		{
+			table->label = i;
+			break;
+		}
+	}
+	return true;
+}
+
+/* loaded table, NULL if it failed or isn't loaded yet */
+static struct dbc_table *find_table(struct dbc_join *join, const char *name)
+{
+	g_mutex_lock(&join->mutex);
+	struct dbc_table *table = g_hash_table_lookup(join->tables, name);
+	g_mutex_unlock(&join->mutex);
+	return table && table->file ? table : NULL;
+}
+
+/* workers only: the file is parsed outside of the lock, a concurrent load
+ * of the same file keeps the first one
+ */
+static struct dbc_table *get_table(struct dbc_join *join, const char *name)
+{
+	g_mutex_lock(&join->mutex);
+	struct dbc_table *table = g_hash_table_lookup(join->tables, name);
+	g_mutex_unlock(&join->mutex);
+	if (table)
+		return table->file ? table : NULL;
+	table = calloc(1, sizeof(*table));
+	if (!table)
+	{
+		fprintf(stderr, "dbc table allocation failed\n");
+		return NULL;
+	}
+	table->label = -1;
+	/* failures are kept too, to not load the file again */
+	load_table(table, name);
+	g_mutex_lock(&join->mutex);
+	struct dbc_table *prev = g_hash_table_lookup(join->tables, name);
+	if (prev)
+	{
+		table_delete(table);
+		table = prev;
+	}
+	else
+	{
+		g_hash_table_insert(join->tables, g_strdup(name), table);
+	}
+	g_mutex_unlock(&join->mutex);
+	return table->file ? table : NULL;
+}
+
+static bool find_id(const struct dbc_table *table, uint64_t id, uint32_t *record)
+{
+	uint32_t slot = id_hash(id) & table->ids_mask;
+	while (table->ids[slot])
+	{
+		if (dbc_layout_get(&table->layout, table->file, table->ids[slot] - 1, 0).u == id)
+		{
+			*record = table->ids[slot] - 1;
+			return true;
+		}
+		slot = (slot + 1) & table->ids_mask;
+	}
+	return false;
+}
+
+const char *dbc_join_resolve(struct dbc_join *join, const char *target, uint64_t id)
+{
+	/* called while rendering: only the tables already loaded */
+	struct dbc_table *table = find_table(join, target);
+	uint32_t record;
+	if (!table || table->label < 0 || !find_id(table, id, &record))
+		return NULL;
+	return dbc_layout_get_str(&table->layout, table->file, record, table->label);
+}
+
+static int cmp_u64(const void *a, const void *b)
+{
+	uint64_t va = *(const uint64_t*)a;
+	uint64_t vb = *(const uint64_t*)b;
+	return (va > vb) - (va < vb);
+}
+
+static struct dbc_reverse *find_reverse(struct dbc_join *join, size_t fk)
+{
+	g_mutex_lock(&join->mutex);
+	struct dbc_reverse *reverse = g_hash_table_lookup(join->reverses, GSIZE_TO_POINTER(fk + 1));
+	g_mutex_unlock(&join->mutex);
+	return reverse;
+}
+
+/* workers only, same as get_table */
+static struct dbc_reverse *get_reverse(struct dbc_join *join, size_t fk, struct dbc_table *table, int32_t column)
+{
+	struct dbc_reverse *reverse = find_reverse(join, fk);
+	if (reverse)
+		return reverse;
+	reverse = malloc(sizeof(*reverse));
+	if (!reverse)
+	{
+		fprintf(stderr, "dbc reverse allocation failed\n");
+		return NULL;
+	}
+	reverse->count = table->file->header.record_count;
+	reverse->pairs = malloc(sizeof(*reverse->pairs) * (reverse->count ? reverse->count : 1));
+	if (!reverse->pairs)
+	{
+		fprintf(stderr, "dbc reverse allocation failed\n");
+		free(reverse);
+		return NULL;
+	}
+	struct dbc_column_scan scan;
+	dbc_layout_scan(&table->layout, table->file, column, &scan);
+	for (uint32_t i = 0; i < reverse->count; ++i)
+		reverse->pairs[i] = ((uint64_t)(uint32_t)dbc_scan_get(&scan, i).u << 32) | i;
+	qsort(reverse->pairs, reverse->count, sizeof(*reverse->pairs), cmp_u64);
+	g_mutex_lock(&join->mutex);
+	struct dbc_reverse *prev = g_hash_table_lookup(join->reverses, GSIZE_TO_POINTER(fk + 1));
+	if (prev)
+	{
+		reverse_delete(reverse);
+		reverse = prev;
+	}
+	else
+	{
+		g_hash_table_insert(join->reverses, GSIZE_TO_POINTER(fk + 1), reverse);
+	}
+	g_mutex_unlock(&join->mutex);
+	return reverse;
+}
+
+static void load_targets(struct dbc_join *join, const char *file)
+{
+	for (size_t i = 0; i < sizeof(foreign_keys) / sizeof(*foreign_keys); ++i)
+	{
+		if (!strcmp(foreign_keys[i].file, file))
+			get_table(join, foreign_keys[i].target);
+	}
+}
+
+static void load_referrers(struct dbc_join *join, const char *file)
+{
+	for (size_t i = 0; i < sizeof(foreign_keys) / sizeof(*foreign_keys); ++i)
+	{
+		if (strcmp(foreign_keys[i].target, file))
+			continue;
+		struct dbc_table *table = get_table(join, foreign_keys[i].file);
+		if (!table)
+			continue;
+		int32_t column = get_column(table, foreign_keys[i].column);
+		if (!is_integer(table, column))
+			continue;
+		get_reverse(join, i, table, column);
+	}
+}
+
+static void request_unref(struct dbc_join_request *request)
+{
+	if (!g_atomic_int_dec_and_test(&request->refs))
+		return;
+	free(request->file);
+	free(request);
+}
+
+static gboolean notify_ready(gpointer data)
+{
+	struct dbc_join_request *request = data;
+	if (request->on_ready)
+		request->on_ready(request, request->userdata);
+	request_unref(request);
+	return G_SOURCE_REMOVE;
+}
+
+static gpointer load_request(gpointer data)
+{
+	struct dbc_join_request *request = data;
+	struct dbc_join *join = request->join;
+	if (request->referrers)
+		load_referrers(join, request->file);
+	else
+		load_targets(join, request->file);
+	g_atomic_int_set(&request->ready, 1);
+	g_idle_add(notify_ready, request);
+	/* the request doesn't use the join past this point */
+	g_mutex_lock(&join->mutex);
+	join->loads--;
+	g_cond_broadcast(&join->cond);
+	g_mutex_unlock(&join->mutex);
+	return NULL;
+}
+
+static struct dbc_join_request *request_new(struct dbc_join *join, const char *file, bool referrers, dbc_join_ready_t on_ready, void *userdata)
+{
+	struct dbc_join_request *request = calloc(1, sizeof(*request));
+	if (!request)
+	{
+		fprintf(stderr, "dbc join request allocation failed\n");
+		return NULL;
+	}
+	request->file = strdup(file);
+	if (!request->file)
+	{
+		fprintf(stderr, "dbc join request allocation failed\n");
+		free(request);
+		return NULL;
+	}
+	request->join = join;
+	request->referrers = referrers;
+	request->on_ready = on_ready;
+	request->userdata = userdata;
+	request->refs = 2; /* caller and loader */
+	g_mutex_lock(&join->mutex);
+	join->loads++;
+	g_mutex_unlock(&join->mutex);
+	g_thread_unref(g_thread_new("dbc join", load_request, request));
+	return request;
+}
+
+struct dbc_join_request *dbc_join_load_targets(struct dbc_join *join, const char *file, dbc_join_ready_t on_ready, void *userdata)
+{
+	return request_new(join, file, false, on_ready, userdata);
+}
+
+struct dbc_join_request *dbc_join_load_referrers(struct dbc_join *join, const char *file, dbc_join_ready_t on_ready, void *userdata)
+{
+	return request_new(join, file, true, on_ready, userdata);
+}
+
+void dbc_join_request_detach(struct dbc_join_request *request)
+{
+	if (!request)
+		return;
+	request->on_ready = NULL;
+	request->userdata = NULL;
+	request_unref(request);
+}
+
+bool dbc_join_request_ready(struct dbc_join_request *request)
+{
+	return g_atomic_int_get(&request->ready);
+}
+
+void dbc_join_referrers(struct dbc_join *join, const char *file, uint64_t id, dbc_join_referrer_t fn, void *userdata)
+{
+	if (id > UINT32_MAX)
+		return;
+	for (size_t i = 0; i < sizeof(foreign_keys) / sizeof(*foreign_keys); ++i)
+	{
+		if (strcmp(foreign_keys[i].target, file))
+			continue;
+		/* only what dbc_join_load_referrers built */
+		struct dbc_reverse *reverse = find_reverse(join, i);
+		if (!reverse)
+			continue;
+		struct dbc_table *table = find_table(join, foreign_keys[i].file);
+		if (!table)
+			continue;
+		/* lower bound of the id */
+		uint32_t lo = 0;
+		uint32_t hi = reverse->count;
+		while (lo < hi)
+		{
+			uint32_t mid = lo + (hi - lo) / 2;
+			if ((reverse->pairs[mid] >> 32) < id)
+				lo = mid + 1;
+			else
+				hi = mid;
+		}
+		for (; lo < reverse->count && (reverse->pairs[lo] >> 32) == id; ++lo)
+		{
+			uint32_t record = (uint32_t)reverse->pairs[lo];
+			fn(foreign_keys[i].file, foreign_keys[i].column, dbc_layout_get(&table->layout, table->file, record, 0).u, userdata);
+		}
+	}
+}
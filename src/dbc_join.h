@@ -0,0 +1,50 @@
+#ifndef EXPLORER_DBC_JOIN_H
+#define EXPLORER_DBC_JOIN_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+struct wow_dbc_def;
+struct dbc_join_request;
+struct dbc_join;
+
+typedef void (*dbc_join_referrer_t)(const char *file, const char *column, uint64_t id, void *userdata);
+typedef void (*dbc_join_ready_t)(struct dbc_join_request *request, void *userdata);
+
+/* foreign keys between dbc files
+ * referenced files are loaded once, with a hash of their ids (first column);
+ * reverse indexes of the referencing columns are built once
+ * loading is done by requests on workers, lookups never load anything
+ */
+struct dbc_join *dbc_join_new(void);
+void dbc_join_delete(struct dbc_join *join);
+
+/* definition of a dbc file by its lowercase name, NULL if unknown */
+const struct wow_dbc_def *dbc_join_get_def(const char *file);
+
+/* file referenced by a column, NULL if it isn't a foreign key */
+const char *dbc_join_get_target(const char *file, const char *column);
+
+/* load in the background the files referenced by the foreign keys of file,
+ * or the files referencing it with their reverse indexes
+ * on_ready is called on the main thread, unless the request was detached
+ */
+struct dbc_join_request *dbc_join_load_targets(struct dbc_join *join, const char *file, dbc_join_ready_t on_ready, void *userdata);
+struct dbc_join_request *dbc_join_load_referrers(struct dbc_join *join, const char *file, dbc_join_ready_t on_ready, void *userdata);
+
+/* drop the caller reference, on_ready won't be called anymore */
+void dbc_join_request_detach(struct dbc_join_request *request);
+
+bool dbc_join_request_ready(struct dbc_join_request *request);
+
+/* first string column of the target row with this id, NULL if it doesn't
+ * resolve or if the target isn't loaded yet
+ */
+const char *dbc_join_resolve(struct dbc_join *join, const char *target, uint64_t id);
+
+/* call fn for every row referencing the row with this id of file,
+ * among the files loaded by dbc_join_load_referrers
+ */
+void dbc_join_referrers(struct dbc_join *join, const char *file, uint64_t id, dbc_join_referrer_t fn, void *userdata);
+
+#endif
@@ -0,0 +1,426 @@
+#include "utils/dbc_layout.h"
+#include "utils/dbc_sort.h"
+
+#include "dbc_model.h"
+
+#include <libwow/dbc.h>
+
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+struct _DbcModel
+{
+	GObject parent;
+	struct wow_dbc_file *file;
+	struct dbc_layout layout;
+	uint32_t *rows; /* record index of each row */
+	uint32_t rows_nb;
+	gint sort_column;
+	GtkSortType sort_order;
+	guint sort_generation;
+	gint stamp;
+};
+
+static void dbc_model_tree_model_init(GtkTreeModelIface *iface);
+static void dbc_model_tree_sortable_init(GtkTreeSortableIface *iface);
+
+G_DEFINE_TYPE_WITH_CODE(DbcModel, dbc_model, G_TYPE_OBJECT,
+                        G_IMPLEMENT_INTERFACE(GTK_TYPE_TREE_MODEL, dbc_model_tree_model_init)
+                        G_IMPLEMENT_INTERFACE(GTK_TYPE_TREE_SORTABLE, dbc_model_tree_sortable_init))
+
+static GType column_gtype(const struct dbc_layout_column *column)
+{
+	switch (column->kind)
+	{
+		case DBC_VALUE_INT:
+			return G_TYPE_INT64;
+		case DBC_VALUE_UINT:
+			return G_TYPE_UINT64;
+		case DBC_VALUE_FLOAT:
+			return G_TYPE_FLOAT;
+		case DBC_VALUE_STRING:
+			break;
+	}
+	return G_TYPE_STRING;
+}
+
+static void set_iter(DbcModel *model, GtkTreeIter *iter, uint32_t position)
+{
+	iter->stamp = model->stamp;
+	iter->user_data = GUINT_TO_POINTER(position);
+	iter->user_data2 = NULL;
+	iter->user_data3 = NULL;
+}
+
+static uint32_t get_position(DbcModel *model, GtkTreeIter *iter)
+{
+	g_return_val_if_fail(iter->stamp == model->stamp, 0);
+	return GPOINTER_TO_UINT(iter->user_data);
+}
+
+static GtkTreeModelFlags get_flags(GtkTreeModel *tree_model)
+{
+	(void)tree_model;
+	return GTK_TREE_MODEL_LIST_ONLY;
+}
+
+static gint get_n_columns(GtkTreeModel *tree_model)
+{
+	return DBC_MODEL(tree_model)->layout.columns_nb;
+}
+
+static GType get_column_type(GtkTreeModel *tree_model, gint index)
+{
+	DbcModel *model = DBC_MODEL(tree_model);
+	if (index < 0 || (uint32_t)index >= model->layout.columns_nb)
+		return G_TYPE_INVALID;
+	return column_gtype(&model->layout.columns[index]);
+}
+
+static gboolean get_iter(GtkTreeModel *tree_model, GtkTreeIter *iter, GtkTreePath *path)
+{
+	DbcModel *model = DBC_MODEL(tree_model);
+	gint depth;
+	gint *indices = gtk_tree_path_get_indices_with_depth(path, &depth);
+	if (depth != 1 || indices[0] < 0 || (uint32_t)indices[0] >= model->rows_nb)
+		return FALSE;
+	set_iter(model, iter, indices[0]);
+	return TRUE;
+}
+
+static GtkTreePath *get_path(GtkTreeModel *tree_model, GtkTreeIter *iter)
+{
+	return gtk_tree_path_new_from_indices(get_position(DBC_MODEL(tree_model), iter), -1);
+}
+
+static void get_value(GtkTreeModel *tree_model, GtkTreeIter *iter, gint column, GValue *value)
+{
+	DbcModel *model = DBC_MODEL(tree_model);
+	const struct dbc_layout_column *col = &model->layout.columns[column];
+	uint32_t record = model->rows[get_position(model, iter)];
+	g_value_init(value, column_gtype(col));
+	switch (col->kind)
+	{
+		case DBC_VALUE_INT:
+			g_value_set_int64(value, dbc_layout_get(&model->layout, model->file, record, column).i);
+			break;
+		case DBC_VALUE_UINT:
+			g_value_set_uint64(value, dbc_layout_get(&model->layout, model->file, record, column).u);
+			break;
+		case DBC_VALUE_FLOAT:
+			g_value_set_float(value, dbc_layout_get(&model->layout, model->file, record, column).f);
+			break;
+		case DBC_VALUE_STRING:
+			/* the strings block lives as long as the model */
+			g_value_set_static_string(value, dbc_layout_get_str(&model->layout, model->file, record, column));
+			break;
+	}
+}
+
+static gboolean iter_nth_child(GtkTreeModel *tree_model, GtkTreeIter *iter, GtkTreeIter *parent, gint n)
+{
+	DbcModel *model = DBC_MODEL(tree_model);
+	if (parent || n < 0 || (uint32_t)n >= model->rows_nb)
+		return FALSE;
+	set_iter(model, iter, n);
+	return TRUE;
+}
+
+static gboolean iter_next(GtkTreeModel *tree_model, GtkTreeIter *iter)
+{
+	DbcModel *model = DBC_MODEL(tree_model);
+	uint32_t position = get_position(model, iter);
+	if (position + 1 >= model->rows_nb)
+	{
+		iter->stamp = 0;
+		return FALSE;
+	}
+	set_iter(model, iter, position + 1);
+	return TRUE;
+}
+
+static gboolean iter_previous(GtkTreeModel *tree_model, GtkTreeIter *iter)
+{
+	DbcModel *model = DBC_MODEL(tree_model);
+	uint32_t position = get_position(model, iter);
+	if (!position)
+	{
+		iter->stamp = 0;
+		return FALSE;
+	}
+	set_iter(model, iter, position - 1);
+	return TRUE;
+}
+
+static gboolean iter_children(GtkTreeModel *tree_model, GtkTreeIter *iter, GtkTreeIter *parent)
+{
+	return iter_nth_child(tree_model, iter, parent, 0);
+}
+
+static gboolean iter_has_child(GtkTreeModel *tree_model, GtkTreeIter *iter)
+{
+	(void)tree_model;
+	(void)iter;
+	return FALSE;
+}
+
+static gint iter_n_children(GtkTreeModel *tree_model, GtkTreeIter *iter)
+{
+	if (iter)
+		return 0;
+	return DBC_MODEL(tree_model)->rows_nb;
+}
+
+static gboolean iter_parent(GtkTreeModel *tree_model, GtkTreeIter *iter, GtkTreeIter *child)
+{
+	(void)tree_model;
+	(void)iter;
+	(void)child;
+	return FALSE;
+}
+
+static void dbc_model_tree_model_init(GtkTreeModelIface *iface)
+{
+	iface->get_flags = get_flags;
+	iface->get_n_columns = get_n_columns;
+	iface->get_column_type = get_column_type;
+	iface->get_iter = get_iter;
+	iface->get_path = get_path;
+	iface->get_value = get_value;
+	iface->iter_next = iter_next;
+	iface->iter_previous = iter_previous;
+	iface->iter_children = iter_children;
+	iface->iter_has_child = iter_has_child;
+	iface->iter_n_children = iter_n_children;
+	iface->iter_nth_child = iter_nth_child;
+	iface->iter_parent = iter_parent;
+}
+
+struct sort_job
+{
+	DbcModel *model;
+	uint32_t *rows;
+	uint32_t rows_nb;
+	gint column;
+	GtkSortType order;
+	guint generation;
+	bool sorted;
+};
+
+static void apply_sort(DbcModel *model, uint32_t *rows)
+{
+	gint *new_order = malloc(sizeof(*new_order) * model->rows_nb);
+	uint32_t *positions = malloc(sizeof(*positions) * model->file->header.record_count);
+	if (!new_order || !positions)
+	{
+		fprintf(stderr, "dbc model sort allocation failed\n");
+		free(new_order);
+		free(positions);
+		free(rows);
+		return;
+	}
+	for (uint32_t i = 0; i < model->rows_nb; ++i)
+		positions[model->rows[i]] = i;
+	for (uint32_t i = 0; i < model->rows_nb; ++i)
+		new_order[i] = positions[rows[i]];
+	free(model->rows);
+	model->rows = rows;
+	GtkTreePath *path = gtk_tree_path_new();
+	gtk_tree_model_rows_reordered(GTK_TREE_MODEL(model), path, NULL, new_order);
+	gtk_tree_path_free(path);
+	free(positions);
+	free(new_order);
+}
+
+static gboolean sort_finish(gpointer data)
+{
+	struct sort_job *job = data;
+	DbcModel *model = job->model;
+	/* a newer sort or filter replaced the rows meanwhile */
+	if (job->sorted && job->generation == model->sort_generation)
+	{
+		apply_sort(model, job->rows);
+		job->rows = NULL;
+	}
+	free(job->rows);
+	g_object_unref(model);
+	free(job);
+	return G_SOURCE_REMOVE;
+}
+
+static gpointer sort_run(gpointer data)
+{
+	struct sort_job *job = data;
+	job->sorted = dbc_sort(&job->model->layout, job->model->file, job->column, job->order == GTK_SORT_DESCENDING, job->rows, job->rows_nb);
+	g_idle_add(sort_finish, job);
+	return NULL;
+}
+
+/* the permutation is computed on a worker from a copy of the rows, then
+ * swapped in by the main thread
+ */
+static void sort_rows(DbcModel *model)
+{
+	model->sort_generation++;
+	if (!model->rows_nb)
+		return;
+	struct sort_job *job = malloc(sizeof(*job));
+	if (!job)
+	{
+		fprintf(stderr, "dbc model sort allocation failed\n");
+		return;
+	}
+	job->rows = malloc(sizeof(*job->rows) * model->rows_nb);
+	if (!job->rows)
+	{
+		fprintf(stderr, "dbc model sort allocation failed\n");
+		free(job);
+		return;
+	}
+	memcpy(job->rows, model->rows, sizeof(*job->rows) * model->rows_nb);
+	job->model = g_object_ref(model);
+	job->rows_nb = model->rows_nb;
+	job->column = model->sort_column;
+	job->order = model->sort_order;
+	job->generation = model->sort_generation;
+	job->sorted = false;
+	g_thread_unref(g_thread_new("dbc sort", sort_run, job));
+}
+
+static gboolean get_sort_column_id(GtkTreeSortable *sortable, gint *sort_column_id, GtkSortType *order)
+{
+	DbcModel *model = DBC_MODEL(sortable);
+	if (sort_column_id)
+		*sort_column_id = model->sort_column;
+	if (order)
+		*order = model->sort_order;
+	return model->sort_column >= 0;
+}
+
+static void set_sort_column_id(GtkTreeSortable *sortable, gint sort_column_id, GtkSortType order)
+{
+	DbcModel *model = DBC_MODEL(sortable);
+	if (sort_column_id >= (gint)model->layout.columns_nb)
+		return;
+	if (sort_column_id < 0)
+		sort_column_id = GTK_TREE_SORTABLE_DEFAULT_SORT_COLUMN_ID;
+	if (model->sort_column == sort_column_id && model->sort_order == order)
+		return;
+	model->sort_column = sort_column_id;
+	model->sort_order = order;
+	gtk_tree_sortable_sort_column_changed(sortable);
+	sort_rows(model);
+}
+
+static void set_sort_func(GtkTreeSortable *sortable, gint sort_column_id, GtkTreeIterCompareFunc func, gpointer data, GDestroyNotify destroy)
+{
+	(void)sortable;
+	(void)sort_column_id;
+	(void)func;
+	(void)data;
+	(void)destroy;
+	g_warning("dbc model columns are sorted natively");
+}
+
+static void set_default_sort_func(GtkTreeSortable *sortable, GtkTreeIterCompareFunc func, gpointer data, GDestroyNotify destroy)
+{
+	set_sort_func(sortable, GTK_TREE_SORTABLE_DEFAULT_SORT_COLUMN_ID, func, data, destroy);
+}
+
+static gboolean has_default_sort_func(GtkTreeSortable *sortable)
+{
+	(void)sortable;
+	/* the record order */
+	return TRUE;
+}
+
+static void dbc_model_tree_sortable_init(GtkTreeSortableIface *iface)
+{
+	iface->get_sort_column_id = get_sort_column_id;
+	iface->set_sort_column_id = set_sort_column_id;
+	iface->set_sort_func = set_sort_func;
+	iface->set_default_sort_func = set_default_sort_func;
+	iface->has_default_sort_func = has_default_sort_func;
+}
+
+static void dbc_model_finalize(GObject *object)
+{
+	DbcModel *model = DBC_MODEL(object);
+	wow_dbc_file_delete(model->file);
+	dbc_layout_destroy(&model->layout);
+	free(model->rows);
+	G_OBJECT_CLASS(dbc_model_parent_class)->finalize(object);
+}
+
+static void dbc_model_class_init(DbcModelClass *klass)
+{
+	G_OBJECT_CLASS(klass)->finalize = dbc_model_finalize;
+}
+
+static void dbc_model_init(DbcModel *model)
+{
+	model->file = NULL;
+	model->layout.columns = NULL;
+	model->layout.columns_nb = 0;
+	model->rows = NULL;
+	model->rows_nb = 0;
+	model->sort_column = GTK_TREE_SORTABLE_DEFAULT_SORT_COLUMN_ID;
+	model->sort_order = GTK_SORT_ASCENDING;
+	model->sort_generation = 0;
+	model->stamp = g_random_int();
+}
+
+DbcModel *dbc_model_new(struct wow_dbc_file *file, const struct wow_dbc_def *def)
+{
+	DbcModel *model = g_object_new(DBC_TYPE_MODEL, NULL);
+	model->file = file;
+	model->rows_nb = file->header.record_count;
+	model->rows = malloc(sizeof(*model->rows) * (model->rows_nb ? model->rows_nb : 1));
+	if (!model->rows || !dbc_layout_init(&model->layout, def, file))
+	{
+		fprintf(stderr, "dbc model allocation failed\n");
+		g_object_unref(model);
+		return NULL;
+	}
+	for (uint32_t i = 0; i < model->rows_nb; ++i)
+		model->rows[i] = i;
+	return model;
+}
+
+const struct wow_dbc_file *dbc_model_get_file(DbcModel *model)
+{
+	return model->file;
+}
+
+const struct dbc_layout *dbc_model_get_layout(DbcModel *model)
+{
+	return &model->layout;
+}
+
+void dbc_model_set_filter(DbcModel *model, uint32_t *records, uint32_t count)
+{
+	if (!records)
+	{
+		count = model->file->header.record_count;
+		records = malloc(sizeof(*records) * (count ? count : 1));
+		if (!records)
+		{
+			fprintf(stderr, "dbc model rows allocation failed\n");
+			return;
+		}
+		for (uint32_t i = 0; i < count; ++i)
+			records[i] = i;
+	}
+	free(model->rows);
+	model->rows = records;
+	model->rows_nb = count;
+	model->stamp++;
+	/* the records come in record order: the current sort runs on the worker
+	 * and is applied as a reorder, once the view is attached again
+	 */
+	if (model->sort_column >= 0)
+		sort_rows(model);
+	else
+		model->sort_generation++;
+}
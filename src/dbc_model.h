@@ -0,0 +1,35 @@
+#ifndef EXPLORER_DBC_MODEL_H
+#define EXPLORER_DBC_MODEL_H
+
+#include <gtk/gtk.h>
+
+#include <stdint.h>
+
+struct wow_dbc_file;
+struct wow_dbc_def;
+struct dbc_layout;
+
+/* GtkTreeModel reading the cells on demand from the dbc records
+ * rows are served through a permutation of the record indexes, changed by
+ * GtkTreeSortable; the permutation is sorted on a worker and applied as a
+ * rows reorder; iters hold the row position (user_data), so they don't
+ * persist across a reorder
+ * the model takes ownership of the file
+ */
+
+#define DBC_TYPE_MODEL dbc_model_get_type()
+G_DECLARE_FINAL_TYPE(DbcModel, dbc_model, DBC, MODEL, GObject)
+
+/* def may be NULL, the records are then shown as u32 columns */
+DbcModel *dbc_model_new(struct wow_dbc_file *file, const struct wow_dbc_def *def);
+const struct wow_dbc_file *dbc_model_get_file(DbcModel *model);
+const struct dbc_layout *dbc_model_get_layout(DbcModel *model);
+
+/* restrict the rows to the given records, in record order
+ * the model takes ownership of records, NULL shows every record
+ * no row signal is emitted: the model must be detached from its view; the
+ * current sort is then computed on a worker and applied as a rows reorder
+ */
+void dbc_model_set_filter(DbcModel *model, uint32_t *records, uint32_t count);
+
+#endif
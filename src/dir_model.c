@@ -0,0 +1,413 @@
+#include "dir_model.h"
+#include "nodes.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+struct _DirModel
+{
+	GObject parent;
+	struct node *node;
+	uint32_t *rows; /* child index of each row */
+	uint32_t rows_nb;
+	gint sort_column;
+	GtkSortType sort_order;
+	gint stamp;
+};
+
+static void dir_model_tree_model_init(GtkTreeModelIface *iface);
+static void dir_model_tree_sortable_init(GtkTreeSortableIface *iface);
+
+G_DEFINE_TYPE_WITH_CODE(DirModel, dir_model, G_TYPE_OBJECT,
+                        G_IMPLEMENT_INTERFACE(GTK_TYPE_TREE_MODEL, dir_model_tree_model_init)
+                        G_IMPLEMENT_INTERFACE(GTK_TYPE_TREE_SORTABLE, dir_model_tree_sortable_init))
+
+static void set_iter(DirModel *model, GtkTreeIter *iter, uint32_t position)
+{
+	iter->stamp = model->stamp;
+	iter->user_data = GUINT_TO_POINTER(position);
+	iter->user_data2 = NULL;
+	iter->user_data3 = NULL;
+}
+
+static uint32_t get_position(DirModel *model, GtkTreeIter *iter)
+{
+	g_return_val_if_fail(iter->stamp == model->stamp, 0);
+	return GPOINTER_TO_UINT(iter->user_data);
+}
+
+/* directories report the totals of their subtree */
+static bool get_sizes(const struct node *node, uint64_t *file_size, uint64_t *block_size)
+{
+	if (node_is_dir(node))
+	{
+		if (!node->stats)
+			return false;
+		*file_size = node->stats->file_size;
+		*block_size = node->stats->block_size;
+		return true;
+	}
+	if (node->block.archive == NODE_NO_ARCHIVE)
+		return false;
+	*file_size = node->block.file_size;
+	*block_size = node->block.block_size;
+	return true;
+}
+
+static float compression(const struct node *node)
+{
+	uint64_t file_size;
+	uint64_t block_size;
+	if (!get_sizes(node, &file_size, &block_size) || !file_size)
+		return 0;
+	return (double)block_size / file_size;
+}
+
+static GtkTreeModelFlags get_flags(GtkTreeModel *tree_model)
+{
+	(void)tree_model;
+	return GTK_TREE_MODEL_LIST_ONLY;
+}
+
+static gint get_n_columns(GtkTreeModel *tree_model)
+{
+	(void)tree_model;
+	return DIR_COLUMNS_NB;
+}
+
+static GType get_column_type(GtkTreeModel *tree_model, gint index)
+{
+	(void)tree_model;
+	switch (index)
+	{
+		case DIR_COLUMN_NAME:
+			return G_TYPE_STRING;
+		case DIR_COLUMN_OFFSET:
+		case DIR_COLUMN_FLAGS:
+			return G_TYPE_UINT;
+		case DIR_COLUMN_BLOCK_SIZE:
+		case DIR_COLUMN_FILE_SIZE:
+			return G_TYPE_UINT64;
+		case DIR_COLUMN_COMPRESSION:
+			return G_TYPE_FLOAT;
+		case DIR_COLUMN_NODE:
+			return G_TYPE_POINTER;
+	}
+	return G_TYPE_INVALID;
+}
+
+static gboolean get_iter(GtkTreeModel *tree_model, GtkTreeIter *iter, GtkTreePath *path)
+{
+	DirModel *model = DIR_MODEL(tree_model);
+	gint depth;
+	gint *indices = gtk_tree_path_get_indices_with_depth(path, &depth);
+	if (depth != 1 || indices[0] < 0 || (uint32_t)indices[0] >= model->rows_nb)
+		return FALSE;
+	set_iter(model, iter, indices[0]);
+	return TRUE;
+}
+
+static GtkTreePath *get_path(GtkTreeModel *tree_model, GtkTreeIter *iter)
+{
+	return gtk_tree_path_new_from_indices(get_position(DIR_MODEL(tree_model), iter), -1);
+}
+
+static void get_value(GtkTreeModel *tree_model, GtkTreeIter *iter, gint column, GValue *value)
+{
+	DirModel *model = DIR_MODEL(tree_model);
+	struct node *node = model->node->childs[model->rows[get_position(model, iter)]];
+	uint64_t file_size = 0;
+	uint64_t block_size = 0;
+	get_sizes(node, &file_size, &block_size);
+	g_value_init(value, get_column_type(tree_model, column));
+	switch (column)
+	{
+		case DIR_COLUMN_NAME:
+			g_value_set_static_string(value, node->name);
+			break;
+		case DIR_COLUMN_OFFSET:
+			g_value_set_uint(value, node->block.offset);
+			break;
+		case DIR_COLUMN_BLOCK_SIZE:
+			g_value_set_uint64(value, block_size);
+			break;
+		case DIR_COLUMN_FILE_SIZE:
+			g_value_set_uint64(value, file_size);
+			break;
+		case DIR_COLUMN_COMPRESSION:
+			g_value_set_float(value, compression(node));
+			break;
+		case DIR_COLUMN_FLAGS:
+			g_value_set_uint(value, node->block.flags);
+			break;
+		case DIR_COLUMN_NODE:
+			g_value_set_pointer(value, node);
+			break;
+	}
+}
+
+static gboolean iter_nth_child(GtkTreeModel *tree_model, GtkTreeIter *iter, GtkTreeIter *parent, gint n)
+{
+	DirModel *model = DIR_MODEL(tree_model);
+	if (parent || n < 0 || (uint32_t)n >= model->rows_nb)
+		return FALSE;
+	set_iter(model, iter, n);
+	return TRUE;
+}
+
+static gboolean iter_next(GtkTreeModel *tree_model, GtkTreeIter *iter)
+{
+	DirModel *model = DIR_MODEL(tree_model);
+	uint32_t position = get_position(model, iter);
+	if (position + 1 >= model->rows_nb)
+	{
+		iter->stamp = 0;
+		return FALSE;
+	}
+	set_iter(model, iter, position + 1);
+	return TRUE;
+}
+
+static gboolean iter_previous(GtkTreeModel *tree_model, GtkTreeIter *iter)
+{
+	DirModel *model = DIR_MODEL(tree_model);
+	uint32_t position = get_position(model, iter);
+	if (!position)
+	{
+		iter->stamp = 0;
+		return FALSE;
+	}
+	set_iter(model, iter, position - 1);
+	return TRUE;
+}
+
+static gboolean iter_children(GtkTreeModel *tree_model, GtkTreeIter *iter, GtkTreeIter *parent)
+{
+	return iter_nth_child(tree_model, iter, parent, 0);
+}
+
+static gboolean iter_has_child(GtkTreeModel *tree_model, GtkTreeIter *iter)
+{
+	(void)tree_model;
+	(void)iter;
+	return FALSE;
+}
+
+static gint iter_n_children(GtkTreeModel *tree_model, GtkTreeIter *iter)
+{
+	if (iter)
+		return 0;
+	return DIR_MODEL(tree_model)->rows_nb;
+}
+
+static gboolean iter_parent(GtkTreeModel *tree_model, GtkTreeIter *iter, GtkTreeIter *child)
+{
+	(void)tree_model;
+	(void)iter;
+	(void)child;
+	return FALSE;
+}
+
+static void dir_model_tree_model_init(GtkTreeModelIface *iface)
+{
+	iface->get_flags = get_flags;
+	iface->get_n_columns = get_n_columns;
+	iface->get_column_type = get_column_type;
+	iface->get_iter = get_iter;
+	iface->get_path = get_path;
+	iface->get_value = get_value;
+	iface->iter_next = iter_next;
+	iface->iter_previous = iter_previous;
+	iface->iter_children = iter_children;
+	iface->iter_has_child = iter_has_child;
+	iface->iter_n_children = iter_n_children;
+	iface->iter_nth_child = iter_nth_child;
+	iface->iter_parent = iter_parent;
+}
+
+#define CMP(a, b) (((a) > (b)) - ((a) < (b)))
+
+/* nodes without value (directories for the block columns, missing files)
+ * come first
+ */
+static int compare_childs(DirModel *model, uint32_t a, uint32_t b)
+{
+	const struct node *na = model->node->childs[a];
+	const struct node *nb = model->node->childs[b];
+	bool ba = !node_is_dir(na) && na->block.archive != NODE_NO_ARCHIVE;
+	bool bb = !node_is_dir(nb) && nb->block.archive != NODE_NO_ARCHIVE;
+	uint64_t file_size[2];
+	uint64_t block_size[2];
+	int ret;
+	switch (model->sort_column)
+	{
+		case DIR_COLUMN_NAME:
+			ret = strcmp(na->name, nb->name);
+			break;
+		case DIR_COLUMN_OFFSET:
+			ret = ba != bb ? CMP(ba, bb) : CMP(na->block.offset, nb->block.offset);
+			break;
+		case DIR_COLUMN_FLAGS:
+			ret = ba != bb ? CMP(ba, bb) : CMP(na->block.flags, nb->block.flags);
+			break;
+		case DIR_COLUMN_BLOCK_SIZE:
+		case DIR_COLUMN_FILE_SIZE:
+		case DIR_COLUMN_COMPRESSION:
+			ba = get_sizes(na, &file_size[0], &block_size[0]);
+			bb = get_sizes(nb, &file_size[1], &block_size[1]);
+			if (ba != bb)
+				ret = CMP(ba, bb);
+			else if (!ba)
+				ret = 0;
+			else if (model->sort_column == DIR_COLUMN_BLOCK_SIZE)
+				ret = CMP(block_size[0], block_size[1]);
+			else if (model->sort_column == DIR_COLUMN_FILE_SIZE)
+				ret = CMP(file_size[0], file_size[1]);
+			else
+				ret = CMP(compression(na), compression(nb));
+			break;
+		default:
+			ret = 0;
+			break;
+	}
+	if (!ret)
+		ret = CMP(a, b);
+	else if (model->sort_order == GTK_SORT_DESCENDING)
+		ret = -ret;
+	return ret;
+}
+
+#undef CMP
+
+static gint compare_rows(gconstpointer a, gconstpointer b, gpointer userdata)
+{
+	return compare_childs(userdata, *(const uint32_t*)a, *(const uint32_t*)b);
+}
+
+static void sort_rows(DirModel *model)
+{
+	if (!model->rows_nb)
+		return;
+	gint *new_order = malloc(sizeof(*new_order) * model->rows_nb);
+	uint32_t *positions = malloc(sizeof(*positions) * model->rows_nb);
+	if (!new_order || !positions)
+	{
+		fprintf(stderr, "dir model sort allocation failed\n");
+		free(new_order);
+		free(positions);
+		return;
+	}
+	for (uint32_t i = 0; i < model->rows_nb; ++i)
+		positions[model->rows[i]] = i;
+	if (model->sort_column >= 0)
+	{
+		g_qsort_with_data(model->rows, model->rows_nb, sizeof(*model->rows), compare_rows, model);
+	}
+	else
+	{
+		for (uint32_t i = 0; i < model->rows_nb; ++i)
+			model->rows[i] = i;
+	}
+	for (uint32_t i = 0; i < model->rows_nb; ++i)
+		new_order[i] = positions[model->rows[i]];
+	GtkTreePath *path = gtk_tree_path_new();
+	gtk_tree_model_rows_reordered(GTK_TREE_MODEL(model), path, NULL, new_order);
+	gtk_tree_path_free(path);
+	free(positions);
+	free(new_order);
+}
+
+static gboolean get_sort_column_id(GtkTreeSortable *sortable, gint *sort_column_id, GtkSortType *order)
+{
+	DirModel *model = DIR_MODEL(sortable);
+	if (sort_column_id)
+		*sort_column_id = model->sort_column;
+	if (order)
+		*order = model->sort_order;
+	return model->sort_column >= 0;
+}
+
+static void set_sort_column_id(GtkTreeSortable *sortable, gint sort_column_id, GtkSortType order)
+{
+	DirModel *model = DIR_MODEL(sortable);
+	if (sort_column_id >= DIR_COLUMN_NODE)
+		return;
+	if (sort_column_id < 0)
+		sort_column_id = GTK_TREE_SORTABLE_DEFAULT_SORT_COLUMN_ID;
+	if (model->sort_column == sort_column_id && model->sort_order == order)
+		return;
+	model->sort_column = sort_column_id;
+	model->sort_order = order;
+	gtk_tree_sortable_sort_column_changed(sortable);
+	sort_rows(model);
+}
+
+static void set_sort_func(GtkTreeSortable *sortable, gint sort_column_id, GtkTreeIterCompareFunc func, gpointer data, GDestroyNotify destroy)
+{
+	(void)sortable;
+	(void)sort_column_id;
+	(void)func;
+	(void)data;
+	(void)destroy;
+	g_warning("dir model columns are sorted natively");
+}
+
+static void set_default_sort_func(GtkTreeSortable *sortable, GtkTreeIterCompareFunc func, gpointer data, GDestroyNotify destroy)
+{
+	set_sort_func(sortable, GTK_TREE_SORTABLE_DEFAULT_SORT_COLUMN_ID, func, data, destroy);
+}
+
+static gboolean has_default_sort_func(GtkTreeSortable *sortable)
+{
+	(void)sortable;
+	/* the node order */
+	return TRUE;
+}
+
+static void dir_model_tree_sortable_init(GtkTreeSortableIface *iface)
+{
+	iface->get_sort_column_id = get_sort_column_id;
+	iface->set_sort_column_id = set_sort_column_id;
+	iface->set_sort_func = set_sort_func;
+	iface->set_default_sort_func = set_default_sort_func;
+	iface->has_default_sort_func = has_default_sort_func;
+}
+
+static void dir_model_finalize(GObject *object)
+{
+	DirModel *model = DIR_MODEL(object);
+	free(model->rows);
+	G_OBJECT_CLASS(dir_model_parent_class)->finalize(object);
+}
+
+static void dir_model_class_init(DirModelClass *klass)
+{
+	G_OBJECT_CLASS(klass)->finalize = dir_model_finalize;
+}
+
+static void dir_model_init(DirModel *model)
+{
+	model->node = NULL;
+	model->rows = NULL;
+	model->rows_nb = 0;
+	model->sort_column = GTK_TREE_SORTABLE_DEFAULT_SORT_COLUMN_ID;
+	model->sort_order = GTK_SORT_ASCENDING;
+	model->stamp = g_random_int();
+}
+
+DirModel *dir_model_new(struct node *node)
+{
+	DirModel *model = g_object_new(DIR_TYPE_MODEL, NULL);
+	model->node = node;
+	model->rows_nb = node->childs_nb;
+	model->rows = malloc(sizeof(*model->rows) * (model->rows_nb ? model->rows_nb : 1));
+	if (!model->rows)
+	{
+		fprintf(stderr, "dir model allocation failed\n");
+		g_object_unref(model);
+		return NULL;
+	}
+	for (uint32_t i = 0; i < model->rows_nb; ++i)
+		model->rows[i] = i;
+	return model;
+}
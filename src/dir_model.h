@@ -0,0 +1,33 @@
+#ifndef EXPLORER_DIR_MODEL_H
+#define EXPLORER_DIR_MODEL_H
+
+#include <gtk/gtk.h>
+
+struct node;
+
+enum
+{
+	DIR_COLUMN_NAME,
+	DIR_COLUMN_OFFSET,
+	DIR_COLUMN_BLOCK_SIZE,
+	DIR_COLUMN_FILE_SIZE,
+	DIR_COLUMN_COMPRESSION,
+	DIR_COLUMN_FLAGS,
+	DIR_COLUMN_NODE,
+	DIR_COLUMNS_NB,
+};
+
+/* GtkTreeModel over the childs of a directory node, reading the cells on
+ * demand from the node blocks (the subtree totals for the directories); the
+ * raw values are served, the view formats them
+ * rows are a permutation of the childs, sorted on the raw values by
+ * GtkTreeSortable; iters hold the row position (user_data), so they don't
+ * persist across a reorder
+ */
+
+#define DIR_TYPE_MODEL dir_model_get_type()
+G_DECLARE_FINAL_TYPE(DirModel, dir_model, DIR, MODEL, GObject)
+
+DirModel *dir_model_new(struct node *node);
+
+#endif
@@ -28,7 +28,7 @@ static void dtr(struct display *ptr)
 	wow_adt_file_delete(display->file);
 }
 
-struct display *adt_display_new(const struct node *node, const char *path, struct wow_mpq_file *mpq_file)
+struct display *adt_display_new(const struct node *node, const char *path, struct wow_mpq_file *mpq_file, void *parsed)
 {
 	(void)node;
 	(void)path;
@@ -60,7 +60,7 @@ struct display *adt_display_new(const struct node *node, const char *path, struc
 	     Textures
 	     Next is everything available in MCNK but generalized over all the chunks (textures, height, ...)
 	 */
-	struct wow_adt_file *file = wow_adt_file_new(mpq_file);
+	struct wow_adt_file *file = parsed ? parsed : wow_adt_file_new(mpq_file);
 	if (!file)
 	{
 		fprintf(stderr, "failed to parse adt file\n");
@@ -3,6 +3,9 @@
 #include "utils/blp.h"
 #include "utils/bc.h"
 
+#include "texture_cache.h"
+#include "explorer.h"
+
 #include <libwow/blp.h>
 
 #include <inttypes.h>
@@ -11,6 +14,7 @@ struct blp_display
 {
 	struct display display;
 	struct wow_blp_file *file;
+	char *path;
 	GtkWidget *gtk_display;
 	GtkWidget *image;
 };
@@ -29,13 +33,13 @@ static void dtr(struct display *ptr)
 {
 	struct blp_display *display = (struct blp_display*)ptr;
 	wow_blp_file_delete(display->file);
+	free(display->path);
 }
 
-struct display *blp_display_new(const struct node *node, const char *path, struct wow_mpq_file *mpq_file)
+struct display *blp_display_new(const struct node *node, const char *path, struct wow_mpq_file *mpq_file, void *parsed)
 {
 	(void)node;
-	(void)path;
-	struct wow_blp_file *file = wow_blp_file_new(mpq_file);
+	struct wow_blp_file *file = parsed ? parsed : wow_blp_file_new(mpq_file);
 	if (!file)
 	{
 		fprintf(stderr, "failed to parse blp file\n");
@@ -48,6 +52,14 @@ struct display *blp_display_new(const struct node *node, const char *path, struc
 		wow_blp_file_delete(file);
 		return NULL;
 	}
+	display->path = strdup(path);
+	if (!display->path)
+	{
+		fprintf(stderr, "blp display path allocation failed\n");
+		wow_blp_file_delete(file);
+		free(display);
+		return NULL;
+	}
 	display->display.dtr = dtr;
 	display->file = file;
 	display->image = NULL;
@@ -185,21 +197,72 @@ static void on_gtk_mipmap_row_activated(GtkTreeView *tree, GtkTreePath *path, Gt
 	set_mipmap_box(display, val);
 }
 
-static void set_mipmap_box(struct blp_display *display, uint32_t mipmap_id)
+static GdkPixbuf *new_pixbuf(struct blp_display *display, struct blp_rgba *rgba)
 {
-	uint8_t *data;
-	uint32_t width;
-	uint32_t height;
 	uint32_t line_width;
-	if (!blp_decode_rgba(display->file, mipmap_id, &width, &height, &data))
-		return;
-	if (width < 4 && display->file->header.type == 1 && display->file->header.compression == 2)
+	if (rgba->width < 4 && display->file->header.type == 1 && display->file->header.compression == 2)
 		line_width = 16;
 	else
-		line_width = width * 4;
+		line_width = rgba->width * 4;
+	return gdk_pixbuf_new_from_data(rgba->data, GDK_COLORSPACE_RGB, true, 8, rgba->width, rgba->height, line_width, dummy_free, NULL);
+}
+
+/* the whole chain is decoded at once so that going through the mipmaps
+ * only hits the texture cache
+ */
+static GdkPixbuf *decode_mipmaps(struct blp_display *display, uint32_t mipmap_id)
+{
+	struct texture_cache *cache = g_explorer->texture_cache;
+	struct blp_rgba *mipmaps = malloc(sizeof(*mipmaps) * (display->file->mipmaps_nb ? display->file->mipmaps_nb : 1));
+	if (!mipmaps)
+	{
+		fprintf(stderr, "blp mipmaps allocation failed\n");
+		return NULL;
+	}
+	if (!blp_decode_rgba_mipmaps(display->file, mipmaps))
+	{
+		free(mipmaps);
+		return NULL;
+	}
+	GdkPixbuf *ret = NULL;
+	for (uint32_t i = 0; i < display->file->mipmaps_nb; ++i)
+	{
+		GdkPixbuf *pixbuf = new_pixbuf(display, &mipmaps[i]);
+		if (!pixbuf)
+		{
+			free(mipmaps[i].data);
+			continue;
+		}
+		if (cache)
+			texture_cache_put(cache, display->path, i, pixbuf);
+		if (i == mipmap_id)
+			ret = pixbuf;
+		else
+			g_object_unref(pixbuf);
+	}
+	free(mipmaps);
+	return ret;
+}
+
+static void set_mipmap_box(struct blp_display *display, uint32_t mipmap_id)
+{
+	struct texture_cache *cache = g_explorer->texture_cache;
+	GdkPixbuf *pixbuf = cache ? texture_cache_get(cache, display->path, mipmap_id) : NULL;
+	if (!pixbuf)
+	{
+		pixbuf = decode_mipmaps(display, mipmap_id);
+		if (!pixbuf)
+			return;
+	}
 	if (display->image)
-		gtk_widget_destroy(display->image);
-	display->image = gtk_image_new_from_pixbuf(gdk_pixbuf_new_from_data(data, GDK_COLORSPACE_RGB, true, 8, width, height, line_width, dummy_free, NULL));
-	gtk_widget_show(display->image);
-	gtk_box_pack_start(GTK_BOX(display->gtk_display), display->image, false, false, 0);
+	{
+		gtk_image_set_from_pixbuf(GTK_IMAGE(display->image), pixbuf);
+	}
+	else
+	{
+		display->image = gtk_image_new_from_pixbuf(pixbuf);
+		gtk_widget_show(display->image);
+		gtk_box_pack_start(GTK_BOX(display->gtk_display), display->image, false, false, 0);
+	}
+	g_object_unref(pixbuf);
 }
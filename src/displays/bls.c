@@ -21,11 +21,11 @@ static void dtr(struct display *ptr)
 	wow_bls_file_delete(display->file);
 }
 
-struct display *bls_display_new(const struct node *node, const char *path, struct wow_mpq_file *mpq_file)
+struct display *bls_display_new(const struct node *node, const char *path, struct wow_mpq_file *mpq_file, void *parsed)
 {
 	(void)node;
 	(void)path;
-	struct wow_bls_file *file = wow_bls_file_new(mpq_file);
+	struct wow_bls_file *file = parsed ? parsed : wow_bls_file_new(mpq_file);
 	if (!file)
 	{
 		fprintf(stderr, "failed to parse bls file\n");
@@ -1,5 +1,11 @@
 #include "displays/display.h"
 
+#include "utils/dbc_layout.h"
+
+#include "explorer.h"
+#include "dbc_index.h"
+#include "dbc_model.h"
+#include "dbc_join.h"
 #include "nodes.h"
 
 #include <libwow/dbc.h>
@@ -7,100 +13,161 @@
 #include <inttypes.h>
 #include <stdbool.h>
 
-#define VALUE_SET_I64(v) \
-do \
-{ \
-	g_value_init(&value, G_TYPE_INT64); \
-	g_value_set_int64(&value, v); \
-} while (0)
-
-#define VALUE_SET_U64(v) \
-do \
-{ \
-	g_value_init(&value, G_TYPE_UINT64); \
-	g_value_set_uint64(&value, v); \
-} while (0)
-
-#define VALUE_SET_FLT(v) \
-do \
-{ \
-	g_value_init(&value, G_TYPE_FLOAT); \
-	g_value_set_float(&value, v); \
-} while (0)
-
-static const struct
-{
-	const char *file;
-	const struct wow_dbc_def *def;
-} defs[] =
+struct dbc_display
 {
-	{"animationdata.dbc"            , wow_dbc_animation_data_def},
-	{"areapoi.dbc"                  , wow_dbc_area_poi_def},
-	{"areatable.dbc"                , wow_dbc_area_table_def},
-	{"auctionhouse.dbc"             , wow_dbc_auction_house_def},
-	{"charbaseinfo.dbc"             , wow_dbc_char_base_info_def},
-	{"charhairgeosets.dbc"          , wow_dbc_char_hair_geosets_def},
-	{"charhairtextures.dbc"         , wow_dbc_char_hair_textures_def},
-	{"charsections.dbc"             , wow_dbc_char_sections_def},
-	{"charstartoutfit.dbc"          , wow_dbc_char_start_outfit_def},
-	{"chartitles.dbc"               , wow_dbc_char_titles_def},
-	{"characterfacialhairstyles.dbc", wow_dbc_character_facial_hair_styles_def},
-	{"chatprofanity.dbc"            , wow_dbc_chat_profanity_def},
-	{"chrclasses.dbc"               , wow_dbc_chr_classes_def},
-	{"chrraces.dbc"                 , wow_dbc_chr_races_def},
-	{"creaturedisplayinfo.dbc"      , wow_dbc_creature_display_info_def},
-	{"creaturedisplayinfoextra.dbc" , wow_dbc_creature_display_info_extra_def},
-	{"creaturemodeldata.dbc"        , wow_dbc_creature_model_data_def},
-	{"gameobjectdisplayinfo.dbc"    , wow_dbc_game_object_display_info_def},
-	{"groundeffecttexture.dbc"      , wow_dbc_ground_effect_texture_def},
-	{"groundeffectdoodad.dbc"       , wow_dbc_ground_effect_doodad_def},
-	{"helmetgeosetvisdata.dbc"      , wow_dbc_helmet_geoset_vis_data_def},
-	{"item.dbc"                     , wow_dbc_item_def},
-	{"itemclass.dbc"                , wow_dbc_item_class_def},
-	{"itemdisplayinfo.dbc"          , wow_dbc_item_display_info_def},
-	{"itemset.dbc"                  , wow_dbc_item_set_def},
-	{"itemsubclass.dbc"             , wow_dbc_item_sub_class_def},
-	{"light.dbc"                    , wow_dbc_light_def},
-	{"lightfloatband.dbc"           , wow_dbc_light_float_band_def},
-	{"lightintband.dbc"             , wow_dbc_light_int_band_def},
-	{"lightparams.dbc"              , wow_dbc_light_params_def},
-	{"lightskybox.dbc"              , wow_dbc_light_skybox_def},
-	{"liquidtype.dbc"               , wow_dbc_liquid_type_def},
-	{"loadingscreens.dbc"           , wow_dbc_loading_screens_def},
-	{"loadingscreentaxisplines.dbc" , wow_dbc_loading_screen_taxi_splines_def},
-	{"map.dbc"                      , wow_dbc_map_def},
-	{"namegen.dbc"                  , wow_dbc_name_gen_def},
-	{"soundentries.dbc"             , wow_dbc_sound_entries_def},
-	{"spell.dbc"                    , wow_dbc_spell_def},
-	{"spellicon.dbc"                , wow_dbc_spell_icon_def},
-	{"talent.dbc"                   , wow_dbc_talent_def},
-	{"talenttab.dbc"                , wow_dbc_talent_tab_def},
-	{"taxinodes.dbc"                , wow_dbc_taxi_nodes_def},
-	{"taxipath.dbc"                 , wow_dbc_taxi_path_def},
-	{"taxipathnode.dbc"             , wow_dbc_taxi_path_node_def},
-	{"worldmaparea.dbc"             , wow_dbc_world_map_area_def},
-	{"worldmapcontinent.dbc"        , wow_dbc_world_map_continent_def},
-	{"worldmapoverlay.dbc"          , wow_dbc_world_map_overlay_def},
-	{"worldmaptransforms.dbc"       , wow_dbc_world_map_transforms_def},
-	{"wowerror_strings.dbc"         , wow_dbc_wow_error_strings_def},
+	struct display display;
+	struct dbc_index *index;
+	struct dbc_join_request *targets;
+	struct dbc_join_request *referrers;
+	uint64_t referrers_id; /* row activated while the referrers are loading */
+	GtkWidget *search;
+	GtkWidget *tree;
+	DbcModel *model;
+	const char *name;
 };
 
-struct dbc_display
+struct foreign_column
 {
-	struct display display;
-	struct wow_dbc_file *file;
+	const char *target;
+	gint column;
 };
 
 static void dtr(struct display *ptr)
 {
 	struct dbc_display *display = (struct dbc_display*)ptr;
-	wow_dbc_file_delete(display->file);
+	dbc_index_detach(display->index);
+	dbc_join_request_detach(display->targets);
+	dbc_join_request_detach(display->referrers);
+	g_object_unref(display->model);
+}
+
+static void apply_filter(struct dbc_display *display)
+{
+	const char *query = gtk_entry_get_text(GTK_ENTRY(display->search));
+	uint32_t *records = NULL;
+	uint32_t count = 0;
+	/* until the index is built, the filter is applied by on_index_ready */
+	if (*query && (!display->index || !dbc_index_query(display->index, query, &records, &count)))
+		return;
+	gtk_tree_view_set_model(GTK_TREE_VIEW(display->tree), NULL);
+	dbc_model_set_filter(display->model, records, count);
+	gtk_tree_view_set_model(GTK_TREE_VIEW(display->tree), GTK_TREE_MODEL(display->model));
+}
+
+static void on_search_changed(GtkSearchEntry *entry, gpointer data)
+{
+	(void)entry;
+	apply_filter(data);
 }
 
-struct display *dbc_display_new(const struct node *node, const char *path, struct wow_mpq_file *mpq_file)
+static uint64_t get_id(GtkTreeModel *model, GtkTreeIter *iter, gint column)
+{
+	GValue value = G_VALUE_INIT;
+	gtk_tree_model_get_value(model, iter, column, &value);
+	uint64_t id = G_VALUE_HOLDS_INT64(&value) ? (uint64_t)g_value_get_int64(&value) : g_value_get_uint64(&value);
+	g_value_unset(&value);
+	return id;
+}
+
+static void render_foreign_key(GtkTreeViewColumn *column, GtkCellRenderer *renderer, GtkTreeModel *model, GtkTreeIter *iter, gpointer data)
+{
+	(void)column;
+	const struct foreign_column *foreign = data;
+	uint64_t id = get_id(model, iter, foreign->column);
+	const char *label = dbc_join_resolve(g_explorer->dbc_join, foreign->target, id);
+	char text[512];
+	if (label && *label)
+		snprintf(text, sizeof(text), "%" PRIu64 " (%s)", id, label);
+	else
+		snprintf(text, sizeof(text), "%" PRIu64, id);
+	g_object_set(renderer, "text", text, NULL);
+}
+
+static void add_referrer(const char *file, const char *column, uint64_t id, void *userdata)
+{
+	g_string_append_printf(userdata, "%s %s: %" PRIu64 "\n", file, column, id);
+}
+
+static void show_referrers(struct dbc_display *display, uint64_t id)
+{
+	GString *text = g_string_new(NULL);
+	dbc_join_referrers(g_explorer->dbc_join, display->name, id, add_referrer, text);
+	if (!text->len)
+		g_string_append(text, "no reference");
+	char title[256];
+	snprintf(title, sizeof(title), "references to %s %" PRIu64, display->name, id);
+	GtkWidget *dialog = gtk_dialog_new_with_buttons(title, GTK_WINDOW(g_explorer->window), GTK_DIALOG_MODAL | GTK_DIALOG_DESTROY_WITH_PARENT, "Close", GTK_RESPONSE_CLOSE, NULL);
+	gtk_window_set_default_size(GTK_WINDOW(dialog), 400, 300);
+	GtkWidget *view = gtk_text_view_new();
+	gtk_text_view_set_editable(GTK_TEXT_VIEW(view), false);
+	gtk_text_buffer_set_text(gtk_text_view_get_buffer(GTK_TEXT_VIEW(view)), text->str, -1);
+	g_string_free(text, true);
+	GtkWidget *scroll = gtk_scrolled_window_new(NULL, NULL);
+	gtk_widget_set_vexpand(scroll, true);
+	gtk_container_add(GTK_CONTAINER(scroll), view);
+	gtk_container_add(GTK_CONTAINER(gtk_dialog_get_content_area(GTK_DIALOG(dialog))), scroll);
+	gtk_widget_show_all(dialog);
+	gtk_dialog_run(GTK_DIALOG(dialog));
+	gtk_widget_destroy(dialog);
+}
+
+static void on_referrers_ready(struct dbc_join_request *request, void *userdata)
+{
+	(void)request;
+	struct dbc_display *display = userdata;
+	show_referrers(display, display->referrers_id);
+}
+
+static void on_row_activated(GtkTreeView *tree, GtkTreePath *path, GtkTreeViewColumn *column, gpointer data)
+{
+	(void)tree;
+	(void)column;
+	struct dbc_display *display = data;
+	const struct dbc_layout *layout = dbc_model_get_layout(display->model);
+	GtkTreeIter iter;
+	if (!layout->columns_nb
+	 || layout->columns[0].kind == DBC_VALUE_STRING
+	 || layout->columns[0].kind == DBC_VALUE_FLOAT
+	 || !gtk_tree_model_get_iter(GTK_TREE_MODEL(display->model), &iter, path))
+		return;
+	uint64_t id = get_id(GTK_TREE_MODEL(display->model), &iter, 0);
+	/* the referencing files are loaded on the first activation,
+	 * the dialog is shown by on_referrers_ready for the last row activated
+	 */
+	if (!display->referrers)
+	{
+		display->referrers_id = id;
+		display->referrers = dbc_join_load_referrers(g_explorer->dbc_join, display->name, on_referrers_ready, display);
+		return;
+	}
+	if (!dbc_join_request_ready(display->referrers))
+	{
+		display->referrers_id = id;
+		return;
+	}
+	show_referrers(display, id);
+}
+
+static void on_targets_ready(struct dbc_join_request *request, void *userdata)
+{
+	(void)request;
+	struct dbc_display *display = userdata;
+	/* the foreign key labels can now be resolved */
+	gtk_widget_queue_draw(display->tree);
+}
+
+static void on_index_ready(struct dbc_index *index, void *userdata)
+{
+	(void)index;
+	struct dbc_display *display = userdata;
+	if (*gtk_entry_get_text(GTK_ENTRY(display->search)))
+		apply_filter(display);
+}
+
+struct display *dbc_display_new(const struct node *node, const char *path, struct wow_mpq_file *mpq_file, void *parsed)
 {
 	(void)path;
-	struct wow_dbc_file *file = wow_dbc_file_new(mpq_file);
+	struct wow_dbc_file *file = parsed ? parsed : wow_dbc_file_new(mpq_file);
 	if (!file)
 	{
 		fprintf(stderr, "failed to parse dbc file\n");
@@ -113,53 +180,18 @@ struct display *dbc_display_new(const struct node *node, const char *path, struc
 		wow_dbc_file_delete(file);
 		return NULL;
 	}
-	display->display.dtr = dtr;
-	display->file = file;
-	const struct wow_dbc_def *def = NULL;
-	for (size_t i = 0; i < sizeof(defs) / sizeof(*defs); ++i)
-	{
-		if (!strcmp(defs[i].file, node->name))
-		{
-			def = defs[i].def;
-			break;
-		}
-	}
+	const struct wow_dbc_def *def = dbc_join_get_def(node->name);
 	/* Tree */
-	GType types[512];
-	size_t types_nb = 0;
-	if (def)
-	{
-		while (def[types_nb].type != WOW_DBC_TYPE_END)
-		{
-			switch (def[types_nb].type)
-			{
-				case WOW_DBC_TYPE_I8:
-				case WOW_DBC_TYPE_I16:
-				case WOW_DBC_TYPE_I32:
-				case WOW_DBC_TYPE_I64:
-					types[types_nb++] = G_TYPE_INT64;
-					break;
-				case WOW_DBC_TYPE_U8:
-				case WOW_DBC_TYPE_U16:
-				case WOW_DBC_TYPE_U32:
-				case WOW_DBC_TYPE_U64:
-					types[types_nb++] = G_TYPE_UINT64;
-					break;
-				case WOW_DBC_TYPE_FLT:
-					types[types_nb++] = G_TYPE_FLOAT;
-					break;
-				default:
-					types[types_nb++] = G_TYPE_STRING;
-					break;
-			}
-		}
-	}
-	else
+	display->model = dbc_model_new(file, def);
+	if (!display->model)
 	{
-		for (size_t i = 0; i < file->header.record_size / 4; ++i)
-			types[types_nb++] = G_TYPE_STRING;
+		free(display);
+		return NULL;
 	}
-	GtkListStore *store = gtk_list_store_newv(types_nb, types);
+	display->display.dtr = dtr;
+	display->name = node->name;
+	display->referrers = NULL;
+	const struct dbc_layout *layout = dbc_model_get_layout(display->model);
 	GtkWidget *tree = gtk_tree_view_new();
 	gtk_tree_view_set_fixed_height_mode(GTK_TREE_VIEW(tree), true);
 	gtk_tree_view_set_headers_visible(GTK_TREE_VIEW(tree), true);
@@ -184,6 +216,18 @@ struct display *dbc_display_new(const struct node *node, const char *path, struc
 			gtk_tree_view_column_set_sizing(column, GTK_TREE_VIEW_COLUMN_FIXED);
 			gtk_tree_view_column_set_resizable(column, true);
 			gtk_tree_view_column_set_sort_column_id(column, i);
+			const char *target = dbc_join_get_target(node->name, def[i].name);
+			if (target && i < layout->columns_nb
+			 && (layout->columns[i].kind == DBC_VALUE_INT || layout->columns[i].kind == DBC_VALUE_UINT))
+			{
+				struct foreign_column *foreign = malloc(sizeof(*foreign));
+				if (foreign)
+				{
+					foreign->target = target;
+					foreign->column = i;
+					gtk_tree_view_column_set_cell_data_func(column, renderer, render_foreign_key, foreign, free);
+				}
+			}
 			gtk_tree_view_append_column(GTK_TREE_VIEW(tree), column);
 		}
 	}
@@ -201,89 +245,18 @@ struct display *dbc_display_new(const struct node *node, const char *path, struc
 			gtk_tree_view_append_column(GTK_TREE_VIEW(tree), column);
 		}
 	}
-	for (size_t i = 0; i < file->header.record_count; ++i)
-	{
-		GtkTreeIter iter;
-		gtk_list_store_append(store, &iter);
-		struct wow_dbc_row row = wow_dbc_get_row(file, i);
-		if (def)
-		{
-			size_t j = 0;
-			for (uint32_t idx = 0; def[idx].type != WOW_DBC_TYPE_END; ++idx)
-			{
-				GValue value = G_VALUE_INIT;
-				char str[512];
-				switch (def[idx].type)
-				{
-					case WOW_DBC_TYPE_I8:
-						VALUE_SET_I64(wow_dbc_get_i8(&row, j));
-						j += 1;
-						break;
-					case WOW_DBC_TYPE_U8:
-						VALUE_SET_U64(wow_dbc_get_u8(&row, j));
-						j += 1;
-						break;
-					case WOW_DBC_TYPE_I16:
-						VALUE_SET_I64(wow_dbc_get_i16(&row, j));
-						j += 2;
-						break;
-					case WOW_DBC_TYPE_U16:
-						VALUE_SET_U64(wow_dbc_get_u16(&row, j));
-						j += 2;
-						break;
-					case WOW_DBC_TYPE_I32:
-						VALUE_SET_I64(wow_dbc_get_i32(&row, j));
-						j += 4;
-						break;
-					case WOW_DBC_TYPE_U32:
-						VALUE_SET_U64(wow_dbc_get_u32(&row, j));
-						j += 4;
-						break;
-					case WOW_DBC_TYPE_I64:
-						VALUE_SET_I64(wow_dbc_get_i64(&row, j));
-						j += 8;
-						break;
-					case WOW_DBC_TYPE_U64:
-						VALUE_SET_U64(wow_dbc_get_u64(&row, j));
-						j += 8;
-						break;
-					case WOW_DBC_TYPE_STR:
-						g_value_init(&value, G_TYPE_STRING);
-						snprintf(str, sizeof(str), "%s", wow_dbc_get_str(&row, j));
-						g_value_set_string(&value, str);
-						j += 4;
-						break;
-					case WOW_DBC_TYPE_LSTR:
-						g_value_init(&value, G_TYPE_STRING);
-						snprintf(str, sizeof(str), "%s", wow_dbc_get_str(&row, j + 8));
-						g_value_set_string(&value, str);
-						j += 4 * 17;
-						break;
-					case WOW_DBC_TYPE_FLT:
-						VALUE_SET_FLT(wow_dbc_get_flt(&row, j));
-						j += 4;
-						break;
-					case WOW_DBC_TYPE_END:
-						break;
-				}
-				gtk_list_store_set_value(store, &iter, idx, &value);
-			}
-		}
-		else
-		{
-			GValue value = G_VALUE_INIT;
-			g_value_init(&value, G_TYPE_STRING);
-			for (uint32_t j = 0; j < file->header.record_size / 4; ++j)
-			{
-				char str[64];
-				snprintf(str, sizeof(str), "%" PRIu32, wow_dbc_get_u32(&row, j * 4));
-				g_value_set_string(&value, str);
-				gtk_list_store_set_value(store, &iter, j, &value);
-			}
-		}
-	}
-	gtk_tree_view_set_model(GTK_TREE_VIEW(tree), GTK_TREE_MODEL(store));
+	gtk_tree_view_set_model(GTK_TREE_VIEW(tree), GTK_TREE_MODEL(display->model));
+	g_signal_connect(tree, "row-activated", G_CALLBACK(on_row_activated), display);
 	gtk_widget_show(tree);
+	display->tree = tree;
+	/* Search */
+	display->search = gtk_search_entry_new();
+	gtk_entry_set_placeholder_text(GTK_ENTRY(display->search), "Filter by id or text");
+	g_signal_connect(display->search, "search-changed", G_CALLBACK(on_search_changed), display);
+	gtk_widget_show(display->search);
+	display->index = dbc_index_new(display->model, on_index_ready, display);
+	/* the foreign key labels are rendered from the referenced files */
+	display->targets = dbc_join_load_targets(g_explorer->dbc_join, node->name, on_targets_ready, display);
 	/* Scroll */
 	GtkWidget *scroll = gtk_scrolled_window_new(NULL, NULL);
 	gtk_scrolled_window_set_policy(GTK_SCROLLED_WINDOW(scroll), GTK_POLICY_AUTOMATIC, GTK_POLICY_AUTOMATIC);
@@ -291,6 +264,11 @@ struct display *dbc_display_new(const struct node *node, const char *path, struc
 	gtk_widget_set_hexpand(scroll, true);
 	gtk_container_add(GTK_CONTAINER(scroll), tree);
 	gtk_widget_show(scroll);
-	display->display.root = scroll;
+	/* Box */
+	GtkWidget *box = gtk_box_new(GTK_ORIENTATION_VERTICAL, 0);
+	gtk_box_pack_start(GTK_BOX(box), display->search, false, false, 0);
+	gtk_box_pack_start(GTK_BOX(box), scroll, true, true, 0);
+	gtk_widget_show(box);
+	display->display.root = box;
 	return &display->display;
 }
@@ -1,14 +1,19 @@
 #include "displays/display.h"
 
+#include "dir_model.h"
 #include "explorer.h"
 #include "nodes.h"
 
 #include <libwow/mpq.h>
 
+#include <inttypes.h>
+
 #define ADD_TREE_COLUMN(id, name) \
 do \
 { \
-	GtkTreeViewColumn *column = gtk_tree_view_column_new_with_attributes(name, renderer, "text", id, NULL); \
+	GtkCellRenderer *renderer = gtk_cell_renderer_text_new(); \
+	GtkTreeViewColumn *column = gtk_tree_view_column_new_with_attributes(name, renderer, NULL); \
+	gtk_tree_view_column_set_cell_data_func(column, renderer, render_cell, GINT_TO_POINTER(id), NULL); \
 	gtk_tree_view_append_column(GTK_TREE_VIEW(tree), column); \
 	gtk_tree_view_column_set_sort_column_id(column, id); \
 	gtk_tree_view_column_set_resizable(column, true); \
@@ -17,9 +22,19 @@ do \
 struct dir_display
 {
 	struct display display;
+	DirModel *model;
 };
 
-static void pretty_size(char *str, size_t len, uint32_t size)
+enum
+{
+	GROUP_COLUMN_NAME,
+	GROUP_COLUMN_FILES,
+	GROUP_COLUMN_FILE_SIZE,
+	GROUP_COLUMN_BLOCK_SIZE,
+	GROUP_COLUMN_COMPRESSION,
+};
+
+static void pretty_size(char *str, size_t len, uint64_t size)
 {
 	if (size > 1000000000)
 		snprintf(str, len, "%3.3f GB", size / 1000000000.f);
@@ -28,132 +43,238 @@ static void pretty_size(char *str, size_t len, uint32_t size)
 	else if (size > 1000)
 		snprintf(str, len, "%3.3f KB", size / 1000.f);
 	else
-		snprintf(str, len, "%3u B", size);
+		snprintf(str, len, "%3" PRIu64 " B", size);
+}
+
+static void pretty_ratio(char *str, size_t len, uint64_t block_size, uint64_t file_size)
+{
+	if (file_size)
+		snprintf(str, len, "%2.2f%%", (double)block_size / file_size * 100);
+	else
+		snprintf(str, len, "N/A");
+}
+
+static void flags_string(char *str, uint32_t flags)
+{
+	str[0] = 'R';
+	str[1] = (flags & WOW_MPQ_BLOCK_IMPLODE) ? 'I' : '-';
+	str[2] = (flags & WOW_MPQ_BLOCK_COMPRESS) ? 'C' : '-';
+	str[3] = (flags & WOW_MPQ_BLOCK_ENCRYPTED) ? 'E' : '-';
+	str[4] = (flags & WOW_MPQ_BLOCK_FIX_KEY) ? 'F' : '-';
+	str[5] = (flags & WOW_MPQ_BLOCK_PATCH_FILE) ? 'P' : '-';
+	str[6] = (flags & WOW_MPQ_BLOCK_DELETE_MARKER) ? 'D' : '-';
+	str[7] = (flags & WOW_MPQ_BLOCK_SINGLE_UNIT) ? 'S' : '-';
+	str[8] = (flags & WOW_MPQ_BLOCK_SECTOR_CRC) ? 'R' : '-';
+	str[9] = (flags & WOW_MPQ_BLOCK_EXISTS) ? 'X' : '-';
+	str[10] = '\0';
+}
+
+/* the cells are formatted on demand from the node blocks, for the visible rows only */
+static void render_cell(GtkTreeViewColumn *column, GtkCellRenderer *renderer, GtkTreeModel *model, GtkTreeIter *iter, gpointer data)
+{
+	(void)column;
+	gint id = GPOINTER_TO_INT(data);
+	struct node *node;
+	guint64 file_size;
+	guint64 block_size;
+	char tmp[64];
+	gtk_tree_model_get(model, iter, DIR_COLUMN_NODE, &node, DIR_COLUMN_FILE_SIZE, &file_size, DIR_COLUMN_BLOCK_SIZE, &block_size, -1);
+	if (id == DIR_COLUMN_NAME)
+	{
+		g_object_set(renderer, "text", node->name, NULL);
+		return;
+	}
+	/* directories show the totals of their subtree */
+	if (node_is_dir(node) && (id == DIR_COLUMN_OFFSET || id == DIR_COLUMN_FLAGS || !node->stats))
+	{
+		g_object_set(renderer, "text", id == DIR_COLUMN_FLAGS ? "D----------" : "N/A", NULL);
+		return;
+	}
+	if (!node_is_dir(node) && node->block.archive == NODE_NO_ARCHIVE)
+	{
+		g_object_set(renderer, "text", "err", NULL);
+		return;
+	}
+	switch (id)
+	{
+		case DIR_COLUMN_OFFSET:
+			pretty_size(tmp, sizeof(tmp), node->block.offset);
+			break;
+		case DIR_COLUMN_BLOCK_SIZE:
+			pretty_size(tmp, sizeof(tmp), block_size);
+			break;
+		case DIR_COLUMN_FILE_SIZE:
+			pretty_size(tmp, sizeof(tmp), file_size);
+			break;
+		case DIR_COLUMN_COMPRESSION:
+			pretty_ratio(tmp, sizeof(tmp), block_size, file_size);
+			break;
+		case DIR_COLUMN_FLAGS:
+			flags_string(tmp, node->block.flags);
+			break;
+		default:
+			tmp[0] = '\0';
+			break;
+	}
+	g_object_set(renderer, "text", tmp, NULL);
+}
+
+static void render_group_size(GtkTreeViewColumn *column, GtkCellRenderer *renderer, GtkTreeModel *model, GtkTreeIter *iter, gpointer data)
+{
+	(void)column;
+	guint64 size;
+	char tmp[64];
+	gtk_tree_model_get(model, iter, GPOINTER_TO_INT(data), &size, -1);
+	pretty_size(tmp, sizeof(tmp), size);
+	g_object_set(renderer, "text", tmp, NULL);
+}
+
+static void render_group_ratio(GtkTreeViewColumn *column, GtkCellRenderer *renderer, GtkTreeModel *model, GtkTreeIter *iter, gpointer data)
+{
+	(void)column;
+	(void)data;
+	guint64 file_size;
+	guint64 block_size;
+	char tmp[64];
+	gtk_tree_model_get(model, iter, GROUP_COLUMN_FILE_SIZE, &file_size, GROUP_COLUMN_BLOCK_SIZE, &block_size, -1);
+	pretty_ratio(tmp, sizeof(tmp), block_size, file_size);
+	g_object_set(renderer, "text", tmp, NULL);
+}
+
+static void add_group_column(GtkWidget *tree, gint id, const char *name, GtkTreeCellDataFunc func)
+{
+	GtkCellRenderer *renderer = gtk_cell_renderer_text_new();
+	GtkTreeViewColumn *column;
+	if (func)
+	{
+		column = gtk_tree_view_column_new_with_attributes(name, renderer, NULL);
+		gtk_tree_view_column_set_cell_data_func(column, renderer, func, GINT_TO_POINTER(id), NULL);
+	}
+	else
+	{
+		column = gtk_tree_view_column_new_with_attributes(name, renderer, "text", id, NULL);
+	}
+	gtk_tree_view_append_column(GTK_TREE_VIEW(tree), column);
+	gtk_tree_view_column_set_sort_column_id(column, id);
+	gtk_tree_view_column_set_resizable(column, true);
+}
+
+static const char *group_name(uintptr_t key, bool archive)
+{
+	if (!archive)
+		return key && *(const char*)key ? (const char*)key : "(none)";
+	if (key == NODE_NO_ARCHIVE)
+		return "(missing)";
+	const char *filename = g_explorer->mpq_compound->archives[key].archive->filename;
+	const char *name = strrchr(filename, '/');
+	return name ? name + 1 : filename;
+}
+
+static GtkWidget *build_groups(const char *title, const struct node_stats_group *groups, uint32_t groups_nb, bool archive)
+{
+	GtkListStore *store = gtk_list_store_new(5, G_TYPE_STRING, G_TYPE_UINT, G_TYPE_UINT64, G_TYPE_UINT64, G_TYPE_FLOAT);
+	for (uint32_t i = 0; i < groups_nb; ++i)
+	{
+		const struct node_stats_group *group = &groups[i];
+		GtkTreeIter iter;
+		gtk_list_store_append(store, &iter);
+		gtk_list_store_set(store, &iter,
+		                   GROUP_COLUMN_NAME, group_name(group->key, archive),
+		                   GROUP_COLUMN_FILES, group->files_nb,
+		                   GROUP_COLUMN_FILE_SIZE, (guint64)group->file_size,
+		                   GROUP_COLUMN_BLOCK_SIZE, (guint64)group->block_size,
+		                   GROUP_COLUMN_COMPRESSION, group->file_size ? (float)((double)group->block_size / group->file_size) : 0.f,
+		                   -1);
+	}
+	gtk_tree_sortable_set_sort_column_id(GTK_TREE_SORTABLE(store), GROUP_COLUMN_FILE_SIZE, GTK_SORT_DESCENDING);
+	GtkWidget *tree = gtk_tree_view_new();
+	gtk_tree_view_set_headers_visible(GTK_TREE_VIEW(tree), true);
+	add_group_column(tree, GROUP_COLUMN_NAME, title, NULL);
+	add_group_column(tree, GROUP_COLUMN_FILES, "files", NULL);
+	add_group_column(tree, GROUP_COLUMN_FILE_SIZE, "file size", render_group_size);
+	add_group_column(tree, GROUP_COLUMN_BLOCK_SIZE, "block size", render_group_size);
+	add_group_column(tree, GROUP_COLUMN_COMPRESSION, "compression", render_group_ratio);
+	gtk_tree_view_set_model(GTK_TREE_VIEW(tree), GTK_TREE_MODEL(store));
+	g_object_unref(store);
+	gtk_widget_show(tree);
+	GtkWidget *scroll = gtk_scrolled_window_new(NULL, NULL);
+	gtk_scrolled_window_set_policy(GTK_SCROLLED_WINDOW(scroll), GTK_POLICY_AUTOMATIC, GTK_POLICY_AUTOMATIC);
+	gtk_widget_set_vexpand(scroll, true);
+	gtk_widget_set_hexpand(scroll, true);
+	gtk_container_add(GTK_CONTAINER(scroll), tree);
+	gtk_widget_show(scroll);
+	return scroll;
+}
+
+/* the totals of the whole subtree, memoized on the node by node_compute_stats */
+static GtkWidget *build_stats(const struct node *node)
+{
+	const struct node_stats *stats = node->stats;
+	GtkWidget *box = gtk_box_new(GTK_ORIENTATION_VERTICAL, 0);
+	char text[256];
+	char file_size[64];
+	char block_size[64];
+	char ratio[64];
+	if (stats)
+	{
+		pretty_size(file_size, sizeof(file_size), stats->file_size);
+		pretty_size(block_size, sizeof(block_size), stats->block_size);
+		pretty_ratio(ratio, sizeof(ratio), stats->block_size, stats->file_size);
+		snprintf(text, sizeof(text), "%" PRIu32 " files, %s, %s in archives (%s)", stats->files_nb, file_size, block_size, ratio);
+	}
+	else
+	{
+		snprintf(text, sizeof(text), "no statistics");
+	}
+	GtkWidget *label = gtk_label_new(text);
+	gtk_label_set_selectable(GTK_LABEL(label), true);
+	gtk_widget_show(label);
+	gtk_box_pack_start(GTK_BOX(box), label, false, false, 0);
+	if (stats)
+	{
+		GtkWidget *groups = gtk_paned_new(GTK_ORIENTATION_HORIZONTAL);
+		gtk_paned_pack1(GTK_PANED(groups), build_groups("extension", stats->extensions, stats->extensions_nb, false), true, false);
+		gtk_paned_pack2(GTK_PANED(groups), build_groups("archive", stats->archives, stats->archives_nb, true), true, false);
+		gtk_widget_show(groups);
+		gtk_box_pack_start(GTK_BOX(box), groups, true, true, 0);
+	}
+	gtk_widget_show(box);
+	return box;
 }
 
 static void dtr(struct display *ptr)
 {
-	(void)ptr;
+	struct dir_display *display = (struct dir_display*)ptr;
+	g_object_unref(display->model);
 }
 
-struct display *dir_display_new(const struct node *node, const char *path, struct wow_mpq_file *file)
+struct display *dir_display_new(const struct node *node, const char *path, struct wow_mpq_file *file, void *parsed)
 {
 	(void)path;
 	(void)file;
+	(void)parsed;
 	struct dir_display *display = malloc(sizeof(*display));
 	if (!display)
 	{
 		fprintf(stderr, "dir display allocation failed\n");
 		return NULL;
 	}
+	display->model = dir_model_new((struct node*)node);
+	if (!display->model)
+	{
+		free(display);
+		return NULL;
+	}
 	display->display.dtr = dtr;
-	GtkListStore *store = gtk_list_store_new(6, G_TYPE_STRING, G_TYPE_STRING, G_TYPE_STRING, G_TYPE_STRING, G_TYPE_STRING, G_TYPE_STRING);
 	GtkWidget *tree = gtk_tree_view_new();
 	gtk_tree_view_set_headers_visible(GTK_TREE_VIEW(tree), true);
-	GtkCellRenderer *renderer = gtk_cell_renderer_text_new();
-	ADD_TREE_COLUMN(0, "name");
-	ADD_TREE_COLUMN(1, "offset");
-	ADD_TREE_COLUMN(2, "block size");
-	ADD_TREE_COLUMN(3, "file size");
-	ADD_TREE_COLUMN(4, "compression");
-	ADD_TREE_COLUMN(5, "flags");
-	for (size_t i = 0; i < node->childs.size; ++i)
-	{
-		struct node *child = *JKS_ARRAY_GET(&node->childs, i, struct node*);
-		char child_path[512];
-		char tmp[64];
-		node_get_path(child, child_path, sizeof(child_path));
-		normalize_mpq_filename(child_path, sizeof(child_path));
-		const struct wow_mpq_block *block = wow_mpq_get_block(g_explorer->mpq_compound, child_path);
-		GtkTreeIter iter;
-		gtk_list_store_append(store, &iter);
-		GValue value = G_VALUE_INIT;
-		g_value_init(&value, G_TYPE_STRING);
-		g_value_set_string(&value, child->name);
-		gtk_list_store_set_value(store, &iter, 0, &value);
-		if (child->childs.size)
-		{
-			g_value_set_string(&value, "N/A");
-		}
-		else if (block)
-		{
-			pretty_size(tmp, sizeof(tmp), block->offset);
-			g_value_set_string(&value, tmp);
-		}
-		else
-		{
-			g_value_set_string(&value, "err");
-		}
-		gtk_list_store_set_value(store, &iter, 1, &value);
-		if (child->childs.size)
-		{
-			g_value_set_string(&value, "N/A");
-		}
-		else if (block)
-		{
-			pretty_size(tmp, sizeof(tmp), block->block_size);
-			g_value_set_string(&value, tmp);
-		}
-		else
-		{
-			g_value_set_string(&value, "err");
-		}
-		gtk_list_store_set_value(store, &iter, 2, &value);
-		if (child->childs.size)
-		{
-			g_value_set_string(&value, "N/A");
-		}
-		else if (block)
-		{
-			pretty_size(tmp, sizeof(tmp), block->file_size);
-			g_value_set_string(&value, tmp);
-		}
-		else
-		{
-			g_value_set_string(&value, "err");
-		}
-		gtk_list_store_set_value(store, &iter, 3, &value);
-		if (child->childs.size)
-		{
-			g_value_set_string(&value, "N/A");
-		}
-		else if (block)
-		{
-			snprintf(tmp, sizeof(tmp), "%2.2f%%", (float)block->block_size / block->file_size * 100);
-			g_value_set_string(&value, tmp);
-		}
-		else
-		{
-			g_value_set_string(&value, "err");
-		}
-		gtk_list_store_set_value(store, &iter, 4, &value);
-		if (child->childs.size)
-		{
-			g_value_set_string(&value, "D----------");
-		}
-		else if (block)
-		{
-			char flags[11];
-			flags[0] = 'R';
-			flags[1] = (block->flags & WOW_MPQ_BLOCK_IMPLODE) ? 'I' : '-';
-			flags[2] = (block->flags & WOW_MPQ_BLOCK_COMPRESS) ? 'C' : '-';
-			flags[3] = (block->flags & WOW_MPQ_BLOCK_ENCRYPTED) ? 'E' : '-';
-			flags[4] = (block->flags & WOW_MPQ_BLOCK_FIX_KEY) ? 'F' : '-';
-			flags[5] = (block->flags & WOW_MPQ_BLOCK_PATCH_FILE) ? 'P' : '-';
-			flags[6] = (block->flags & WOW_MPQ_BLOCK_DELETE_MARKER) ? 'D' : '-';
-			flags[7] = (block->flags & WOW_MPQ_BLOCK_SINGLE_UNIT) ? 'S' : '-';
-			flags[8] = (block->flags & WOW_MPQ_BLOCK_SECTOR_CRC) ? 'R' : '-';
-			flags[9] = (block->flags & WOW_MPQ_BLOCK_EXISTS) ? 'X' : '-';
-			flags[10] = '\0';
-			g_value_set_string(&value, flags);
-		}
-		else
-		{
-			g_value_set_string(&value, "err");
-		}
-		gtk_list_store_set_value(store, &iter, 5, &value);
-	}
-	gtk_tree_view_set_model(GTK_TREE_VIEW(tree), GTK_TREE_MODEL(store));
+	ADD_TREE_COLUMN(DIR_COLUMN_NAME, "name");
+	ADD_TREE_COLUMN(DIR_COLUMN_OFFSET, "offset");
+	ADD_TREE_COLUMN(DIR_COLUMN_BLOCK_SIZE, "block size");
+	ADD_TREE_COLUMN(DIR_COLUMN_FILE_SIZE, "file size");
+	ADD_TREE_COLUMN(DIR_COLUMN_COMPRESSION, "compression");
+	ADD_TREE_COLUMN(DIR_COLUMN_FLAGS, "flags");
+	gtk_tree_view_set_model(GTK_TREE_VIEW(tree), GTK_TREE_MODEL(display->model));
 	gtk_widget_show(tree);
 	/* Scroll */
 	GtkWidget *scroll = gtk_scrolled_window_new(NULL, NULL);
@@ -162,6 +283,12 @@ struct display *dir_display_new(const struct node *node, const char *path, struc
 	gtk_widget_set_hexpand(scroll, true);
 	gtk_container_add(GTK_CONTAINER(scroll), tree);
 	gtk_widget_show(scroll);
-	display->display.root = scroll;
+	/* Paned */
+	GtkWidget *paned = gtk_paned_new(GTK_ORIENTATION_VERTICAL);
+	gtk_paned_pack1(GTK_PANED(paned), scroll, true, true);
+	gtk_paned_pack2(GTK_PANED(paned), build_stats(node), false, false);
+	gtk_paned_set_position(GTK_PANED(paned), 500);
+	gtk_widget_show(paned);
+	display->display.root = paned;
 	return &display->display;
 }
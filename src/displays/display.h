@@ -16,17 +16,17 @@ struct display
 };
 
 void display_delete(struct display *display);
-struct display *adt_display_new(const struct node *node, const char *path, struct wow_mpq_file *file);
-struct display *blp_display_new(const struct node *node, const char *path, struct wow_mpq_file *file);
-struct display *bls_display_new(const struct node *node, const char *path, struct wow_mpq_file *file);
-struct display *dbc_display_new(const struct node *node, const char *path, struct wow_mpq_file *file);
-struct display *dir_display_new(const struct node *node, const char *path, struct wow_mpq_file *file);
-struct display *txt_display_new(const struct node *node, const char *path, struct wow_mpq_file *file);
-struct display *wdl_display_new(const struct node *node, const char *path, struct wow_mpq_file *file);
-struct display *wdt_display_new(const struct node *node, const char *path, struct wow_mpq_file *file);
-struct display *m2_display_new(const struct node *node, const char *path, struct wow_mpq_file *file);
-struct display *img_display_new(const struct node *node, const char *path, struct wow_mpq_file *file);
-struct display *wmo_display_new(const struct node *node, const char *path, struct wow_mpq_file *file);
-struct display *wmo_group_display_new(const struct node *node, const char *path, struct wow_mpq_file *file);
+struct display *adt_display_new(const struct node *node, const char *path, struct wow_mpq_file *file, void *parsed);
+struct display *blp_display_new(const struct node *node, const char *path, struct wow_mpq_file *file, void *parsed);
+struct display *bls_display_new(const struct node *node, const char *path, struct wow_mpq_file *file, void *parsed);
+struct display *dbc_display_new(const struct node *node, const char *path, struct wow_mpq_file *file, void *parsed);
+struct display *dir_display_new(const struct node *node, const char *path, struct wow_mpq_file *file, void *parsed);
+struct display *txt_display_new(const struct node *node, const char *path, struct wow_mpq_file *file, void *parsed);
+struct display *wdl_display_new(const struct node *node, const char *path, struct wow_mpq_file *file, void *parsed);
+struct display *wdt_display_new(const struct node *node, const char *path, struct wow_mpq_file *file, void *parsed);
+struct display *m2_display_new(const struct node *node, const char *path, struct wow_mpq_file *file, void *parsed);
+struct display *img_display_new(const struct node *node, const char *path, struct wow_mpq_file *file, void *parsed);
+struct display *wmo_display_new(const struct node *node, const char *path, struct wow_mpq_file *file, void *parsed);
+struct display *wmo_group_display_new(const struct node *node, const char *path, struct wow_mpq_file *file, void *parsed);
 
 #endif
@@ -7,9 +7,10 @@ struct img_display
 	struct display display;
 };
 
-struct display *img_display_new(const struct node *node, const char *path, struct wow_mpq_file *file)
+struct display *img_display_new(const struct node *node, const char *path, struct wow_mpq_file *file, void *parsed)
 {
 	(void)node;
+	(void)parsed;
 	struct img_display *display = malloc(sizeof(*display));
 	if (!display)
 	{
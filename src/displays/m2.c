@@ -140,11 +140,11 @@ static char *generate_track_str_uint8(char *d, size_t n, const struct wow_m2_tra
 	return d;
 }
 
-struct display *m2_display_new(const struct node *node, const char *path, struct wow_mpq_file *mpq_file)
+struct display *m2_display_new(const struct node *node, const char *path, struct wow_mpq_file *mpq_file, void *parsed)
 {
 	(void)node;
 	(void)path;
-	struct wow_m2_file *file = wow_m2_file_new(mpq_file);
+	struct wow_m2_file *file = parsed ? parsed : wow_m2_file_new(mpq_file);
 	if (!file)
 	{
 		fprintf(stderr, "failed to parse m2 file\n");
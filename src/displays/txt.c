@@ -7,10 +7,11 @@ struct txt_display
 	struct display display;
 };
 
-struct display *txt_display_new(const struct node *node, const char *path, struct wow_mpq_file *file)
+struct display *txt_display_new(const struct node *node, const char *path, struct wow_mpq_file *file, void *parsed)
 {
 	(void)node;
 	(void)path;
+	(void)parsed;
 	struct txt_display *display = malloc(sizeof(*display));
 	if (!display)
 	{
@@ -20,11 +20,11 @@ static void dtr(struct display *ptr)
 	(void)ptr;
 }
 
-struct display *wdt_display_new(const struct node *node, const char *path, struct wow_mpq_file *mpq_file)
+struct display *wdt_display_new(const struct node *node, const char *path, struct wow_mpq_file *mpq_file, void *parsed)
 {
 	(void)node;
 	(void)path;
-	struct wow_wdt_file *file = wow_wdt_file_new(mpq_file);
+	struct wow_wdt_file *file = parsed ? parsed : wow_wdt_file_new(mpq_file);
 	if (!file)
 	{
 		fprintf(stderr, "failed to parse wdt file\n");
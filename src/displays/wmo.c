@@ -41,11 +41,11 @@ static void dtr(struct display *ptr)
 	wow_wmo_file_delete(display->file);
 }
 
-struct display *wmo_display_new(const struct node *node, const char *path, struct wow_mpq_file *mpq_file)
+struct display *wmo_display_new(const struct node *node, const char *path, struct wow_mpq_file *mpq_file, void *parsed)
 {
-	struct wow_wmo_file *file = wow_wmo_file_new(mpq_file);
+	struct wow_wmo_file *file = parsed ? parsed : wow_wmo_file_new(mpq_file);
 	if (!file)
-		return wmo_group_display_new(node, path, mpq_file);
+		return wmo_group_display_new(node, path, mpq_file, NULL);
 	struct wmo_display *display = malloc(sizeof(*display));
 	if (!display)
 	{
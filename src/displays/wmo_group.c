@@ -39,10 +39,10 @@ static void dtr(struct display *ptr)
 	wow_wmo_group_file_delete(display->file);
 }
 
-struct display *wmo_group_display_new(const struct node *node, const char *path, struct wow_mpq_file *mpq_file)
+struct display *wmo_group_display_new(const struct node *node, const char *path, struct wow_mpq_file *mpq_file, void *parsed)
 {
 	mpq_file->pos = 0; /* XXX remove this hack */
-	struct wow_wmo_group_file *file = wow_wmo_group_file_new(mpq_file);
+	struct wow_wmo_group_file *file = parsed ? parsed : wow_wmo_group_file_new(mpq_file);
 	if (!file)
 	{
 		fprintf(stderr, "failed to open wmo file\n");
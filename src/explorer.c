@@ -1,6 +1,15 @@
 #include "displays/display.h"
 
+#include "utils/parallel.h"
+
 #include "explorer.h"
+#include "convert.h"
+#include "dbc_join.h"
+#include "export.h"
+#include "file_cache.h"
+#include "mpq_map.h"
+#include "node_cache.h"
+#include "texture_cache.h"
 #include "nodes.h"
 #include "tree.h"
 
@@ -12,6 +21,9 @@
 #include <getopt.h>
 #include <ctype.h>
 
+#define FILE_CACHE_BUDGET (256 * 1024 * 1024)
+#define TEXTURE_CACHE_BUDGET (128 * 1024 * 1024)
+
 struct explorer *g_explorer;
 
 struct explorer *explorer_new(void)
@@ -31,8 +43,13 @@ void explorer_delete(struct explorer *explorer)
 {
 	if (!explorer)
 		return;
+	export_cancel_all();
 	tree_delete(explorer->tree);
 	node_delete(explorer->root);
+	dbc_join_delete(explorer->dbc_join);
+	texture_cache_delete(explorer->texture_cache);
+	file_cache_delete(explorer->file_cache);
+	mpq_map_delete(explorer->mpq_map);
 	gtk_widget_destroy(explorer->window);
 	free(explorer);
 }
@@ -98,6 +115,18 @@ static bool setup_game_files(struct explorer *explorer)
 			return false;
 		}
 	}
+	explorer->mpq_map = mpq_map_new(explorer->mpq_compound);
+	if (!explorer->mpq_map)
+	{
+		fprintf(stderr, "failed to map archives\n");
+		return false;
+	}
+	explorer->file_cache = file_cache_new(explorer->mpq_map, FILE_CACHE_BUDGET);
+	if (!explorer->file_cache)
+	{
+		fprintf(stderr, "failed to create file cache\n");
+		return false;
+	}
 	return true;
 }
 
@@ -108,64 +137,105 @@ static void on_gtk_destroy(GtkWidget *widget, gpointer *explorer)
 	gtk_main_quit();
 }
 
-static bool add_mpq_file(struct explorer *explorer, const char *path)
+static struct node *get_child(struct explorer *explorer, struct node_index *index, struct node *parent, const char *name, bool dir)
+{
+	struct node *node = node_index_get(index, parent, name);
+	if (node)
+		return node;
+	node = dir ? mpq_dir_node_new(name, parent) : mpq_file_node_new(name, parent);
+	if (!node)
+		return NULL;
+	/* indexed first: a node the index refuses isn't in the tree yet, and its
+	 * memory goes with the tree arena; any failure stops the ingestion, the
+	 * index and the tree would disagree otherwise
+	 */
+	if (!node_index_add(index, node)
+	 || !node_add_child(parent, node))
+		return NULL;
+	if (!dir)
+		explorer->files_count++;
+	return node;
+}
+
+static struct node *add_mpq_file(struct explorer *explorer, struct node_index *index, const char *path)
 {
 	struct node *parent = explorer->root;
-	struct node *new_node;
 	const char *prev = path;
 	const char *pos;
 	while ((pos = strchr(prev, '\\')))
 	{
 		if (pos == prev)
 		{
-			pos++;
+			prev++;
 			continue;
 		}
 		char dir[512];
 		snprintf(dir, sizeof(dir), "%.*s", (int)(pos - prev), prev);
-		for (size_t i = 0; dir[i]; ++i)
-			dir[i] = tolower(dir[i]);
-		for (size_t i = 0; i < parent->childs.size; ++i)
-		{
-			struct node *node = *JKS_ARRAY_GET(&parent->childs, i, struct node*);
-			if (!strcmp(node->name, dir))
-			{
-				parent = node;
-				goto next_iter;
-			}
-		}
-		new_node = mpq_dir_node_new(dir, parent);
-		if (!node_add_child(parent, new_node))
-			return false;
-		parent = new_node;
-next_iter:
-		pos++;
-		prev = pos;
+		parent = get_child(explorer, index, parent, dir, true);
+		if (!parent)
+			return NULL;
+		prev = pos + 1;
+	}
+	if (!*prev)
+		return parent;
+	return get_child(explorer, index, parent, prev, false);
+}
+
+struct listfile
+{
+	struct wow_mpq_file *file;
+	char *strings; /* paths rebuilt from the node cache */
+	struct jks_array paths; /* const char* */
+	bool has_key;
+};
+
+struct listfiles
+{
+	struct wow_mpq_compound *compound;
+	struct listfile *listfiles;
+	struct node_cache_key *keys;
+	struct jks_array *files; /* struct node*, file nodes of each archive */
+};
+
+static void init_listfile_key(void *userdata, size_t i)
+{
+	struct listfiles *listfiles = userdata;
+	struct listfile *listfile = &listfiles->listfiles[i];
+	listfile->has_key = node_cache_key_init(&listfiles->keys[i], listfiles->compound->archives[i].archive->filename);
+}
+
+static void parse_listfile(void *userdata, size_t i)
+{
+	struct listfiles *listfiles = userdata;
+	struct listfile *listfile = &listfiles->listfiles[i];
+	struct wow_mpq_archive_view *archive = &listfiles->compound->archives[i];
+	if (listfile->strings)
+		return;
+	listfile->file = wow_mpq_get_archive_file(archive, "(listfile)");
+	if (!listfile->file)
+	{
+		fprintf(stderr, "failed to get (listfile) in archive %s\n", archive->archive->filename);
+		return;
 	}
-	size_t rem = strlen(path) - (prev - path);
-	if (rem > 0)
+	/* tokenize in place: lowercase the paths and terminate each line */
+	char *data = (char*)listfile->file->data;
+	size_t start = 0;
+	for (size_t j = 0; j < listfile->file->size; ++j)
 	{
-		char file[512];
-		snprintf(file, sizeof(file), "%s", prev);
-		size_t len = strlen(file);
-		for (size_t i = 0; i < len; ++i)
-			file[i] = tolower(file[i]);
-		if (file[len - 1] == '\r')
-			file[len - 1] = '\0';
-		for (size_t i = 0; i < parent->childs.size; ++i)
+		if (data[j] != '\n' && data[j] != '\r')
 		{
-			struct node *node = *JKS_ARRAY_GET(&parent->childs, i, struct node*);
-			if (!strcmp(node->name, file))
-			{
-				parent = node;
-				return true;
-			}
+			data[j] = tolower((unsigned char)data[j]);
+			continue;
 		}
-		if (!node_add_child(parent, mpq_file_node_new(file, parent)))
-			return false;
-		explorer->files_count++;
+		data[j] = '\0';
+		if (j > start)
+		{
+			const char *path = &data[start];
+			if (!jks_array_push_back(&listfile->paths, &path))
+				fprintf(stderr, "failed to add listfile path\n");
+		}
+		start = j + 1;
 	}
-	return true;
 }
 
 static void load_files(struct explorer *explorer)
@@ -173,41 +243,115 @@ static void load_files(struct explorer *explorer)
 	/* XXX create popup to diplay loading files */
 	explorer->root = mpq_dir_node_new("", NULL);
 	struct wow_mpq_compound *compound = explorer->mpq_compound;
+	size_t archives_nb = compound->archives_nb ? compound->archives_nb : 1;
+	struct listfiles listfiles;
+	listfiles.compound = compound;
+	listfiles.listfiles = calloc(archives_nb, sizeof(*listfiles.listfiles));
+	listfiles.keys = calloc(archives_nb, sizeof(*listfiles.keys));
+	listfiles.files = calloc(archives_nb, sizeof(*listfiles.files));
+	if (!listfiles.listfiles || !listfiles.keys || !listfiles.files)
+	{
+		fprintf(stderr, "listfiles allocation failed\n");
+		free(listfiles.listfiles);
+		free(listfiles.keys);
+		free(listfiles.files);
+		return;
+	}
+	for (uint32_t i = 0; i < compound->archives_nb; ++i)
+	{
+		jks_array_init(&listfiles.listfiles[i].paths, sizeof(const char*), NULL, NULL);
+		jks_array_init(&listfiles.files[i], sizeof(struct node*), NULL, NULL);
+	}
+	char cache_path[512];
+	snprintf(cache_path, sizeof(cache_path), "%s/Data/explorer.cache", explorer->game_path);
+	parallel_for(compound->archives_nb, init_listfile_key, &listfiles);
+	bool has_keys = true;
 	for (uint32_t i = 0; i < compound->archives_nb; ++i)
 	{
-		struct wow_mpq_archive_view *archive = &compound->archives[i];
-		struct wow_mpq_file *file = wow_mpq_get_archive_file(archive, "(listfile)");
-		if (!file)
+		if (!listfiles.listfiles[i].has_key)
+			has_keys = false;
+	}
+	struct node_cache *cache = has_keys ? node_cache_open(cache_path) : NULL;
+	if (cache)
+	{
+		if (node_cache_valid(cache, listfiles.keys, compound->archives_nb))
 		{
-			fprintf(stderr, "failed to get (listfile) in archive %s\n", archive->archive->filename);
-			continue;
+			if (node_cache_load(cache, explorer->root, &explorer->files_count))
+			{
+				node_cache_close(cache);
+				goto end;
+			}
+			node_delete(explorer->root);
+			explorer->root = mpq_dir_node_new("", NULL);
 		}
-		const char *prev = (const char*)file->data;
-		const char *pos;
-		while ((pos = (const char*)memchr(prev, '\n', file->size - (prev - (const char*)file->data))))
+		/* reuse the share of the archives which didn't change */
+		for (uint32_t i = 0; i < compound->archives_nb; ++i)
 		{
-			if (pos == prev)
-			{
-				pos++;
+			struct listfile *listfile = &listfiles.listfiles[i];
+			if (node_cache_get_paths(cache, &listfiles.keys[i], &listfile->strings, &listfile->paths))
 				continue;
+			free(listfile->strings);
+			listfile->strings = NULL;
+			jks_array_destroy(&listfile->paths);
+			jks_array_init(&listfile->paths, sizeof(const char*), NULL, NULL);
+		}
+		node_cache_close(cache);
+	}
+	/* decompress and tokenize every listfile in parallel, then merge them in archive order */
+	parallel_for(compound->archives_nb, parse_listfile, &listfiles);
+	explorer->files_count = 0;
+	struct node_index index;
+	/* a partial tree is shown but never cached */
+	bool complete = node_index_init(&index);
+	if (complete)
+	{
+		for (uint32_t i = 0; i < compound->archives_nb && complete; ++i)
+		{
+			struct listfile *listfile = &listfiles.listfiles[i];
+			for (size_t j = 0; j < listfile->paths.size; ++j)
+			{
+				struct node *node = add_mpq_file(explorer, &index, *JKS_ARRAY_GET(&listfile->paths, j, const char*));
+				if (!node)
+				{
+					fprintf(stderr, "failed to add mpq file\n");
+					complete = false;
+					break;
+				}
+				if (!node_is_dir(node) && !jks_array_push_back(&listfiles.files[i], &node))
+					fprintf(stderr, "failed to add listfile node\n");
 			}
-			char path[256];
-			snprintf(path, sizeof(path), "%.*s", (int)(pos - prev), prev);
-			size_t len = strlen(path);
-			if (path[len - 1] == '\r')
-				path[len - 1] = '\0';
-			if (!add_mpq_file(explorer, path))
-				fprintf(stderr, "failed to add mpq file\n");
-			pos++;
-			prev = pos;
 		}
-		wow_mpq_file_delete(file);
+		node_index_destroy(&index);
 	}
+	/* children are appended unsorted during ingestion, sort them once */
+	node_sort(explorer->root);
+	/* the cache keeps the blocks, they are only resolved for a new tree */
+	node_resolve_blocks(explorer->root, compound);
+	if (has_keys && complete)
+		node_cache_write(cache_path, explorer->root, listfiles.keys, listfiles.files, compound->archives_nb);
+
+end:
+	for (uint32_t i = 0; i < compound->archives_nb; ++i)
+	{
+		struct listfile *listfile = &listfiles.listfiles[i];
+		jks_array_destroy(&listfile->paths);
+		jks_array_destroy(&listfiles.files[i]);
+		free(listfile->strings);
+		if (listfile->file)
+			wow_mpq_file_delete(listfile->file);
+	}
+	free(listfiles.listfiles);
+	free(listfiles.keys);
+	free(listfiles.files);
+	/* the displays read the directory totals from the nodes */
+	node_compute_stats(explorer->root);
 }
 
 static void init(struct explorer *explorer)
 {
 	load_files(explorer);
+	explorer->texture_cache = texture_cache_new(TEXTURE_CACHE_BUDGET);
+	explorer->dbc_join = dbc_join_new();
 
 	/* MenuBar */
 	explorer->menu_bar = gtk_menu_bar_new();
@@ -270,9 +414,22 @@ int explorer_run(struct explorer *explorer)
 	init(explorer);
 	gtk_widget_show(explorer->window);
 	gtk_main();
+	/* the export threads would still be writing at exit */
+	export_cancel_all();
 	return EXIT_SUCCESS;
 }
 
+int explorer_convert(struct explorer *explorer, int argc, char **argv)
+{
+	if (!setup_game_files(explorer))
+	{
+		fprintf(stderr, "failed to setup game files\n");
+		return EXIT_FAILURE;
+	}
+	load_files(explorer);
+	return convert_run(explorer, argc, argv);
+}
+
 void explorer_set_display(struct explorer *explorer, struct display *display)
 {
 	if (explorer->display)
@@ -361,10 +518,11 @@ void normalize_mpq_filename(char *filename, size_t size)
 
 static void usage(void)
 {
-	printf("explorer [-h] [-p <path>] [-l <locale>]\n");
+	printf("explorer [-h] [-p <path>] [-l <locale>] [convert ...]\n");
 	printf("-h: show this help\n");
 	printf("-p: set the game path\n");
 	printf("-l: set the locale (frFR, enUS, ..)\n");
+	printf("convert: convert textures without the interface, see convert -h\n");
 }
 
 int main(int argc, char **argv)
@@ -374,7 +532,7 @@ int main(int argc, char **argv)
 	if (!g_explorer)
 		return EXIT_FAILURE;
 	int c;
-	while ((c = getopt(argc, argv, "hp:l:")) != -1)
+	while ((c = getopt(argc, argv, "+hp:l:")) != -1)
 	{
 		switch (c)
 		{
@@ -392,5 +550,7 @@ int main(int argc, char **argv)
 				return EXIT_FAILURE;
 		}
 	}
+	if (optind < argc && !strcmp(argv[optind], "convert"))
+		return explorer_convert(g_explorer, argc - optind, argv + optind);
 	return explorer_run(g_explorer);
 }
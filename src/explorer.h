@@ -6,7 +6,11 @@
 #include <stdint.h>
 
 struct wow_mpq_compound;
+struct texture_cache;
+struct file_cache;
+struct dbc_join;
 struct jks_array;
+struct mpq_map;
 struct display;
 struct tree;
 struct node;
@@ -22,6 +26,10 @@ struct explorer
 	GtkWidget *box;
 	struct wow_mpq_compound *mpq_compound;
 	struct jks_array *mpq_archives; /* struct wow_mpq_archive* */
+	struct mpq_map *mpq_map;
+	struct file_cache *file_cache;
+	struct texture_cache *texture_cache;
+	struct dbc_join *dbc_join;
 	struct display *display;
 	struct node *root;
 	struct tree *tree;
@@ -33,6 +41,7 @@ struct explorer
 struct explorer *explorer_new(void);
 void explorer_delete(struct explorer *explorer);
 int explorer_run(struct explorer *explorer);
+int explorer_convert(struct explorer *explorer, int argc, char **argv);
 void explorer_set_display(struct explorer *explorer, struct display *display);
 uint32_t get_color_from_height(float height, float min, float max);
 void normalize_mpq_filename(char *filename, size_t size);
@@ -0,0 +1,695 @@
+#ifdef __linux__
+# define _GNU_SOURCE /* copy_file_range */
+#endif
+
+#include "utils/parallel.h"
+#include "utils/pack.h"
+
+#include "explorer.h"
+#include "mpq_map.h"
+#include "export.h"
+#include "nodes.h"
+
+#include <libwow/mpq.h>
+
+#include <jks/array.h>
+
+#include <zlib.h>
+
+#ifdef __linux__
+# include <sys/sendfile.h>
+#endif
+#include <sys/stat.h>
+
+#include <inttypes.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <stdio.h>
+
+#define EXPORT_MANIFEST ".export_manifest"
+
+struct export_file
+{
+	char *mpq_path;
+	char *path;
+	const char *name; /* relative to the export root, in path */
+	struct node_block block; /* source identity, checked against the manifest */
+};
+
+/* manifest line: size md5 archive offset block_size file_size name
+ * the file on disk, then the mpq block it was exported from
+ */
+struct manifest_entry
+{
+	uint64_t size;
+	char hash[33]; /* md5 */
+	uint32_t archive;
+	uint32_t offset;
+	uint32_t block_size;
+	uint32_t file_size;
+};
+
+/* fetched file waiting to be written in the archive */
+struct export_entry
+{
+	struct wow_mpq_file *file; /* released once deflated */
+	size_t size;
+	uint8_t *packed;
+	size_t packed_size;
+	uint32_t crc;
+	bool failed;
+	bool ready;
+};
+
+/* reorder window between the packing threads and the archive writer
+ * file i is only fetched once i < written + capacity, which bounds the
+ * memory held and keeps the archive in tree order
+ */
+struct export_window
+{
+	struct export_entry *entries;
+	size_t capacity;
+	size_t written;
+	GMutex mutex;
+	GCond cond;
+};
+
+struct export
+{
+	struct node *node;
+	enum export_format format;
+	char *root;
+	struct jks_array dirs; /* char* */
+	struct jks_array files; /* struct export_file */
+	GHashTable *manifest; /* name to struct manifest_entry*, from the previous runs */
+	FILE *manifest_fp;
+	GMutex manifest_mutex;
+	struct export_window window;
+	GThread *thread;
+	GtkWidget *dialog;
+	GtkWidget *label;
+	GtkWidget *progress;
+	guint timer;
+	gint total;
+	gint next;
+	gint done;
+	gint skipped;
+	gint failed;
+	gint cancel;
+	gint finished;
+};
+
+/* running exports, cancelled and joined by export_cancel_all; main thread only */
+static GList *g_exports;
+
+static void dir_delete(void *ptr)
+{
+	free(*(char**)ptr);
+}
+
+static void file_delete(void *ptr)
+{
+	struct export_file *file = ptr;
+	free(file->mpq_path);
+	free(file->path);
+}
+
+static bool collect(struct export *export, struct node *node, const char *path)
+{
+	if (node_is_dir(node) && export->format != EXPORT_DIRECTORY)
+	{
+		for (size_t i = 0; i < node->childs_nb; ++i)
+		{
+			char child_path[4096];
+			snprintf(child_path, sizeof(child_path), "%s/%s", path, node->childs[i]->name);
+			if (!collect(export, node->childs[i], child_path))
+				return false;
+		}
+		return true;
+	}
+	if (node_is_dir(node))
+	{
+		char *dup = strdup(path);
+		if (!dup || !jks_array_push_back(&export->dirs, &dup))
+		{
+			free(dup);
+			return false;
+		}
+		for (size_t i = 0; i < node->childs_nb; ++i)
+		{
+			char child_path[4096];
+			snprintf(child_path, sizeof(child_path), "%s/%s", path, node->childs[i]->name);
+			if (!collect(export, node->childs[i], child_path))
+				return false;
+		}
+		return true;
+	}
+	struct export_file file;
+	file.block = node->block;
+	char mpq_path[4096];
+	node_get_path(node, mpq_path, sizeof(mpq_path));
+	normalize_mpq_filename(mpq_path, sizeof(mpq_path));
+	file.mpq_path = strdup(mpq_path);
+	file.path = strdup(path);
+	if (!file.mpq_path || !file.path)
+	{
+		free(file.mpq_path);
+		free(file.path);
+		return false;
+	}
+	size_t root_len = strlen(export->root);
+	/* archive paths start with the exported node name */
+	if (export->format != EXPORT_DIRECTORY)
+		file.name = file.path;
+	else
+		file.name = strncmp(file.path, export->root, root_len) || file.path[root_len] != '/' ? file.path : &file.path[root_len + 1];
+	if (!jks_array_push_back(&export->files, &file))
+	{
+		file_delete(&file);
+		return false;
+	}
+	return true;
+}
+
+static void manifest_load(struct export *export)
+{
+	char path[4096];
+	snprintf(path, sizeof(path), "%s/" EXPORT_MANIFEST, export->root);
+	FILE *fp = fopen(path, "r");
+	if (!fp)
+		return;
+	char line[4096 + 64];
+	while (fgets(line, sizeof(line), fp))
+	{
+		size_t len = strlen(line);
+		if (len && line[len - 1] == '\n')
+			line[--len] = '\0';
+		struct manifest_entry *entry = malloc(sizeof(*entry));
+		if (!entry)
+			break;
+		int name;
+		/* lines of older exports have no block and are dropped */
+		if (sscanf(line, "%" SCNu64 " %32s %" SCNu32 " %" SCNu32 " %" SCNu32 " %" SCNu32 " %n",
+		           &entry->size, entry->hash, &entry->archive, &entry->offset,
+		           &entry->block_size, &entry->file_size, &name) != 6
+		 || !line[name])
+		{
+			free(entry);
+			continue;
+		}
+		/* later lines are from later runs */
+		g_hash_table_insert(export->manifest, g_strdup(&line[name]), entry);
+	}
+	fclose(fp);
+}
+
+static void manifest_add(struct export *export, const struct export_file *file, const uint8_t *data, size_t size)
+{
+	if (!export->manifest_fp)
+		return;
+	const struct node_block *block = &file->block;
+	gchar *hash = g_compute_checksum_for_data(G_CHECKSUM_MD5, data, size);
+	g_mutex_lock(&export->manifest_mutex);
+	fprintf(export->manifest_fp, "%" PRIu64 " %s %" PRIu32 " %" PRIu32 " %" PRIu32 " %" PRIu32 " %s\n",
+	        (uint64_t)size, hash, (uint32_t)block->archive, block->offset,
+	        block->block_size, block->file_size, file->name);
+	fflush(export->manifest_fp);
+	g_mutex_unlock(&export->manifest_mutex);
+	g_free(hash);
+}
+
+/* the file on disk is kept if its manifest entry has the block of the source,
+ * and the size and hash of the file on disk
+ */
+static bool manifest_match(struct export *export, const struct export_file *file)
+{
+	if (!export->manifest)
+		return false;
+	const struct manifest_entry *entry = g_hash_table_lookup(export->manifest, file->name);
+	if (!entry)
+		return false;
+	/* a patch archive may have replaced the source since the previous run */
+	const struct node_block *block = &file->block;
+	if (block->archive == NODE_NO_ARCHIVE
+	 || entry->archive != block->archive
+	 || entry->offset != block->offset
+	 || entry->block_size != block->block_size
+	 || entry->file_size != block->file_size)
+		return false;
+	struct stat st;
+	if (stat(file->path, &st) == -1 || (uint64_t)st.st_size != entry->size)
+		return false;
+	FILE *fp = fopen(file->path, "rb");
+	if (!fp)
+		return false;
+	GChecksum *checksum = g_checksum_new(G_CHECKSUM_MD5);
+	uint8_t buffer[65536];
+	size_t n;
+	while ((n = fread(buffer, 1, sizeof(buffer), fp)) > 0)
+		g_checksum_update(checksum, buffer, n);
+	bool ret = !ferror(fp) && !strcmp(g_checksum_get_string(checksum), entry->hash);
+	g_checksum_free(checksum);
+	fclose(fp);
+	return ret;
+}
+
+static bool write_file(const char *path, const uint8_t *data, size_t size)
+{
+	int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (fd == -1)
+	{
+		fprintf(stderr, "failed to open '%s': %s\n", path, strerror(errno));
+		return false;
+	}
+	while (size)
+	{
+		ssize_t n = write(fd, data, size);
+		if (n == -1)
+		{
+			if (errno == EINTR)
+				continue;
+			fprintf(stderr, "failed to write '%s': %s\n", path, strerror(errno));
+			close(fd);
+			return false;
+		}
+		data += n;
+		size -= n;
+	}
+	if (close(fd) == -1)
+	{
+		fprintf(stderr, "failed to close '%s': %s\n", path, strerror(errno));
+		return false;
+	}
+	return true;
+}
+
+#ifdef __linux__
+/* stored files are copied by the kernel from the archive file, without going
+ * through a user space buffer; copy_file_range may even share the extents,
+ * sendfile is the fallback when the filesystems don't support it
+ */
+static bool copy_range(const char *path, const struct mpq_map_range *range)
+{
+	int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (fd == -1)
+		return false;
+	off_t offset = range->offset;
+	size_t size = range->size;
+	bool use_sendfile = false;
+	while (size)
+	{
+		ssize_t n;
+		if (use_sendfile)
+			n = sendfile(fd, range->fd, &offset, size);
+		else
+			n = copy_file_range(range->fd, &offset, fd, NULL, size, 0);
+		if (n > 0)
+		{
+			size -= n;
+			continue;
+		}
+		if (n == -1 && errno == EINTR)
+			continue;
+		if (n == -1 && !use_sendfile
+		 && (errno == EXDEV || errno == ENOSYS || errno == EOPNOTSUPP || errno == EINVAL))
+		{
+			use_sendfile = true;
+			continue;
+		}
+		close(fd);
+		return false;
+	}
+	return close(fd) != -1;
+}
+#endif
+
+static bool export_file(struct export *export, const struct export_file *file)
+{
+	if (manifest_match(export, file))
+	{
+		g_atomic_int_inc(&export->skipped);
+		return true;
+	}
+	/* not through the file cache: a bulk export would evict the browsed files */
+	struct wow_mpq_file *mpq_file = mpq_map_get_file(g_explorer->mpq_map, file->mpq_path);
+	if (!mpq_file)
+	{
+		fprintf(stderr, "failed to open mpq '%s'\n", file->mpq_path);
+		return false;
+	}
+	bool ret = false;
+#ifdef __linux__
+	struct mpq_map_range range;
+	if (mpq_map_get_range(g_explorer->mpq_map, mpq_file, &range))
+		ret = copy_range(file->path, &range);
+#endif
+	if (!ret)
+		ret = write_file(file->path, mpq_file->data, mpq_file->size);
+	/* the hash of a view reads the mapping, it is still never copied */
+	if (ret)
+		manifest_add(export, file, mpq_file->data, mpq_file->size);
+	mpq_map_release_file(g_explorer->mpq_map, mpq_file);
+	return ret;
+}
+
+static gpointer export_worker(gpointer data)
+{
+	struct export *export = data;
+	while (!g_atomic_int_get(&export->cancel))
+	{
+		size_t i = g_atomic_int_add(&export->next, 1);
+		if (i >= export->files.size)
+			break;
+		if (!export_file(export, JKS_ARRAY_GET(&export->files, i, struct export_file)))
+			g_atomic_int_inc(&export->failed);
+		g_atomic_int_inc(&export->done);
+	}
+	return NULL;
+}
+
+static bool window_reserve(struct export *export, size_t i)
+{
+	struct export_window *window = &export->window;
+	g_mutex_lock(&window->mutex);
+	while (i >= window->written + window->capacity && !g_atomic_int_get(&export->cancel))
+		g_cond_wait(&window->cond, &window->mutex);
+	bool ret = !g_atomic_int_get(&export->cancel);
+	g_mutex_unlock(&window->mutex);
+	return ret;
+}
+
+static void window_put(struct export *export, size_t i, const struct export_entry *entry)
+{
+	struct export_window *window = &export->window;
+	g_mutex_lock(&window->mutex);
+	window->entries[i % window->capacity] = *entry;
+	window->entries[i % window->capacity].ready = true;
+	g_cond_broadcast(&window->cond);
+	g_mutex_unlock(&window->mutex);
+}
+
+/* returns false when the export is cancelled */
+static bool window_take(struct export *export, size_t i, struct export_entry *entry)
+{
+	struct export_window *window = &export->window;
+	struct export_entry *slot = &window->entries[i % window->capacity];
+	g_mutex_lock(&window->mutex);
+	while (!slot->ready && !g_atomic_int_get(&export->cancel))
+		g_cond_wait(&window->cond, &window->mutex);
+	bool ret = slot->ready && !g_atomic_int_get(&export->cancel);
+	if (ret)
+	{
+		*entry = *slot;
+		slot->ready = false;
+		window->written++;
+		g_cond_broadcast(&window->cond);
+	}
+	g_mutex_unlock(&window->mutex);
+	return ret;
+}
+
+static void entry_destroy(struct export_entry *entry)
+{
+	if (entry->file)
+		mpq_map_release_file(g_explorer->mpq_map, entry->file);
+	free(entry->packed);
+}
+
+static gpointer pack_worker(gpointer data)
+{
+	struct export *export = data;
+	while (1)
+	{
+		size_t i = g_atomic_int_add(&export->next, 1);
+		if (i >= export->files.size || !window_reserve(export, i))
+			break;
+		const struct export_file *file = JKS_ARRAY_GET(&export->files, i, struct export_file);
+		struct export_entry entry;
+		memset(&entry, 0, sizeof(entry));
+		entry.file = mpq_map_get_file(g_explorer->mpq_map, file->mpq_path);
+		if (!entry.file)
+		{
+			fprintf(stderr, "failed to open mpq '%s'\n", file->mpq_path);
+			entry.failed = true;
+		}
+		else if (export->format == EXPORT_TAR)
+		{
+			entry.size = entry.file->size;
+		}
+		else if (export->format == EXPORT_ZIP)
+		{
+			entry.size = entry.file->size;
+			entry.crc = crc32(crc32(0, NULL, 0), entry.file->data, entry.file->size);
+			if (pack_deflate(entry.file->data, entry.file->size, &entry.packed, &entry.packed_size))
+			{
+				mpq_map_release_file(g_explorer->mpq_map, entry.file);
+				entry.file = NULL;
+			}
+		}
+		window_put(export, i, &entry);
+	}
+	return NULL;
+}
+
+/* the summary counts exported files as done - failed - skipped */
+static void export_fail_all(struct export *export)
+{
+	g_atomic_int_set(&export->failed, export->files.size);
+	g_atomic_int_set(&export->done, export->files.size);
+}
+
+static void export_pack(struct export *export)
+{
+	struct pack *pack = pack_new(export->root, export->format == EXPORT_TAR ? PACK_TAR : PACK_ZIP);
+	if (!pack)
+	{
+		export_fail_all(export);
+		return;
+	}
+	size_t threads_nb = parallel_threads();
+	GThread **threads = malloc(sizeof(*threads) * threads_nb);
+	export->window.capacity = threads_nb * 4;
+	export->window.entries = calloc(export->window.capacity, sizeof(*export->window.entries));
+	if (!threads || !export->window.entries)
+	{
+		fprintf(stderr, "export pack allocation failed\n");
+		free(threads);
+		pack_finish(pack);
+		export_fail_all(export);
+		return;
+	}
+	for (size_t i = 0; i < threads_nb; ++i)
+		threads[i] = g_thread_new("export", pack_worker, export);
+	for (size_t i = 0; i < export->files.size; ++i)
+	{
+		struct export_entry entry;
+		if (!window_take(export, i, &entry))
+			break;
+		const struct export_file *file = JKS_ARRAY_GET(&export->files, i, struct export_file);
+		bool ret = !entry.failed;
+		if (ret && entry.packed)
+			ret = pack_add(pack, file->name, NULL, entry.size, entry.crc, entry.packed, entry.packed_size);
+		else if (ret)
+			ret = pack_add(pack, file->name, entry.file->data, entry.size, entry.crc, NULL, 0);
+		if (!ret)
+			g_atomic_int_inc(&export->failed);
+		entry_destroy(&entry);
+		g_atomic_int_inc(&export->done);
+	}
+	for (size_t i = 0; i < threads_nb; ++i)
+		g_thread_join(threads[i]);
+	free(threads);
+	/* entries packed ahead of a cancellation */
+	for (size_t i = 0; i < export->window.capacity; ++i)
+	{
+		if (export->window.entries[i].ready)
+			entry_destroy(&export->window.entries[i]);
+	}
+	if (!pack_finish(pack))
+		fprintf(stderr, "failed to write '%s'\n", export->root);
+}
+
+static void export_delete(struct export *export)
+{
+	jks_array_destroy(&export->dirs);
+	jks_array_destroy(&export->files);
+	if (export->manifest)
+		g_hash_table_destroy(export->manifest);
+	g_mutex_clear(&export->manifest_mutex);
+	free(export->window.entries);
+	g_mutex_clear(&export->window.mutex);
+	g_cond_clear(&export->window.cond);
+	free(export->root);
+	free(export);
+}
+
+/* joins the coordinator, which has joined its workers */
+static void export_finish(struct export *export)
+{
+	g_thread_join(export->thread);
+	if (export->timer)
+		g_source_remove(export->timer);
+	gtk_widget_destroy(export->dialog);
+	printf("exported %d files to '%s' (%d up to date, %d failed%s)\n",
+	       g_atomic_int_get(&export->done) - export->failed - export->skipped,
+	       export->root, export->skipped, export->failed,
+	       g_atomic_int_get(&export->cancel) ? ", cancelled" : "");
+	g_exports = g_list_remove(g_exports, export);
+	export_delete(export);
+}
+
+static gpointer export_run(gpointer data)
+{
+	struct export *export = data;
+	if (!collect(export, export->node, export->format == EXPORT_DIRECTORY ? export->root : export->node->name))
+	{
+		fprintf(stderr, "export allocation failed\n");
+		goto end;
+	}
+	if (export->format != EXPORT_DIRECTORY)
+	{
+		g_atomic_int_set(&export->total, export->files.size);
+		export_pack(export);
+		goto end;
+	}
+	/* parents come before their childs in the tree order */
+	for (size_t i = 0; i < export->dirs.size && !g_atomic_int_get(&export->cancel); ++i)
+	{
+		const char *dir = *JKS_ARRAY_GET(&export->dirs, i, char*);
+		if (mkdir(dir, 0755) == -1 && errno != EEXIST)
+			fprintf(stderr, "failed to create '%s': %s\n", dir, strerror(errno));
+	}
+	if (export->dirs.size)
+	{
+		export->manifest = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, free);
+		manifest_load(export);
+		char path[4096];
+		snprintf(path, sizeof(path), "%s/" EXPORT_MANIFEST, export->root);
+		export->manifest_fp = fopen(path, "a");
+		if (!export->manifest_fp)
+			fprintf(stderr, "failed to open '%s': %s\n", path, strerror(errno));
+	}
+	g_atomic_int_set(&export->total, export->files.size);
+	size_t threads_nb = parallel_threads();
+	GThread **threads = malloc(sizeof(*threads) * threads_nb);
+	if (!threads)
+	{
+		fprintf(stderr, "export threads allocation failed\n");
+		threads_nb = 0;
+	}
+	for (size_t i = 0; i < threads_nb; ++i)
+		threads[i] = g_thread_new("export", export_worker, export);
+	/* the coordinator works too, and alone when no thread could be allocated */
+	export_worker(export);
+	for (size_t i = 0; i < threads_nb; ++i)
+		g_thread_join(threads[i]);
+	free(threads);
+	if (export->manifest_fp)
+		fclose(export->manifest_fp);
+
+end:
+	g_atomic_int_set(&export->finished, 1);
+	return NULL;
+}
+
+static void show_progress(struct export *export)
+{
+	gint total = g_atomic_int_get(&export->total);
+	gint done = g_atomic_int_get(&export->done);
+	char text[128];
+	if (g_atomic_int_get(&export->cancel))
+		snprintf(text, sizeof(text), "cancelling...");
+	else if (!total)
+		snprintf(text, sizeof(text), "listing files...");
+	else
+		snprintf(text, sizeof(text), "%d / %d files", done, total);
+	gtk_label_set_text(GTK_LABEL(export->label), text);
+	if (total)
+		gtk_progress_bar_set_fraction(GTK_PROGRESS_BAR(export->progress), (double)done / total);
+	else
+		gtk_progress_bar_pulse(GTK_PROGRESS_BAR(export->progress));
+}
+
+/* timeout callback only: the export is finished here, so that its source
+ * is the one being removed
+ */
+static gboolean update_progress(gpointer data)
+{
+	struct export *export = data;
+	if (g_atomic_int_get(&export->finished))
+	{
+		export->timer = 0;
+		export_finish(export);
+		return G_SOURCE_REMOVE;
+	}
+	show_progress(export);
+	return G_SOURCE_CONTINUE;
+}
+
+static void export_cancel(struct export *export)
+{
+	g_mutex_lock(&export->window.mutex);
+	g_atomic_int_set(&export->cancel, 1);
+	g_cond_broadcast(&export->window.cond);
+	g_mutex_unlock(&export->window.mutex);
+}
+
+static void on_response(GtkDialog *dialog, gint response, gpointer data)
+{
+	(void)dialog;
+	(void)response;
+	struct export *export = data;
+	/* the dialog stays until the workers are done */
+	export_cancel(export);
+	show_progress(export);
+}
+
+void export_cancel_all(void)
+{
+	for (GList *it = g_exports; it; it = it->next)
+		export_cancel(it->data);
+	while (g_exports)
+		export_finish(g_exports->data);
+}
+
+void export_start(struct node *node, const char *path, enum export_format format)
+{
+	struct export *export = calloc(1, sizeof(*export));
+	if (!export)
+	{
+		fprintf(stderr, "export allocation failed\n");
+		return;
+	}
+	export->node = node;
+	export->format = format;
+	export->root = strdup(path);
+	if (!export->root)
+	{
+		fprintf(stderr, "export allocation failed\n");
+		free(export);
+		return;
+	}
+	jks_array_init(&export->dirs, sizeof(char*), dir_delete, NULL);
+	jks_array_init(&export->files, sizeof(struct export_file), file_delete, NULL);
+	g_mutex_init(&export->manifest_mutex);
+	g_mutex_init(&export->window.mutex);
+	g_cond_init(&export->window.cond);
+	char title[256];
+	snprintf(title, sizeof(title), "exporting %s", node->name);
+	export->dialog = gtk_dialog_new_with_buttons(title, GTK_WINDOW(g_explorer->window), 0, "Cancel", GTK_RESPONSE_CANCEL, NULL);
+	gtk_window_set_default_size(GTK_WINDOW(export->dialog), 400, -1);
+	g_signal_connect(export->dialog, "response", G_CALLBACK(on_response), export);
+	GtkWidget *content = gtk_dialog_get_content_area(GTK_DIALOG(export->dialog));
+	export->label = gtk_label_new(NULL);
+	export->progress = gtk_progress_bar_new();
+	gtk_box_pack_start(GTK_BOX(content), export->label, false, false, 4);
+	gtk_box_pack_start(GTK_BOX(content), export->progress, false, false, 4);
+	gtk_widget_show_all(export->dialog);
+	show_progress(export);
+	export->timer = g_timeout_add(100, update_progress, export);
+	export->thread = g_thread_new("export", export_run, export);
+	g_exports = g_list_prepend(g_exports, export);
+}
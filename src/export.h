@@ -0,0 +1,29 @@
+#ifndef EXPLORER_EXPORT_H
+#define EXPLORER_EXPORT_H
+
+struct node;
+
+enum export_format
+{
+	EXPORT_DIRECTORY,
+	EXPORT_TAR,
+	EXPORT_ZIP,
+};
+
+/* export a node and its subtree to path on worker threads
+ * to a directory, directories are created in tree order before any file is
+ * written, and a manifest of the exported files lets an interrupted export
+ * resume, skipping the files already on disk with the same size and hash,
+ * exported from the same mpq block
+ * to a tar or zip, workers fetch and deflate the files while the archive is
+ * written sequentially, in tree order
+ * progress and cancellation go through a dialog; main thread only
+ */
+void export_start(struct node *node, const char *path, enum export_format format);
+
+/* cancel the running exports and wait for their threads, before the nodes
+ * and the mpq map they read are released
+ */
+void export_cancel_all(void);
+
+#endif
@@ -0,0 +1,283 @@
+#include "file_cache.h"
+#include "explorer.h"
+#include "mpq_map.h"
+
+#include <libwow/mpq.h>
+
+#include <stddef.h>
+
+struct file_cache_entry
+{
+	struct wow_mpq_file *file;
+	struct file_cache_entry *prev;
+	struct file_cache_entry *next;
+	uint32_t hash;
+	uint32_t refs;
+	char path[];
+};
+
+/* every user gets its own wow_mpq_file sharing the cached data, parsers move its read position */
+struct file_cache_handle
+{
+	struct wow_mpq_file file;
+	struct file_cache_entry *entry;
+};
+
+static uint32_t path_hash(const char *path)
+{
+	uint32_t hash = 2166136261u;
+	for (size_t i = 0; path[i]; ++i)
+	{
+		hash ^= (uint8_t)path[i];
+		hash *= 16777619u;
+	}
+	return hash;
+}
+
+struct file_cache *file_cache_new(struct mpq_map *map, size_t budget)
+{
+	struct file_cache *cache = malloc(sizeof(*cache));
+	if (!cache)
+	{
+		fprintf(stderr, "file cache allocation failed\n");
+		return NULL;
+	}
+	cache->map = map;
+	cache->count = 0;
+	cache->mask = 255;
+	cache->slots = calloc(cache->mask + 1, sizeof(*cache->slots));
+	if (!cache->slots)
+	{
+		fprintf(stderr, "file cache slots allocation failed\n");
+		free(cache);
+		return NULL;
+	}
+	cache->lru_head = NULL;
+	cache->lru_tail = NULL;
+	cache->budget = budget;
+	cache->size = 0;
+	g_mutex_init(&cache->mutex);
+	return cache;
+}
+
+static void entry_delete(struct file_cache *cache, struct file_cache_entry *entry)
+{
+	mpq_map_release_file(cache->map, entry->file);
+	free(entry);
+}
+
+void file_cache_delete(struct file_cache *cache)
+{
+	if (!cache)
+		return;
+	struct file_cache_entry *entry = cache->lru_head;
+	while (entry)
+	{
+		struct file_cache_entry *next = entry->next;
+		entry_delete(cache, entry);
+		entry = next;
+	}
+	g_mutex_clear(&cache->mutex);
+	free(cache->slots);
+	free(cache);
+}
+
+static void lru_unlink(struct file_cache *cache, struct file_cache_entry *entry)
+{
+	if (entry->prev)
+		entry->prev->next = entry->next;
+	else
+		cache->lru_head = entry->next;
+	if (entry->next)
+		entry->next->prev = entry->prev;
+	else
+		cache->lru_tail = entry->prev;
+	entry->prev = NULL;
+	entry->next = NULL;
+}
+
+static void lru_push(struct file_cache *cache, struct file_cache_entry *entry)
+{
+	entry->prev = NULL;
+	entry->next = cache->lru_head;
+	if (cache->lru_head)
+		cache->lru_head->prev = entry;
+	else
+		cache->lru_tail = entry;
+	cache->lru_head = entry;
+}
+
+static uint32_t find_slot(const struct file_cache *cache, const char *path, uint32_t hash)
+{
+	uint32_t i = hash & cache->mask;
+	while (cache->slots[i])
+	{
+		if (cache->slots[i]->hash == hash && !strcmp(cache->slots[i]->path, path))
+			break;
+		i = (i + 1) & cache->mask;
+	}
+	return i;
+}
+
+static void slots_remove(struct file_cache *cache, struct file_cache_entry *entry)
+{
+	uint32_t i = find_slot(cache, entry->path, entry->hash);
+	cache->slots[i] = NULL;
+	cache->count--;
+	/* reinsert the following entries of the probe chain */
+	i = (i + 1) & cache->mask;
+	while (cache->slots[i])
+	{
+		struct file_cache_entry *moved = cache->slots[i];
+		cache->slots[i] = NULL;
+		cache->slots[find_slot(cache, moved->path, moved->hash)] = moved;
+		i = (i + 1) & cache->mask;
+	}
+}
+
+static bool slots_add(struct file_cache *cache, struct file_cache_entry *entry)
+{
+	if ((cache->count + 1) * 2 > cache->mask + 1)
+	{
+		uint32_t mask = cache->mask * 2 + 1;
+		struct file_cache_entry **slots = calloc(mask + 1, sizeof(*slots));
+		if (!slots)
+		{
+			fprintf(stderr, "file cache slots allocation failed\n");
+			return false;
+		}
+		struct file_cache_entry **prev_slots = cache->slots;
+		uint32_t prev_mask = cache->mask;
+		cache->slots = slots;
+		cache->mask = mask;
+		for (uint32_t i = 0; i <= prev_mask; ++i)
+		{
+			if (prev_slots[i])
+				cache->slots[find_slot(cache, prev_slots[i]->path, prev_slots[i]->hash)] = prev_slots[i];
+		}
+		free(prev_slots);
+	}
+	cache->slots[find_slot(cache, entry->path, entry->hash)] = entry;
+	cache->count++;
+	return true;
+}
+
+/* views into the archives mapping don't take any memory of their own */
+static size_t entry_size(const struct file_cache *cache, const struct file_cache_entry *entry)
+{
+	if (mpq_map_is_view(cache->map, entry->file))
+		return 0;
+	return entry->file->size;
+}
+
+static void evict(struct file_cache *cache)
+{
+	struct file_cache_entry *entry = cache->lru_tail;
+	while (entry && cache->size > cache->budget)
+	{
+		struct file_cache_entry *prev = entry->prev;
+		if (!entry->refs)
+		{
+			cache->size -= entry_size(cache, entry);
+			lru_unlink(cache, entry);
+			slots_remove(cache, entry);
+			entry_delete(cache, entry);
+		}
+		entry = prev;
+	}
+}
+
+static struct wow_mpq_file *handle_new(struct file_cache_entry *entry)
+{
+	struct file_cache_handle *handle = malloc(sizeof(*handle));
+	if (!handle)
+	{
+		fprintf(stderr, "file cache handle allocation failed\n");
+		return NULL;
+	}
+	handle->file = *entry->file;
+	handle->file.pos = 0;
+	handle->entry = entry;
+	return &handle->file;
+}
+
+static struct wow_mpq_file *get_handle(struct file_cache *cache, struct file_cache_entry *entry)
+{
+	struct wow_mpq_file *file = handle_new(entry);
+	if (file)
+		return file;
+	g_mutex_lock(&cache->mutex);
+	entry->refs--;
+	evict(cache);
+	g_mutex_unlock(&cache->mutex);
+	return NULL;
+}
+
+struct wow_mpq_file *file_cache_get(struct file_cache *cache, const char *path)
+{
+	char key[512];
+	snprintf(key, sizeof(key), "%s", path);
+	normalize_mpq_filename(key, sizeof(key));
+	uint32_t hash = path_hash(key);
+	g_mutex_lock(&cache->mutex);
+	struct file_cache_entry *entry = cache->slots[find_slot(cache, key, hash)];
+	if (entry)
+	{
+		entry->refs++;
+		lru_unlink(cache, entry);
+		lru_push(cache, entry);
+		g_mutex_unlock(&cache->mutex);
+		return get_handle(cache, entry);
+	}
+	g_mutex_unlock(&cache->mutex);
+	/* decompress outside of the lock, concurrent misses on the same path keep the first one */
+	struct wow_mpq_file *file = mpq_map_get_file(cache->map, key);
+	if (!file)
+		return NULL;
+	size_t len = strlen(key) + 1;
+	entry = malloc(sizeof(*entry) + len);
+	if (!entry)
+	{
+		fprintf(stderr, "file cache entry allocation failed\n");
+		mpq_map_release_file(cache->map, file);
+		return NULL;
+	}
+	entry->file = file;
+	entry->hash = hash;
+	entry->refs = 1;
+	memcpy(entry->path, key, len);
+	g_mutex_lock(&cache->mutex);
+	struct file_cache_entry *other = cache->slots[find_slot(cache, key, hash)];
+	if (other)
+	{
+		other->refs++;
+		lru_unlink(cache, other);
+		lru_push(cache, other);
+		g_mutex_unlock(&cache->mutex);
+		entry_delete(cache, entry);
+		return get_handle(cache, other);
+	}
+	if (!slots_add(cache, entry))
+	{
+		g_mutex_unlock(&cache->mutex);
+		entry_delete(cache, entry);
+		return NULL;
+	}
+	lru_push(cache, entry);
+	cache->size += entry_size(cache, entry);
+	evict(cache);
+	g_mutex_unlock(&cache->mutex);
+	return get_handle(cache, entry);
+}
+
+void file_cache_release(struct file_cache *cache, struct wow_mpq_file *file)
+{
+	if (!file)
+		return;
+	struct file_cache_handle *handle = (struct file_cache_handle*)file;
+	g_mutex_lock(&cache->mutex);
+	handle->entry->refs--;
+	evict(cache);
+	g_mutex_unlock(&cache->mutex);
+	free(handle);
+}
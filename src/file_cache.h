@@ -0,0 +1,35 @@
+#ifndef EXPLORER_FILE_CACHE_H
+#define EXPLORER_FILE_CACHE_H
+
+#include <gtk/gtk.h>
+
+#include <stdint.h>
+#include <stddef.h>
+
+struct file_cache_entry;
+struct wow_mpq_file;
+struct mpq_map;
+
+/* byte budgeted LRU cache of the decompressed mpq files
+ * files handed out are referenced until file_cache_release, only unreferenced
+ * files are evicted; safe to use from any thread
+ */
+struct file_cache
+{
+	struct mpq_map *map;
+	struct file_cache_entry **slots;
+	struct file_cache_entry *lru_head; /* most recently used */
+	struct file_cache_entry *lru_tail;
+	uint32_t count;
+	uint32_t mask;
+	size_t budget;
+	size_t size;
+	GMutex mutex;
+};
+
+struct file_cache *file_cache_new(struct mpq_map *map, size_t budget);
+void file_cache_delete(struct file_cache *cache);
+struct wow_mpq_file *file_cache_get(struct file_cache *cache, const char *path);
+void file_cache_release(struct file_cache *cache, struct wow_mpq_file *file);
+
+#endif
@@ -0,0 +1,284 @@
+#include "displays/display.h"
+
+#include "explorer.h"
+#include "file_cache.h"
+#include "loader.h"
+#include "prefetch.h"
+#include "nodes.h"
+
+#include <libwow/wmo_group.h>
+#include <libwow/mpq.h>
+#include <libwow/adt.h>
+#include <libwow/blp.h>
+#include <libwow/bls.h>
+#include <libwow/dbc.h>
+#include <libwow/wdl.h>
+#include <libwow/wdt.h>
+#include <libwow/wmo.h>
+#include <libwow/m2.h>
+
+#include <inttypes.h>
+#include <ctype.h>
+
+typedef struct display *(*display_ctr_t)(const struct node *node, const char *path, struct wow_mpq_file *file, void *parsed);
+typedef void *(*display_parse_t)(struct wow_mpq_file *file);
+typedef void (*display_parsed_delete_t)(void *parsed);
+typedef void (*display_refs_t)(const char *path, void *parsed, struct jks_array *refs);
+
+#define PARSER(name) \
+static void *name##_parse(struct wow_mpq_file *file) \
+{ \
+	return wow_##name##_file_new(file); \
+} \
+static void name##_parsed_delete(void *parsed) \
+{ \
+	wow_##name##_file_delete(parsed); \
+}
+
+PARSER(adt)
+PARSER(blp)
+PARSER(bls)
+PARSER(dbc)
+PARSER(m2)
+PARSER(wdl)
+PARSER(wdt)
+PARSER(wmo)
+PARSER(wmo_group)
+
+#undef PARSER
+
+static void push_ref(struct jks_array *refs, const char *path)
+{
+	if (!path || !*path)
+		return;
+	char *dup = strdup(path);
+	if (!dup)
+		return;
+	if (!jks_array_push_back(refs, &dup))
+		free(dup);
+}
+
+static void m2_refs(const char *path, void *parsed, struct jks_array *refs)
+{
+	struct wow_m2_file *file = parsed;
+	(void)path;
+	for (uint32_t i = 0; i < file->textures_nb; ++i)
+		push_ref(refs, file->textures[i].filename);
+}
+
+static void wmo_refs(const char *path, void *parsed, struct jks_array *refs)
+{
+	struct wow_wmo_file *file = parsed;
+	int len = strlen(path) - 4;
+	for (uint32_t i = 0; i < file->mohd.groups_nb; ++i)
+	{
+		char group[512];
+		snprintf(group, sizeof(group), "%.*s_%03" PRIu32 ".wmo", len, path, i);
+		push_ref(refs, group);
+	}
+	for (uint32_t i = 0; i < file->motx.data_len; ++i)
+	{
+		if (!file->motx.data[i])
+			continue;
+		push_ref(refs, &file->motx.data[i]);
+		i += strlen(&file->motx.data[i]);
+	}
+}
+
+struct display_constructor
+{
+	const char *ext;
+	display_ctr_t ctr;
+	display_parse_t parse;
+	display_parsed_delete_t parsed_delete;
+	display_refs_t refs;
+};
+
+static const struct display_constructor display_constructors[] =
+{
+	{".blp" , blp_display_new, blp_parse, blp_parsed_delete, NULL},
+	{".dbc" , dbc_display_new, dbc_parse, dbc_parsed_delete, NULL},
+	{".bls" , bls_display_new, bls_parse, bls_parsed_delete, NULL},
+	{".wdl" , wdl_display_new, wdl_parse, wdl_parsed_delete, NULL},
+	{".wdt" , wdt_display_new, wdt_parse, wdt_parsed_delete, NULL},
+	{".adt" , adt_display_new, adt_parse, adt_parsed_delete, NULL},
+	{".m2"  , m2_display_new , m2_parse , m2_parsed_delete, m2_refs},
+	{".mdl" , m2_display_new , m2_parse , m2_parsed_delete, m2_refs},
+	{".mdx" , m2_display_new , m2_parse , m2_parsed_delete, m2_refs},
+	{".gif" , img_display_new, NULL, NULL, NULL},
+	{".png" , img_display_new, NULL, NULL, NULL},
+	{".jpg" , img_display_new, NULL, NULL, NULL},
+	{".jpeg", img_display_new, NULL, NULL, NULL},
+	{".tiff", img_display_new, NULL, NULL, NULL},
+	{".js"  , txt_display_new, NULL, NULL, NULL},
+	{".xml" , txt_display_new, NULL, NULL, NULL},
+	{".lua" , txt_display_new, NULL, NULL, NULL},
+	{".wtf" , txt_display_new, NULL, NULL, NULL},
+	{".wfx" , txt_display_new, NULL, NULL, NULL},
+	{".ini" , txt_display_new, NULL, NULL, NULL},
+	{".txt" , txt_display_new, NULL, NULL, NULL},
+	{".toc" , txt_display_new, NULL, NULL, NULL},
+	{".url" , txt_display_new, NULL, NULL, NULL},
+	{".css" , txt_display_new, NULL, NULL, NULL},
+	{".html", txt_display_new, NULL, NULL, NULL},
+	{".zmp" , txt_display_new, NULL, NULL, NULL},
+	{".wmo" , wmo_display_new, wmo_parse, wmo_parsed_delete, wmo_refs},
+};
+
+static const struct display_constructor wmo_group_constructor = {".wmo", wmo_group_display_new, wmo_group_parse, wmo_group_parsed_delete, NULL};
+
+static const struct display_constructor default_constructor = {"", txt_display_new, NULL, NULL, NULL};
+
+struct load_request
+{
+	const struct display_constructor *constructor;
+	struct node *node;
+	struct wow_mpq_file *file;
+	void *parsed;
+	struct jks_array refs; /* char*, files to prefetch once displayed */
+	gint generation;
+	char path[512];
+};
+
+static GThreadPool *g_pool;
+static gint g_generation;
+
+static bool is_ext(const char *path, const char *ext)
+{
+	size_t len = strlen(path);
+	size_t ext_len = strlen(ext);
+	if (len < ext_len)
+		return false;
+	return !strcmp(&path[len - ext_len], ext);
+}
+
+/* groups are named after their root: root_NNN.wmo */
+static bool is_wmo_group(const char *path)
+{
+	size_t len = strlen(path);
+	if (len < 8 || path[len - 8] != '_')
+		return false;
+	for (size_t i = len - 7; i < len - 4; ++i)
+	{
+		if (!isdigit((unsigned char)path[i]))
+			return false;
+	}
+	return is_ext(path, ".wmo");
+}
+
+static const struct display_constructor *get_constructor(const char *path)
+{
+	if (is_wmo_group(path))
+		return &wmo_group_constructor;
+	for (size_t i = 0; i < sizeof(display_constructors) / sizeof(*display_constructors); ++i)
+	{
+		if (is_ext(path, display_constructors[i].ext))
+			return &display_constructors[i];
+	}
+	return &default_constructor;
+}
+
+static bool request_stale(const struct load_request *request)
+{
+	return g_atomic_int_get(&g_generation) != request->generation;
+}
+
+static void ref_delete(void *ptr)
+{
+	free(*(char**)ptr);
+}
+
+static void request_delete(struct load_request *request)
+{
+	if (request->parsed)
+		request->constructor->parsed_delete(request->parsed);
+	if (request->file)
+		file_cache_release(g_explorer->file_cache, request->file);
+	jks_array_destroy(&request->refs);
+	free(request);
+}
+
+static gboolean load_finish(gpointer data)
+{
+	struct load_request *request = data;
+	if (request_stale(request))
+	{
+		request_delete(request);
+		return G_SOURCE_REMOVE;
+	}
+	if (!request->file)
+	{
+		fprintf(stderr, "can't open file \"%s\"\n", request->path);
+		request_delete(request);
+		return G_SOURCE_REMOVE;
+	}
+	/* the display takes the parsed file, and may parse again on failure */
+	void *parsed = request->parsed;
+	request->parsed = NULL;
+	request->file->pos = 0;
+	struct display *display = request->constructor->ctr(request->node, request->path, request->file, parsed);
+	if (display)
+		explorer_set_display(g_explorer, display);
+	else
+		fprintf(stderr, "can't find handler for file \"%s\"\n", request->path);
+	prefetch_start(request->node, &request->refs);
+	request_delete(request);
+	return G_SOURCE_REMOVE;
+}
+
+static void load_worker(gpointer data, gpointer userdata)
+{
+	struct load_request *request = data;
+	(void)userdata;
+	if (request_stale(request))
+	{
+		request_delete(request);
+		return;
+	}
+	request->file = file_cache_get(g_explorer->file_cache, request->path);
+	if (request->file && request->constructor->parse && !request_stale(request))
+		request->parsed = request->constructor->parse(request->file);
+	if (request->parsed && request->constructor->refs && !request_stale(request))
+		request->constructor->refs(request->path, request->parsed, &request->refs);
+	g_idle_add(load_finish, request);
+}
+
+static gpointer create_pool(gpointer data)
+{
+	(void)data;
+	/* two workers, a stale load being parsed doesn't hold the next one */
+	g_pool = g_thread_pool_new(load_worker, NULL, 2, FALSE, NULL);
+	return g_pool;
+}
+
+void loader_load(struct node *node)
+{
+	static GOnce once = G_ONCE_INIT;
+	g_once(&once, create_pool, NULL);
+	prefetch_cancel();
+	struct load_request *request = malloc(sizeof(*request));
+	if (!request)
+	{
+		fprintf(stderr, "load request allocation failed\n");
+		return;
+	}
+	request->node = node;
+	request->file = NULL;
+	request->parsed = NULL;
+	jks_array_init(&request->refs, sizeof(char*), ref_delete, NULL);
+	request->generation = g_atomic_int_add(&g_generation, 1) + 1;
+	node_get_path(node, request->path, sizeof(request->path));
+	request->constructor = get_constructor(request->path);
+	if (!g_pool)
+	{
+		load_worker(request, NULL);
+		return;
+	}
+	g_thread_pool_push(g_pool, request, NULL);
+}
+
+void loader_cancel(void)
+{
+	prefetch_cancel();
+	g_atomic_int_inc(&g_generation);
+}
@@ -0,0 +1,14 @@
+#ifndef EXPLORER_LOADER_H
+#define EXPLORER_LOADER_H
+
+struct node;
+
+/* open the display of a file node
+ * the file is fetched and parsed on a worker thread, only the display
+ * widgets are built on the main thread once it is ready
+ * a newer load (or a cancel) drops the pending one
+ */
+void loader_load(struct node *node);
+void loader_cancel(void);
+
+#endif
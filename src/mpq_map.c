@@ -0,0 +1,287 @@
+#include "utils/parallel.h"
+
+#include "mpq_map.h"
+
+#include <libwow/mpq.h>
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <stdio.h>
+
+#define MPQ_BLOCK_NOT_STORED (WOW_MPQ_BLOCK_IMPLODE \
+                            | WOW_MPQ_BLOCK_COMPRESS \
+                            | WOW_MPQ_BLOCK_ENCRYPTED \
+                            | WOW_MPQ_BLOCK_PATCH_FILE \
+                            | WOW_MPQ_BLOCK_DELETE_MARKER \
+                            | WOW_MPQ_BLOCK_SECTOR_CRC)
+
+static bool map_archive(struct mpq_map_archive *archive, const char *path)
+{
+	archive->data = NULL;
+	archive->size = 0;
+	archive->fd = -1;
+	int fd = open(path, O_RDONLY);
+	if (fd == -1)
+	{
+		fprintf(stderr, "failed to open '%s': %s\n", path, strerror(errno));
+		return false;
+	}
+	struct stat st;
+	if (fstat(fd, &st) == -1 || !st.st_size)
+	{
+		close(fd);
+		return false;
+	}
+	/* read only: a copy on write page would replace the mapping for every later
+	 * view of the range, so the views must never be written
+	 */
+	void *data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (data == MAP_FAILED)
+	{
+		fprintf(stderr, "failed to map '%s': %s\n", path, strerror(errno));
+		close(fd);
+		return false;
+	}
+	/* block offsets are relative to the MPQ header, only map archives starting with it */
+	if (st.st_size < 32 || memcmp(data, "MPQ\x1A", 4))
+	{
+		munmap(data, st.st_size);
+		close(fd);
+		return false;
+	}
+	archive->data = data;
+	archive->size = st.st_size;
+	archive->fd = fd;
+	return true;
+}
+
+struct mpq_map *mpq_map_new(struct wow_mpq_compound *compound)
+{
+	struct mpq_map *map = malloc(sizeof(*map));
+	if (!map)
+	{
+		fprintf(stderr, "mpq map allocation failed\n");
+		return NULL;
+	}
+	map->compound = compound;
+	g_mutex_init(&map->mutex);
+	g_cond_init(&map->cond);
+	map->archives_nb = compound->archives_nb;
+	map->archives = calloc(map->archives_nb ? map->archives_nb : 1, sizeof(*map->archives));
+	map->handles = calloc(1, sizeof(*map->handles));
+	if (!map->archives || !map->handles)
+	{
+		fprintf(stderr, "mpq map archives allocation failed\n");
+		free(map->archives);
+		free(map->handles);
+		g_cond_clear(&map->cond);
+		g_mutex_clear(&map->mutex);
+		free(map);
+		return NULL;
+	}
+	/* the compound of the explorer is the first set, its archives aren't owned */
+	map->handles->archives = NULL;
+	map->handles->compound = compound;
+	map->handles->next = NULL;
+	map->handles_nb = 1;
+	/* the ui thread, the export coordinator and the workers */
+	map->handles_max = parallel_threads() + 2;
+	for (uint32_t i = 0; i < map->archives_nb; ++i)
+		map_archive(&map->archives[i], compound->archives[i].archive->filename);
+	return map;
+}
+
+static void handles_delete(struct mpq_map *map, struct mpq_map_handles *handles)
+{
+	if (handles->archives)
+	{
+		wow_mpq_compound_delete(handles->compound);
+		for (uint32_t i = 0; i < map->archives_nb; ++i)
+		{
+			if (handles->archives[i])
+				wow_mpq_archive_delete(handles->archives[i]);
+		}
+		free(handles->archives);
+	}
+	free(handles);
+}
+
+static struct mpq_map_handles *handles_new(struct mpq_map *map)
+{
+	struct mpq_map_handles *handles = malloc(sizeof(*handles));
+	if (!handles)
+		return NULL;
+	handles->next = NULL;
+	handles->compound = NULL;
+	handles->archives = calloc(map->archives_nb ? map->archives_nb : 1, sizeof(*handles->archives));
+	if (!handles->archives)
+	{
+		free(handles);
+		return NULL;
+	}
+	handles->compound = wow_mpq_compound_new();
+	if (!handles->compound)
+		goto err;
+	/* the archives must be added in the order of the compound for the same files to win */
+	for (uint32_t i = 0; i < map->archives_nb; ++i)
+	{
+		handles->archives[i] = wow_mpq_archive_new(map->compound->archives[i].archive->filename);
+		if (!handles->archives[i]
+		 || !wow_mpq_compound_add_archive(handles->compound, handles->archives[i]))
+			goto err;
+	}
+	return handles;
+
+err:
+	fprintf(stderr, "failed to open mpq handles\n");
+	if (!handles->compound)
+	{
+		free(handles->archives);
+		free(handles);
+		return NULL;
+	}
+	handles_delete(map, handles);
+	return NULL;
+}
+
+/* take an idle set, or open a new one while below handles_max, or wait */
+static struct mpq_map_handles *handles_take(struct mpq_map *map)
+{
+	g_mutex_lock(&map->mutex);
+	while (!map->handles)
+	{
+		if (map->handles_nb < map->handles_max)
+		{
+			map->handles_nb++;
+			g_mutex_unlock(&map->mutex);
+			struct mpq_map_handles *handles = handles_new(map);
+			if (handles)
+				return handles;
+			g_mutex_lock(&map->mutex);
+			/* don't retry: wait for the sets in use */
+			map->handles_max = --map->handles_nb;
+			continue;
+		}
+		g_cond_wait(&map->cond, &map->mutex);
+	}
+	struct mpq_map_handles *handles = map->handles;
+	map->handles = handles->next;
+	g_mutex_unlock(&map->mutex);
+	return handles;
+}
+
+static void handles_give(struct mpq_map *map, struct mpq_map_handles *handles)
+{
+	g_mutex_lock(&map->mutex);
+	handles->next = map->handles;
+	map->handles = handles;
+	g_cond_signal(&map->cond);
+	g_mutex_unlock(&map->mutex);
+}
+
+void mpq_map_delete(struct mpq_map *map)
+{
+	if (!map)
+		return;
+	while (map->handles)
+	{
+		struct mpq_map_handles *handles = map->handles;
+		map->handles = handles->next;
+		handles_delete(map, handles);
+	}
+	for (uint32_t i = 0; i < map->archives_nb; ++i)
+	{
+		if (map->archives[i].data)
+			munmap(map->archives[i].data, map->archives[i].size);
+		if (map->archives[i].fd != -1)
+			close(map->archives[i].fd);
+	}
+	free(map->archives);
+	g_cond_clear(&map->cond);
+	g_mutex_clear(&map->mutex);
+	free(map);
+}
+
+/* only reads the in memory hash and block tables, no lock needed */
+static struct wow_mpq_file *get_view(struct mpq_map *map, const char *path)
+{
+	for (uint32_t i = 0; i < map->archives_nb; ++i)
+	{
+		const struct wow_mpq_block *block = wow_mpq_get_archive_block(&map->compound->archives[i], path);
+		if (!block)
+			continue;
+		/* the first archive holding the file wins, just as in the compound */
+		const struct mpq_map_archive *archive = &map->archives[i];
+		if (!archive->data
+		 || !(block->flags & WOW_MPQ_BLOCK_EXISTS)
+		 || (block->flags & MPQ_BLOCK_NOT_STORED)
+		 || !block->file_size
+		 || block->block_size != block->file_size
+		 || block->offset > archive->size
+		 || block->file_size > archive->size - block->offset)
+			return NULL;
+		struct wow_mpq_file *file = calloc(1, sizeof(*file));
+		if (!file)
+			return NULL;
+		file->data = &archive->data[block->offset];
+		file->size = block->file_size;
+		return file;
+	}
+	return NULL;
+}
+
+struct wow_mpq_file *mpq_map_get_file(struct mpq_map *map, const char *path)
+{
+	struct wow_mpq_file *file = get_view(map, path);
+	if (file)
+		return file;
+	struct mpq_map_handles *handles = handles_take(map);
+	file = wow_mpq_get_file(handles->compound, path);
+	handles_give(map, handles);
+	return file;
+}
+
+static const struct mpq_map_archive *get_view_archive(const struct mpq_map *map, const struct wow_mpq_file *file)
+{
+	for (uint32_t i = 0; i < map->archives_nb; ++i)
+	{
+		const struct mpq_map_archive *archive = &map->archives[i];
+		if (archive->data
+		 && file->data >= archive->data
+		 && file->data < archive->data + archive->size)
+			return archive;
+	}
+	return NULL;
+}
+
+bool mpq_map_is_view(const struct mpq_map *map, const struct wow_mpq_file *file)
+{
+	return get_view_archive(map, file) != NULL;
+}
+
+bool mpq_map_get_range(const struct mpq_map *map, const struct wow_mpq_file *file, struct mpq_map_range *range)
+{
+	const struct mpq_map_archive *archive = get_view_archive(map, file);
+	if (!archive)
+		return false;
+	range->fd = archive->fd;
+	range->offset = file->data - archive->data;
+	range->size = file->size;
+	return true;
+}
+
+void mpq_map_release_file(struct mpq_map *map, struct wow_mpq_file *file)
+{
+	if (!file)
+		return;
+	if (mpq_map_is_view(map, file))
+		free(file);
+	else
+		wow_mpq_file_delete(file);
+}
@@ -0,0 +1,66 @@
+#ifndef EXPLORER_MPQ_MAP_H
+#define EXPLORER_MPQ_MAP_H
+
+#include <gtk/gtk.h>
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+
+struct wow_mpq_compound;
+struct wow_mpq_file;
+
+struct mpq_map_archive
+{
+	uint8_t *data;
+	size_t size;
+	int fd; /* kept open for the kernel side copies of the views, -1 if not mapped */
+};
+
+/* bytes of a view in its archive file */
+struct mpq_map_range
+{
+	int fd;
+	uint64_t offset;
+	size_t size;
+};
+
+/* archives opened again with their own FILE handles, so that a thread can
+ * decompress a file while the other ones are using other handles
+ */
+struct mpq_map_handles
+{
+	struct wow_mpq_archive **archives;
+	struct wow_mpq_compound *compound;
+	struct mpq_map_handles *next;
+};
+
+/* memory mapping of the compound archives
+ * stored files (no compression, implosion nor encryption) are returned as
+ * views into the mapping instead of being read and copied; the mapping is
+ * read only, a consumer needing to write its input must work on a copy
+ * libwow reads the archives through FILE handles, so the other files are
+ * read from a pool of handles sets: a thread takes an idle set (or opens a
+ * new one, up to handles_max) and decompresses without holding the mutex,
+ * which only guards the pool
+ */
+struct mpq_map
+{
+	struct wow_mpq_compound *compound;
+	struct mpq_map_archive *archives; /* same order as the compound archives */
+	uint32_t archives_nb;
+	struct mpq_map_handles *handles; /* idle sets */
+	uint32_t handles_nb;
+	uint32_t handles_max;
+	GMutex mutex;
+	GCond cond;
+};
+
+struct mpq_map *mpq_map_new(struct wow_mpq_compound *compound);
+void mpq_map_delete(struct mpq_map *map);
+struct wow_mpq_file *mpq_map_get_file(struct mpq_map *map, const char *path);
+void mpq_map_release_file(struct mpq_map *map, struct wow_mpq_file *file);
+bool mpq_map_is_view(const struct mpq_map *map, const struct wow_mpq_file *file);
+bool mpq_map_get_range(const struct mpq_map *map, const struct wow_mpq_file *file, struct mpq_map_range *range);
+
+#endif
@@ -0,0 +1,547 @@
+#include "node_cache.h"
+#include "nodes.h"
+
+#include <jks/array.h>
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <inttypes.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <stdio.h>
+#include <zlib.h>
+
+#define NODE_CACHE_MAGIC "WEXC"
+#define NODE_CACHE_VERSION 2
+
+#define NODE_CACHE_DIR 0x1
+
+/*
+ * File layout:
+ * header
+ * archives[archives_nb]
+ * nodes[nodes_nb]       (breadth first: the childs of a node are contiguous, root is 0)
+ * refs[refs_nb]         (file node indexes, grouped by archive)
+ * strings[strings_size] (names and archive paths)
+ */
+
+struct node_cache_header
+{
+	char magic[4];
+	uint32_t version;
+	uint32_t archives_nb;
+	uint32_t nodes_nb;
+	uint32_t refs_nb;
+	uint32_t strings_size;
+	uint32_t files_count;
+	uint32_t padding;
+};
+
+struct node_cache_archive
+{
+	uint32_t path;
+	uint32_t refs;
+	uint32_t refs_nb;
+	uint32_t hash_crc;
+	uint64_t size;
+	int64_t mtime;
+};
+
+struct node_cache_node
+{
+	uint32_t name;
+	uint32_t parent;
+	uint32_t childs;
+	uint32_t childs_nb;
+	uint32_t flags;
+	/* struct node_block, archive is NODE_NO_ARCHIVE for the directories */
+	uint32_t archive;
+	uint32_t offset;
+	uint32_t block_size;
+	uint32_t file_size;
+	uint32_t block_flags;
+};
+
+struct node_cache
+{
+	void *data;
+	size_t size;
+	const struct node_cache_header *header;
+	const struct node_cache_archive *archives;
+	const struct node_cache_node *nodes;
+	const uint32_t *refs;
+	const char *strings;
+};
+
+static uint32_t read_u32(const uint8_t *data)
+{
+	return data[0] | (data[1] << 8) | (data[2] << 16) | ((uint32_t)data[3] << 24);
+}
+
+static uint32_t hash_table_crc(const char *path)
+{
+	FILE *fp = fopen(path, "rb");
+	if (!fp)
+		return 0;
+	uint32_t crc = 0;
+	uint8_t header[32];
+	if (fread(header, 1, sizeof(header), fp) != sizeof(header)
+	 || memcmp(header, "MPQ\x1A", 4))
+		goto end;
+	uint32_t hash_table_pos = read_u32(&header[16]);
+	uint32_t hash_table_size = read_u32(&header[24]);
+	if (fseek(fp, hash_table_pos, SEEK_SET))
+		goto end;
+	crc = crc32(0, NULL, 0);
+	uint8_t buffer[4096];
+	size_t remaining = (size_t)hash_table_size * 16;
+	while (remaining)
+	{
+		size_t n = remaining < sizeof(buffer) ? remaining : sizeof(buffer);
+		if (fread(buffer, 1, n, fp) != n)
+			break;
+		crc = crc32(crc, buffer, n);
+		remaining -= n;
+	}
+
+end:
+	fclose(fp);
+	return crc;
+}
+
+bool node_cache_key_init(struct node_cache_key *key, const char *path)
+{
+	struct stat st;
+	key->path = path;
+	if (stat(path, &st) == -1)
+		return false;
+	key->size = st.st_size;
+	key->mtime = st.st_mtime;
+	key->hash_crc = hash_table_crc(path);
+	return true;
+}
+
+struct node_cache *node_cache_open(const char *path)
+{
+	int fd = open(path, O_RDONLY);
+	if (fd == -1)
+		return NULL;
+	struct stat st;
+	if (fstat(fd, &st) == -1
+	 || (size_t)st.st_size < sizeof(struct node_cache_header))
+	{
+		close(fd);
+		return NULL;
+	}
+	void *data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (data == MAP_FAILED)
+	{
+		fprintf(stderr, "failed to map node cache: %s\n", strerror(errno));
+		return NULL;
+	}
+	struct node_cache *cache = malloc(sizeof(*cache));
+	if (!cache)
+	{
+		fprintf(stderr, "node cache allocation failed\n");
+		munmap(data, st.st_size);
+		return NULL;
+	}
+	cache->data = data;
+	cache->size = st.st_size;
+	cache->header = data;
+	const struct node_cache_header *header = cache->header;
+	if (memcmp(header->magic, NODE_CACHE_MAGIC, 4)
+	 || header->version != NODE_CACHE_VERSION)
+		goto err;
+	uint64_t size = sizeof(*header);
+	size += (uint64_t)header->archives_nb * sizeof(struct node_cache_archive);
+	size += (uint64_t)header->nodes_nb * sizeof(struct node_cache_node);
+	size += (uint64_t)header->refs_nb * sizeof(uint32_t);
+	size += header->strings_size;
+	if (size != cache->size
+	 || !header->nodes_nb
+	 || !header->strings_size)
+		goto err;
+	cache->archives = (const struct node_cache_archive*)&header[1];
+	cache->nodes = (const struct node_cache_node*)&cache->archives[header->archives_nb];
+	cache->refs = (const uint32_t*)&cache->nodes[header->nodes_nb];
+	cache->strings = (const char*)&cache->refs[header->refs_nb];
+	if (cache->strings[header->strings_size - 1])
+		goto err;
+	for (uint32_t i = 0; i < header->archives_nb; ++i)
+	{
+		const struct node_cache_archive *archive = &cache->archives[i];
+		if (archive->path >= header->strings_size
+		 || archive->refs > header->refs_nb
+		 || archive->refs_nb > header->refs_nb - archive->refs)
+			goto err;
+	}
+	/* breadth first: the childs ranges follow each other from 1, so every
+	 * node but the root has exactly one parent, and comes after it
+	 */
+	uint64_t next = 1;
+	for (uint32_t i = 0; i < header->nodes_nb; ++i)
+	{
+		const struct node_cache_node *node = &cache->nodes[i];
+		if (node->name >= header->strings_size
+		 || node->parent >= header->nodes_nb
+		 || (i && node->parent >= i)
+		 || (node->archive >= header->archives_nb && node->archive != NODE_NO_ARCHIVE))
+			goto err;
+		if (!node->childs_nb)
+			continue;
+		if (!(node->flags & NODE_CACHE_DIR)
+		 || node->childs != next
+		 || node->childs <= i
+		 || node->childs_nb > header->nodes_nb - next)
+			goto err;
+		for (uint32_t j = 0; j < node->childs_nb; ++j)
+		{
+			if (cache->nodes[node->childs + j].parent != i)
+				goto err;
+		}
+		next += node->childs_nb;
+	}
+	if (next != header->nodes_nb)
+		goto err;
+	for (uint32_t i = 0; i < header->refs_nb; ++i)
+	{
+		if (cache->refs[i] >= header->nodes_nb)
+			goto err;
+	}
+	return cache;
+
+err:
+	fprintf(stderr, "invalid node cache \"%s\"\n", path);
+	node_cache_close(cache);
+	return NULL;
+}
+
+void node_cache_close(struct node_cache *cache)
+{
+	if (!cache)
+		return;
+	munmap(cache->data, cache->size);
+	free(cache);
+}
+
+static const struct node_cache_archive *get_archive(const struct node_cache *cache, const struct node_cache_key *key)
+{
+	for (uint32_t i = 0; i < cache->header->archives_nb; ++i)
+	{
+		const struct node_cache_archive *archive = &cache->archives[i];
+		if (strcmp(&cache->strings[archive->path], key->path))
+			continue;
+		if (archive->size != key->size
+		 || archive->mtime != key->mtime
+		 || archive->hash_crc != key->hash_crc)
+			return NULL;
+		return archive;
+	}
+	return NULL;
+}
+
+/* the blocks refer to the archives by index: same archives, same order */
+bool node_cache_valid(const struct node_cache *cache, const struct node_cache_key *keys, uint32_t keys_nb)
+{
+	if (cache->header->archives_nb != keys_nb)
+		return false;
+	for (uint32_t i = 0; i < keys_nb; ++i)
+	{
+		if (get_archive(cache, &keys[i]) != &cache->archives[i])
+			return false;
+	}
+	return true;
+}
+
+bool node_cache_load(const struct node_cache *cache, struct node *root, uint32_t *files_count)
+{
+	struct node **nodes = calloc(cache->header->nodes_nb, sizeof(*nodes));
+	if (!nodes)
+	{
+		fprintf(stderr, "node cache nodes allocation failed\n");
+		return false;
+	}
+	nodes[0] = root;
+	for (uint32_t i = 0; i < cache->header->nodes_nb; ++i)
+	{
+		const struct node_cache_node *cache_node = &cache->nodes[i];
+		struct node *node = nodes[i];
+		/* node_cache_open checked that the parents come first */
+		if (!node)
+		{
+			free(nodes);
+			return false;
+		}
+		for (uint32_t j = 0; j < cache_node->childs_nb; ++j)
+		{
+			uint32_t idx = cache_node->childs + j;
+			const struct node_cache_node *child = &cache->nodes[idx];
+			const char *name = &cache->strings[child->name];
+			if (child->flags & NODE_CACHE_DIR)
+				nodes[idx] = mpq_dir_node_new(name, node);
+			else
+				nodes[idx] = mpq_file_node_new(name, node);
+			if (!nodes[idx] || !node_add_child(node, nodes[idx]))
+			{
+				free(nodes);
+				return false;
+			}
+			nodes[idx]->block.archive = child->archive;
+			nodes[idx]->block.offset = child->offset;
+			nodes[idx]->block.block_size = child->block_size;
+			nodes[idx]->block.file_size = child->file_size;
+			nodes[idx]->block.flags = child->block_flags;
+		}
+	}
+	free(nodes);
+	node_flatten(root);
+	*files_count = cache->header->files_count;
+	return true;
+}
+
+static size_t get_path_len(const struct node_cache *cache, uint32_t idx)
+{
+	size_t len = 0;
+	while (idx)
+	{
+		const struct node_cache_node *node = &cache->nodes[idx];
+		len += strlen(&cache->strings[node->name]) + 1;
+		idx = node->parent;
+	}
+	return len;
+}
+
+static void get_path(const struct node_cache *cache, uint32_t idx, char *path, size_t len)
+{
+	char *end = &path[len - 1];
+	*end = '\0';
+	while (idx)
+	{
+		const struct node_cache_node *node = &cache->nodes[idx];
+		const char *name = &cache->strings[node->name];
+		size_t name_len = strlen(name);
+		if (*end)
+			*(--end) = '\\';
+		end -= name_len;
+		memcpy(end, name, name_len);
+		idx = node->parent;
+	}
+}
+
+bool node_cache_get_paths(const struct node_cache *cache, const struct node_cache_key *key, char **strings, struct jks_array *paths)
+{
+	const struct node_cache_archive *archive = get_archive(cache, key);
+	if (!archive)
+		return false;
+	size_t size = 0;
+	for (uint32_t i = 0; i < archive->refs_nb; ++i)
+		size += get_path_len(cache, cache->refs[archive->refs + i]);
+	*strings = malloc(size ? size : 1);
+	if (!*strings)
+	{
+		fprintf(stderr, "node cache paths allocation failed\n");
+		return false;
+	}
+	char *path = *strings;
+	for (uint32_t i = 0; i < archive->refs_nb; ++i)
+	{
+		uint32_t idx = cache->refs[archive->refs + i];
+		size_t len = get_path_len(cache, idx);
+		get_path(cache, idx, path, len);
+		if (!jks_array_push_back(paths, &path))
+		{
+			fprintf(stderr, "failed to add cached path\n");
+			return false;
+		}
+		path += len;
+	}
+	return true;
+}
+
+static size_t count_nodes(const struct node *node)
+{
+	size_t count = 1;
+	for (size_t i = 0; i < node->childs_nb; ++i)
+		count += count_nodes(node->childs[i]);
+	return count;
+}
+
+static uint32_t ptr_hash(const void *ptr)
+{
+	uint64_t v = (uintptr_t)ptr;
+	v ^= v >> 33;
+	v *= 0xFF51AFD7ED558CCDull;
+	v ^= v >> 33;
+	return v;
+}
+
+static bool get_node_idx(const struct node **order, const uint32_t *slots, uint32_t mask, const struct node *node, uint32_t *idx)
+{
+	uint32_t i = ptr_hash(node) & mask;
+	while (slots[i] != UINT32_MAX)
+	{
+		if (order[slots[i]] == node)
+		{
+			*idx = slots[i];
+			return true;
+		}
+		i = (i + 1) & mask;
+	}
+	return false;
+}
+
+static bool add_string(struct jks_array *strings, const char *str, uint32_t *offset)
+{
+	size_t len = strlen(str) + 1;
+	*offset = strings->size;
+	if (!jks_array_resize(strings, strings->size + len))
+	{
+		fprintf(stderr, "failed to grow node cache strings\n");
+		return false;
+	}
+	memcpy(jks_array_get(strings, *offset), str, len);
+	return true;
+}
+
+bool node_cache_write(const char *path, const struct node *root, const struct node_cache_key *keys, const struct jks_array *files, uint32_t archives_nb)
+{
+	bool ret = false;
+	size_t nodes_nb = count_nodes(root);
+	uint32_t mask = 1;
+	while (mask < nodes_nb * 2)
+		mask <<= 1;
+	mask--;
+	const struct node **order = malloc(sizeof(*order) * nodes_nb);
+	struct node_cache_node *nodes = malloc(sizeof(*nodes) * nodes_nb);
+	struct node_cache_archive *archives = malloc(sizeof(*archives) * (archives_nb ? archives_nb : 1));
+	uint32_t *slots = malloc(sizeof(*slots) * (mask + 1));
+	struct jks_array strings; /* char */
+	struct jks_array refs; /* uint32_t */
+	jks_array_init(&strings, sizeof(char), NULL, NULL);
+	jks_array_init(&refs, sizeof(uint32_t), NULL, NULL);
+	char tmp_path[1024];
+	FILE *fp = NULL;
+	if (!order || !nodes || !archives || !slots)
+	{
+		fprintf(stderr, "node cache allocation failed\n");
+		goto end;
+	}
+	/* breadth first so that the childs of every node are contiguous */
+	size_t tail = 1;
+	order[0] = root;
+	/* the other parents are set when their parent is visited */
+	nodes[0].parent = 0;
+	for (size_t i = 0; i < nodes_nb; ++i)
+	{
+		const struct node *node = order[i];
+		if (!add_string(&strings, node->name, &nodes[i].name))
+			goto end;
+		nodes[i].childs = tail;
+		nodes[i].childs_nb = node->childs_nb;
+		nodes[i].flags = node_is_dir(node) ? NODE_CACHE_DIR : 0;
+		nodes[i].archive = node->block.archive;
+		nodes[i].offset = node->block.offset;
+		nodes[i].block_size = node->block.block_size;
+		nodes[i].file_size = node->block.file_size;
+		nodes[i].block_flags = node->block.flags;
+		for (size_t j = 0; j < node->childs_nb; ++j)
+		{
+			nodes[tail].parent = i;
+			order[tail++] = node->childs[j];
+		}
+	}
+	memset(slots, 0xFF, sizeof(*slots) * (mask + 1));
+	for (size_t i = 0; i < nodes_nb; ++i)
+	{
+		uint32_t j = ptr_hash(order[i]) & mask;
+		while (slots[j] != UINT32_MAX)
+			j = (j + 1) & mask;
+		slots[j] = i;
+	}
+	uint32_t files_count = 0;
+	for (size_t i = 0; i < nodes_nb; ++i)
+	{
+		if (!(nodes[i].flags & NODE_CACHE_DIR))
+			files_count++;
+	}
+	for (uint32_t i = 0; i < archives_nb; ++i)
+	{
+		if (!add_string(&strings, keys[i].path, &archives[i].path))
+			goto end;
+		archives[i].refs = refs.size;
+		archives[i].hash_crc = keys[i].hash_crc;
+		archives[i].size = keys[i].size;
+		archives[i].mtime = keys[i].mtime;
+		for (size_t j = 0; j < files[i].size; ++j)
+		{
+			const struct node *node = *JKS_ARRAY_GET(&files[i], j, const struct node*);
+			uint32_t idx;
+			if (!get_node_idx(order, slots, mask, node, &idx))
+				continue;
+			if (!jks_array_push_back(&refs, &idx))
+			{
+				fprintf(stderr, "failed to add node cache ref\n");
+				goto end;
+			}
+		}
+		archives[i].refs_nb = refs.size - archives[i].refs;
+	}
+	struct node_cache_header header;
+	memcpy(header.magic, NODE_CACHE_MAGIC, 4);
+	header.version = NODE_CACHE_VERSION;
+	header.archives_nb = archives_nb;
+	header.nodes_nb = nodes_nb;
+	header.refs_nb = refs.size;
+	header.strings_size = strings.size;
+	header.files_count = files_count;
+	header.padding = 0;
+	snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", path);
+	fp = fopen(tmp_path, "wb");
+	if (!fp)
+	{
+		fprintf(stderr, "failed to open '%s': %s\n", tmp_path, strerror(errno));
+		goto end;
+	}
+	if (fwrite(&header, sizeof(header), 1, fp) != 1
+	 || (archives_nb && fwrite(archives, sizeof(*archives), archives_nb, fp) != archives_nb)
+	 || fwrite(nodes, sizeof(*nodes), nodes_nb, fp) != nodes_nb
+	 || (refs.size && fwrite(jks_array_get(&refs, 0), sizeof(uint32_t), refs.size, fp) != refs.size)
+	 || fwrite(jks_array_get(&strings, 0), 1, strings.size, fp) != strings.size)
+	{
+		fprintf(stderr, "failed to write node cache\n");
+		goto end;
+	}
+	if (fclose(fp))
+	{
+		fp = NULL;
+		fprintf(stderr, "failed to write node cache\n");
+		goto end;
+	}
+	fp = NULL;
+	if (rename(tmp_path, path))
+	{
+		fprintf(stderr, "failed to rename '%s': %s\n", tmp_path, strerror(errno));
+		goto end;
+	}
+	ret = true;
+
+end:
+	if (fp)
+	{
+		fclose(fp);
+		unlink(tmp_path);
+	}
+	jks_array_destroy(&strings);
+	jks_array_destroy(&refs);
+	free(slots);
+	free(archives);
+	free(nodes);
+	free(order);
+	return ret;
+}
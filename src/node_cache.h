@@ -0,0 +1,28 @@
+#ifndef EXPLORER_NODE_CACHE_H
+#define EXPLORER_NODE_CACHE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+struct jks_array;
+struct node_cache;
+struct node;
+
+/* identifies the state of an archive: any change invalidates its share of the cache */
+struct node_cache_key
+{
+	const char *path;
+	uint64_t size;
+	int64_t mtime;
+	uint32_t hash_crc;
+};
+
+bool node_cache_key_init(struct node_cache_key *key, const char *path);
+struct node_cache *node_cache_open(const char *path);
+void node_cache_close(struct node_cache *cache);
+bool node_cache_valid(const struct node_cache *cache, const struct node_cache_key *keys, uint32_t keys_nb);
+bool node_cache_load(const struct node_cache *cache, struct node *root, uint32_t *files_count);
+bool node_cache_get_paths(const struct node_cache *cache, const struct node_cache_key *key, char **strings, struct jks_array *paths);
+bool node_cache_write(const char *path, const struct node *root, const struct node_cache_key *keys, const struct jks_array *files, uint32_t archives_nb);
+
+#endif
@@ -0,0 +1,195 @@
+#include "node_model.h"
+#include "nodes.h"
+
+struct _NodeModel
+{
+	GObject parent;
+	struct node *root;
+	gint stamp;
+};
+
+static void node_model_tree_model_init(GtkTreeModelIface *iface);
+
+G_DEFINE_TYPE_WITH_CODE(NodeModel, node_model, G_TYPE_OBJECT,
+                        G_IMPLEMENT_INTERFACE(GTK_TYPE_TREE_MODEL, node_model_tree_model_init))
+
+static void set_iter(NodeModel *model, GtkTreeIter *iter, struct node *node)
+{
+	iter->stamp = model->stamp;
+	iter->user_data = node;
+	iter->user_data2 = GUINT_TO_POINTER(node->index);
+	iter->user_data3 = NULL;
+}
+
+static struct node *get_node(NodeModel *model, GtkTreeIter *iter)
+{
+	if (!iter)
+		return model->root;
+	g_return_val_if_fail(iter->stamp == model->stamp, NULL);
+	return iter->user_data;
+}
+
+static GtkTreeModelFlags get_flags(GtkTreeModel *tree_model)
+{
+	(void)tree_model;
+	return GTK_TREE_MODEL_ITERS_PERSIST;
+}
+
+static gint get_n_columns(GtkTreeModel *tree_model)
+{
+	(void)tree_model;
+	return 2;
+}
+
+static GType get_column_type(GtkTreeModel *tree_model, gint index)
+{
+	(void)tree_model;
+	switch (index)
+	{
+		case 0:
+			return G_TYPE_STRING;
+		case 1:
+			return G_TYPE_POINTER;
+	}
+	return G_TYPE_INVALID;
+}
+
+static gboolean get_iter(GtkTreeModel *tree_model, GtkTreeIter *iter, GtkTreePath *path)
+{
+	NodeModel *model = NODE_MODEL(tree_model);
+	gint depth;
+	gint *indices = gtk_tree_path_get_indices_with_depth(path, &depth);
+	struct node *node = model->root;
+	for (gint i = 0; i < depth; ++i)
+	{
+		if (indices[i] < 0 || (size_t)indices[i] >= node->childs_nb)
+			return FALSE;
+		node = node->childs[indices[i]];
+	}
+	if (node == model->root)
+		return FALSE;
+	set_iter(model, iter, node);
+	return TRUE;
+}
+
+static GtkTreePath *get_path(GtkTreeModel *tree_model, GtkTreeIter *iter)
+{
+	NodeModel *model = NODE_MODEL(tree_model);
+	GtkTreePath *path = gtk_tree_path_new();
+	for (struct node *node = get_node(model, iter); node && node != model->root; node = node->parent)
+		gtk_tree_path_prepend_index(path, node->index);
+	return path;
+}
+
+static void get_value(GtkTreeModel *tree_model, GtkTreeIter *iter, gint column, GValue *value)
+{
+	struct node *node = get_node(NODE_MODEL(tree_model), iter);
+	switch (column)
+	{
+		case 0:
+			g_value_init(value, G_TYPE_STRING);
+			g_value_set_static_string(value, node->name);
+			break;
+		case 1:
+			g_value_init(value, G_TYPE_POINTER);
+			g_value_set_pointer(value, node);
+			break;
+	}
+}
+
+static gboolean iter_nth_child(GtkTreeModel *tree_model, GtkTreeIter *iter, GtkTreeIter *parent, gint n)
+{
+	NodeModel *model = NODE_MODEL(tree_model);
+	struct node *node = get_node(model, parent);
+	if (n < 0 || (size_t)n >= node->childs_nb)
+		return FALSE;
+	set_iter(model, iter, node->childs[n]);
+	return TRUE;
+}
+
+static gboolean iter_next(GtkTreeModel *tree_model, GtkTreeIter *iter)
+{
+	NodeModel *model = NODE_MODEL(tree_model);
+	struct node *node = get_node(model, iter);
+	struct node *parent = node->parent;
+	if (node->index + 1 >= parent->childs_nb)
+	{
+		iter->stamp = 0;
+		return FALSE;
+	}
+	set_iter(model, iter, parent->childs[node->index + 1]);
+	return TRUE;
+}
+
+static gboolean iter_previous(GtkTreeModel *tree_model, GtkTreeIter *iter)
+{
+	NodeModel *model = NODE_MODEL(tree_model);
+	struct node *node = get_node(model, iter);
+	if (!node->index)
+	{
+		iter->stamp = 0;
+		return FALSE;
+	}
+	set_iter(model, iter, node->parent->childs[node->index - 1]);
+	return TRUE;
+}
+
+static gboolean iter_children(GtkTreeModel *tree_model, GtkTreeIter *iter, GtkTreeIter *parent)
+{
+	return iter_nth_child(tree_model, iter, parent, 0);
+}
+
+static gboolean iter_has_child(GtkTreeModel *tree_model, GtkTreeIter *iter)
+{
+	return get_node(NODE_MODEL(tree_model), iter)->childs_nb != 0;
+}
+
+static gint iter_n_children(GtkTreeModel *tree_model, GtkTreeIter *iter)
+{
+	return get_node(NODE_MODEL(tree_model), iter)->childs_nb;
+}
+
+static gboolean iter_parent(GtkTreeModel *tree_model, GtkTreeIter *iter, GtkTreeIter *child)
+{
+	NodeModel *model = NODE_MODEL(tree_model);
+	struct node *node = get_node(model, child);
+	if (!node->parent || node->parent == model->root)
+		return FALSE;
+	set_iter(model, iter, node->parent);
+	return TRUE;
+}
+
+static void node_model_tree_model_init(GtkTreeModelIface *iface)
+{
+	iface->get_flags = get_flags;
+	iface->get_n_columns = get_n_columns;
+	iface->get_column_type = get_column_type;
+	iface->get_iter = get_iter;
+	iface->get_path = get_path;
+	iface->get_value = get_value;
+	iface->iter_next = iter_next;
+	iface->iter_previous = iter_previous;
+	iface->iter_children = iter_children;
+	iface->iter_has_child = iter_has_child;
+	iface->iter_n_children = iter_n_children;
+	iface->iter_nth_child = iter_nth_child;
+	iface->iter_parent = iter_parent;
+}
+
+static void node_model_class_init(NodeModelClass *klass)
+{
+	(void)klass;
+}
+
+static void node_model_init(NodeModel *model)
+{
+	model->root = NULL;
+	model->stamp = g_random_int();
+}
+
+NodeModel *node_model_new(struct node *root)
+{
+	NodeModel *model = g_object_new(NODE_TYPE_MODEL, NULL);
+	model->root = root;
+	return model;
+}
@@ -0,0 +1,18 @@
+#ifndef EXPLORER_NODE_MODEL_H
+#define EXPLORER_NODE_MODEL_H
+
+#include <gtk/gtk.h>
+
+struct node;
+
+/* GtkTreeModel serving the rows straight from the struct node tree
+ * column 0 is the node name, column 1 the struct node pointer
+ * iters are the node pointer (user_data) and its index in its parent (user_data2)
+ */
+
+#define NODE_TYPE_MODEL node_model_get_type()
+G_DECLARE_FINAL_TYPE(NodeModel, node_model, NODE, MODEL, GObject)
+
+NodeModel *node_model_new(struct node *root);
+
+#endif
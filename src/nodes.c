@@ -1,64 +1,169 @@
 #include "displays/display.h"
 
+#include "utils/parallel.h"
+#include "utils/arena.h"
+
 #include "explorer.h"
+#include "loader.h"
 #include "nodes.h"
 
 #include <libwow/mpq.h>
 
 #include <ctype.h>
 
-static void node_del(void *ptr)
+static struct arena g_arena;
+
+/* interned names, many directories share the same name across the tree */
+static struct
+{
+	const char **slots;
+	uint32_t count;
+	uint32_t mask;
+} g_names;
+
+static uint32_t name_hash(const char *name)
 {
-	node_delete(*(struct node**)ptr);
+	uint32_t hash = 2166136261u;
+	for (size_t i = 0; name[i]; ++i)
+	{
+		hash ^= (uint8_t)name[i];
+		hash *= 16777619u;
+	}
+	return hash;
+}
+
+static bool names_grow(void)
+{
+	uint32_t mask = g_names.slots ? g_names.mask * 2 + 1 : 4095;
+	const char **slots = calloc(mask + 1, sizeof(*slots));
+	if (!slots)
+	{
+		fprintf(stderr, "node names allocation failed\n");
+		return false;
+	}
+	for (uint32_t i = 0; g_names.slots && i <= g_names.mask; ++i)
+	{
+		if (!g_names.slots[i])
+			continue;
+		uint32_t j = name_hash(g_names.slots[i]) & mask;
+		while (slots[j])
+			j = (j + 1) & mask;
+		slots[j] = g_names.slots[i];
+	}
+	free(g_names.slots);
+	g_names.slots = slots;
+	g_names.mask = mask;
+	return true;
+}
+
+static const char *intern_name(const char *name)
+{
+	if ((!g_names.slots || (g_names.count + 1) * 2 > g_names.mask + 1) && !names_grow())
+		return NULL;
+	uint32_t i = name_hash(name) & g_names.mask;
+	while (g_names.slots[i])
+	{
+		if (!strcmp(g_names.slots[i], name))
+			return g_names.slots[i];
+		i = (i + 1) & g_names.mask;
+	}
+	const char *ret = arena_strdup(&g_arena, name);
+	if (!ret)
+		return NULL;
+	g_names.slots[i] = ret;
+	g_names.count++;
+	return ret;
 }
 
 static struct node *node_new(const char *name, struct node *parent, node_on_click_t on_click)
 {
-	struct node *node = malloc(sizeof(*node));
+	if (!g_arena.block_size)
+		arena_init(&g_arena, 1024 * 1024);
+	struct node *node = arena_alloc(&g_arena, sizeof(*node));
 	if (!node)
 		return NULL;
-	node->name = strdup(name);
+	node->name = intern_name(name);
 	if (!node->name)
-		goto err;
+		return NULL;
 	node->parent = parent;
 	node->on_click = on_click;
-	jks_array_init(&node->childs, sizeof(struct node*), node_del, NULL);
+	node->childs = NULL;
+	node->childs_nb = 0;
+	node->index = 0;
+	node->pending = NULL;
+	node->next = NULL;
+	memset(&node->block, 0, sizeof(node->block));
+	node->block.archive = NODE_NO_ARCHIVE;
+	node->stats = NULL;
 	return node;
-
-err:
-	free(node);
-	return NULL;
 }
 
 void node_delete(struct node *node)
 {
 	if (!node)
 		return;
-	jks_array_destroy(&node->childs);
-	free(node);
+	/* only the whole tree can be released */
+	if (node->parent)
+		return;
+	free(g_names.slots);
+	g_names.slots = NULL;
+	g_names.count = 0;
+	arena_destroy(&g_arena);
 }
 
 bool node_add_child(struct node *node, struct node *child)
 {
-	for (size_t i = 0; i < node->childs.size; ++i)
-	{
-		if (strcmp(child->name, (*JKS_ARRAY_GET(&node->childs, i, struct node*))->name) >= 0)
-			continue;
-		if (!jks_array_push(&node->childs, &child, i))
-		{
-			fprintf(stderr, "failed to add node child\n");
-			return false;
-		}
+	child->index = node->childs_nb++;
+	child->next = node->pending;
+	node->pending = child;
+	return true;
+}
+
+static bool flatten_childs(struct node *node)
+{
+	if (!node->pending)
 		return true;
-	}
-	if (!jks_array_push_back(&node->childs, &child))
-	{
-		fprintf(stderr, "failed to add node child\n");
+	struct node **childs = arena_alloc(&g_arena, sizeof(*childs) * node->childs_nb);
+	if (!childs)
 		return false;
+	uint32_t prev_nb = 0;
+	for (struct node *child = node->pending; child; child = child->next)
+	{
+		childs[child->index] = child;
+		prev_nb = child->index;
 	}
+	if (prev_nb)
+		memcpy(childs, node->childs, sizeof(*childs) * prev_nb);
+	node->childs = childs;
+	node->pending = NULL;
 	return true;
 }
 
+void node_flatten(struct node *node)
+{
+	if (!flatten_childs(node))
+		return;
+	for (uint32_t i = 0; i < node->childs_nb; ++i)
+		node_flatten(node->childs[i]);
+}
+
+static int node_cmp(const void *a, const void *b)
+{
+	return strcmp((*(struct node**)a)->name, (*(struct node**)b)->name);
+}
+
+void node_sort(struct node *node)
+{
+	if (!flatten_childs(node) || !node->childs_nb)
+		return;
+	qsort(node->childs, node->childs_nb, sizeof(*node->childs), node_cmp);
+	for (uint32_t i = 0; i < node->childs_nb; ++i)
+	{
+		node->childs[i]->index = i;
+		node_sort(node->childs[i]);
+	}
+}
+
 void node_get_path(struct node *node, char *str, size_t len)
 {
 	if (!node->parent)
@@ -76,11 +181,221 @@ void node_get_path(struct node *node, char *str, size_t len)
 	snprintf(str + pos, len - pos, "%s", node->name);
 }
 
+#define RESOLVE_CHUNK 1024
+
+struct resolve_blocks
+{
+	struct wow_mpq_compound *compound;
+	struct node **files;
+	size_t files_nb;
+};
+
+static size_t count_files(const struct node *node)
+{
+	if (!node_is_dir(node))
+		return 1;
+	size_t count = 0;
+	for (uint32_t i = 0; i < node->childs_nb; ++i)
+		count += count_files(node->childs[i]);
+	return count;
+}
+
+static void gather_files(struct node *node, struct node **files, size_t *files_nb)
+{
+	if (!node_is_dir(node))
+	{
+		files[(*files_nb)++] = node;
+		return;
+	}
+	for (uint32_t i = 0; i < node->childs_nb; ++i)
+		gather_files(node->childs[i], files, files_nb);
+}
+
+static void resolve_block(struct wow_mpq_compound *compound, struct node *node)
+{
+	char path[512];
+	node_get_path(node, path, sizeof(path));
+	normalize_mpq_filename(path, sizeof(path));
+	/* the first archive holding the file wins, just as in the compound */
+	for (uint32_t i = 0; i < compound->archives_nb; ++i)
+	{
+		const struct wow_mpq_block *block = wow_mpq_get_archive_block(&compound->archives[i], path);
+		if (!block)
+			continue;
+		node->block.offset = block->offset;
+		node->block.block_size = block->block_size;
+		node->block.file_size = block->file_size;
+		node->block.flags = block->flags;
+		node->block.archive = i;
+		return;
+	}
+}
+
+static void resolve_chunk(void *userdata, size_t i)
+{
+	struct resolve_blocks *resolve = userdata;
+	size_t end = (i + 1) * RESOLVE_CHUNK;
+	if (end > resolve->files_nb)
+		end = resolve->files_nb;
+	for (size_t j = i * RESOLVE_CHUNK; j < end; ++j)
+		resolve_block(resolve->compound, resolve->files[j]);
+}
+
+/* the block lookups only read the in memory hash and block tables of the
+ * archives, so they are spread over the worker pool
+ */
+void node_resolve_blocks(struct node *root, struct wow_mpq_compound *compound)
+{
+	struct resolve_blocks resolve;
+	resolve.compound = compound;
+	resolve.files_nb = count_files(root);
+	resolve.files = malloc(sizeof(*resolve.files) * (resolve.files_nb ? resolve.files_nb : 1));
+	if (!resolve.files)
+	{
+		fprintf(stderr, "node blocks allocation failed\n");
+		return;
+	}
+	resolve.files_nb = 0;
+	gather_files(root, resolve.files, &resolve.files_nb);
+	parallel_for((resolve.files_nb + RESOLVE_CHUNK - 1) / RESOLVE_CHUNK, resolve_chunk, &resolve);
+	free(resolve.files);
+}
+
+static const char *file_extension(const char *name)
+{
+	const char *dot = strrchr(name, '.');
+	char extension[32];
+	size_t len = 0;
+	if (dot)
+	{
+		for (++dot; *dot && len < sizeof(extension) - 1; ++dot)
+			extension[len++] = tolower((unsigned char)*dot);
+	}
+	extension[len] = '\0';
+	return intern_name(extension);
+}
+
+static int compare_groups(const void *a, const void *b)
+{
+	uintptr_t ka = ((const struct node_stats_group*)a)->key;
+	uintptr_t kb = ((const struct node_stats_group*)b)->key;
+	return (ka > kb) - (ka < kb);
+}
+
+/* sort and collapse the groups gathered from the childs into the arena */
+static struct node_stats_group *merge_groups(struct node_stats_group *groups, uint32_t *groups_nb)
+{
+	if (!*groups_nb)
+		return NULL;
+	qsort(groups, *groups_nb, sizeof(*groups), compare_groups);
+	uint32_t count = 0;
+	for (uint32_t i = 0; i < *groups_nb; ++i)
+	{
+		if (count && groups[count - 1].key == groups[i].key)
+		{
+			groups[count - 1].files_nb += groups[i].files_nb;
+			groups[count - 1].file_size += groups[i].file_size;
+			groups[count - 1].block_size += groups[i].block_size;
+			continue;
+		}
+		groups[count++] = groups[i];
+	}
+	struct node_stats_group *ret = arena_alloc(&g_arena, sizeof(*ret) * count);
+	if (!ret)
+	{
+		*groups_nb = 0;
+		return NULL;
+	}
+	memcpy(ret, groups, sizeof(*ret) * count);
+	*groups_nb = count;
+	return ret;
+}
+
+static bool compute_stats(struct node *node)
+{
+	struct node_stats *stats = arena_alloc(&g_arena, sizeof(*stats));
+	if (!stats)
+		return false;
+	memset(stats, 0, sizeof(*stats));
+	/* the childs directories are done first, their groups are then merged */
+	for (uint32_t i = 0; i < node->childs_nb; ++i)
+	{
+		struct node *child = node->childs[i];
+		if (node_is_dir(child))
+		{
+			if (!compute_stats(child))
+				return false;
+			stats->files_nb += child->stats->files_nb;
+			stats->file_size += child->stats->file_size;
+			stats->block_size += child->stats->block_size;
+			stats->extensions_nb += child->stats->extensions_nb;
+			stats->archives_nb += child->stats->archives_nb;
+		}
+		else
+		{
+			stats->files_nb++;
+			stats->file_size += child->block.file_size;
+			stats->block_size += child->block.block_size;
+			stats->extensions_nb++;
+			stats->archives_nb++;
+		}
+	}
+	struct node_stats_group *extensions = malloc(sizeof(*extensions) * (stats->extensions_nb ? stats->extensions_nb : 1));
+	struct node_stats_group *archives = malloc(sizeof(*archives) * (stats->archives_nb ? stats->archives_nb : 1));
+	if (!extensions || !archives)
+	{
+		free(extensions);
+		free(archives);
+		return false;
+	}
+	uint32_t extensions_nb = 0;
+	uint32_t archives_nb = 0;
+	for (uint32_t i = 0; i < node->childs_nb; ++i)
+	{
+		struct node *child = node->childs[i];
+		if (node_is_dir(child))
+		{
+			/* empty subtrees have no groups */
+			if (!child->stats->files_nb)
+				continue;
+			memcpy(&extensions[extensions_nb], child->stats->extensions, sizeof(*extensions) * child->stats->extensions_nb);
+			extensions_nb += child->stats->extensions_nb;
+			memcpy(&archives[archives_nb], child->stats->archives, sizeof(*archives) * child->stats->archives_nb);
+			archives_nb += child->stats->archives_nb;
+			continue;
+		}
+		struct node_stats_group group;
+		group.files_nb = 1;
+		group.file_size = child->block.file_size;
+		group.block_size = child->block.block_size;
+		group.key = (uintptr_t)file_extension(child->name);
+		extensions[extensions_nb++] = group;
+		group.key = child->block.archive;
+		archives[archives_nb++] = group;
+	}
+	stats->extensions = merge_groups(extensions, &stats->extensions_nb);
+	stats->archives = merge_groups(archives, &stats->archives_nb);
+	free(extensions);
+	free(archives);
+	node->stats = stats;
+	return true;
+}
+
+/* a single post order pass: every directory sums the memoized totals of its
+ * childs directories instead of walking their subtrees again
+ */
+void node_compute_stats(struct node *root)
+{
+	if (!compute_stats(root))
+		fprintf(stderr, "node stats allocation failed\n");
+}
+
 static void mpq_dir_on_click(struct node *node)
 {
 	char path[512];
 	node_get_path(node, path, sizeof(path));
-	explorer_set_display(g_explorer, dir_display_new(node, path, NULL));
+	loader_cancel();
+	explorer_set_display(g_explorer, dir_display_new(node, path, NULL, NULL));
 }
 
 struct node *mpq_dir_node_new(const char *name, struct node *parent)
@@ -88,78 +403,99 @@ struct node *mpq_dir_node_new(const char *name, struct node *parent)
 	return node_new(name, parent, mpq_dir_on_click);
 }
 
-static bool is_ext(const char *path, const char *ext)
+bool node_is_dir(const struct node *node)
 {
-	size_t len = strlen(path);
-	size_t ext_len = strlen(ext);
-	if (len < ext_len)
-		return false;
-	return !strcmp(&path[len - ext_len], ext);
-}
-
-typedef struct display *(*display_ctr_t)(const struct node *node, const char *path, struct wow_mpq_file *file);
-
-static const struct
-{
-	const char *ext;
-	display_ctr_t ctr;
-} display_constructors[] =
-{
-	{".blp" , blp_display_new},
-	{".dbc" , dbc_display_new},
-	{".bls" , bls_display_new},
-	{".wdl" , wdl_display_new},
-	{".wdt" , wdt_display_new},
-	{".adt" , adt_display_new},
-	{".m2"  , m2_display_new},
-	{".mdl" , m2_display_new},
-	{".mdx" , m2_display_new},
-	{".gif" , img_display_new},
-	{".png" , img_display_new},
-	{".jpg" , img_display_new},
-	{".jpeg", img_display_new},
-	{".tiff", img_display_new},
-	{".js"  , txt_display_new},
-	{".xml" , txt_display_new},
-	{".lua" , txt_display_new},
-	{".wtf" , txt_display_new},
-	{".wfx" , txt_display_new},
-	{".ini" , txt_display_new},
-	{".txt" , txt_display_new},
-	{".toc" , txt_display_new},
-	{".url" , txt_display_new},
-	{".css" , txt_display_new},
-	{".html", txt_display_new},
-	{".zmp" , txt_display_new},
-	{".wmo" , wmo_display_new},
-};
+	return node->on_click == mpq_dir_on_click;
+}
 
 static void mpq_file_on_click(struct node *node)
 {
-	char path[512];
-	node_get_path(node, path, sizeof(path));
-	struct wow_mpq_file *file = wow_mpq_get_file(g_explorer->mpq_compound, path);
-	if (!file)
-		return;
-	display_ctr_t ctr = NULL;
-	for (size_t i = 0; i < sizeof(display_constructors) / sizeof(*display_constructors); ++i)
-	{
-		if (!is_ext(path, display_constructors[i].ext))
-			continue;
-		ctr = display_constructors[i].ctr;
-		break;
-	}
-	if (!ctr)
-		ctr = txt_display_new;
-	struct display *display = display = ctr(node, path, file);
-	if (display)
-		explorer_set_display(g_explorer, display);
-	else
-		fprintf(stderr, "can't find handler for file \"%s\"\n", path);
-	wow_mpq_file_delete(file);
+	loader_load(node);
 }
 
 struct node *mpq_file_node_new(const char *name, struct node *parent)
 {
 	return node_new(name, parent, mpq_file_on_click);
 }
+
+static uint32_t node_hash(const struct node *parent, const char *name)
+{
+	uint32_t hash = 2166136261u;
+	uintptr_t ptr = (uintptr_t)parent;
+	for (size_t i = 0; i < sizeof(ptr); ++i)
+	{
+		hash ^= (ptr >> (i * 8)) & 0xFF;
+		hash *= 16777619u;
+	}
+	for (size_t i = 0; name[i]; ++i)
+	{
+		hash ^= (uint8_t)name[i];
+		hash *= 16777619u;
+	}
+	return hash;
+}
+
+bool node_index_init(struct node_index *index)
+{
+	index->count = 0;
+	index->mask = 4095;
+	index->slots = calloc(index->mask + 1, sizeof(*index->slots));
+	if (!index->slots)
+	{
+		fprintf(stderr, "node index allocation failed\n");
+		return false;
+	}
+	return true;
+}
+
+void node_index_destroy(struct node_index *index)
+{
+	free(index->slots);
+	index->slots = NULL;
+}
+
+struct node *node_index_get(const struct node_index *index, const struct node *parent, const char *name)
+{
+	uint32_t i = node_hash(parent, name) & index->mask;
+	struct node *node;
+	while ((node = index->slots[i]))
+	{
+		if (node->parent == parent && !strcmp(node->name, name))
+			return node;
+		i = (i + 1) & index->mask;
+	}
+	return NULL;
+}
+
+static void node_index_insert(struct node **slots, uint32_t mask, struct node *node)
+{
+	uint32_t i = node_hash(node->parent, node->name) & mask;
+	while (slots[i])
+		i = (i + 1) & mask;
+	slots[i] = node;
+}
+
+bool node_index_add(struct node_index *index, struct node *node)
+{
+	if ((index->count + 1) * 2 > index->mask + 1)
+	{
+		uint32_t mask = index->mask * 2 + 1;
+		struct node **slots = calloc(mask + 1, sizeof(*slots));
+		if (!slots)
+		{
+			fprintf(stderr, "node index allocation failed\n");
+			return false;
+		}
+		for (uint32_t i = 0; i <= index->mask; ++i)
+		{
+			if (index->slots[i])
+				node_index_insert(slots, mask, index->slots[i]);
+		}
+		free(index->slots);
+		index->slots = slots;
+		index->mask = mask;
+	}
+	node_index_insert(index->slots, index->mask, node);
+	index->count++;
+	return true;
+}
@@ -1,24 +1,92 @@
 #ifndef EXPLORER_NODES_H
 #define EXPLORER_NODES_H
 
-#include <jks/array.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
 
+struct wow_mpq_compound;
 struct node;
 
 typedef void (*node_on_click_t)(struct node *node);
 
+#define NODE_NO_ARCHIVE UINT16_MAX
+
+/* mpq block of a file node, resolved once after the listfiles ingestion and
+ * kept in the node cache
+ */
+struct node_block
+{
+	uint32_t offset;
+	uint32_t block_size;
+	uint32_t file_size;
+	uint32_t flags;
+	uint16_t archive; /* index in the compound, NODE_NO_ARCHIVE if not found */
+};
+
+/* totals of the files sharing an extension or an archive */
+struct node_stats_group
+{
+	uintptr_t key; /* interned lowercase extension, or archive index */
+	uint32_t files_nb;
+	uint64_t file_size;
+	uint64_t block_size;
+};
+
+/* recursive totals of a directory, computed once bottom-up by node_compute_stats
+ * files not found in any archive are counted in the NODE_NO_ARCHIVE group
+ */
+struct node_stats
+{
+	uint32_t files_nb;
+	uint64_t file_size;
+	uint64_t block_size;
+	struct node_stats_group *extensions; /* sorted by key */
+	uint32_t extensions_nb;
+	struct node_stats_group *archives; /* sorted by key */
+	uint32_t archives_nb;
+};
+
+/* nodes, names and childs arrays are carved from a tree wide arena
+ * childs are first chained in the pending list by node_add_child, and gathered
+ * into the childs array by node_flatten / node_sort
+ */
 struct node
 {
 	node_on_click_t on_click;
-	struct jks_array childs; /* node_t* */
-	char *name;
+	struct node **childs;
+	uint32_t childs_nb;
+	uint32_t index; /* position in the parent childs */
+	const char *name;
 	struct node *parent;
+	struct node *pending;
+	struct node *next;
+	struct node_block block;
+	struct node_stats *stats; /* directories only */
 };
 
 struct node *mpq_dir_node_new(const char *name, struct node *parent);
 struct node *mpq_file_node_new(const char *name, struct node *parent);
 void node_delete(struct node *node);
 bool node_add_child(struct node *node, struct node *child);
+void node_flatten(struct node *node);
+void node_sort(struct node *node);
+bool node_is_dir(const struct node *node);
 void node_get_path(struct node *node, char *str, size_t len);
+void node_resolve_blocks(struct node *root, struct wow_mpq_compound *compound);
+void node_compute_stats(struct node *root);
+
+/* (parent, name) -> node hash table, used while ingesting the listfiles */
+struct node_index
+{
+	struct node **slots;
+	uint32_t count;
+	uint32_t mask;
+};
+
+bool node_index_init(struct node_index *index);
+void node_index_destroy(struct node_index *index);
+struct node *node_index_get(const struct node_index *index, const struct node *parent, const char *name);
+bool node_index_add(struct node_index *index, struct node *node);
 
 #endif
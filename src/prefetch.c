@@ -0,0 +1,120 @@
+#include "explorer.h"
+#include "file_cache.h"
+#include "prefetch.h"
+#include "nodes.h"
+
+#include <libwow/mpq.h>
+
+#include <stdlib.h>
+#include <string.h>
+
+#define PREFETCH_SIBLINGS 8
+#define PREFETCH_BUDGET (32 * 1024 * 1024)
+
+struct prefetch_job
+{
+	struct jks_array paths; /* char* */
+	gint generation;
+};
+
+static GThreadPool *g_pool;
+static gint g_generation;
+
+static void path_delete(void *ptr)
+{
+	free(*(char**)ptr);
+}
+
+static void job_delete(struct prefetch_job *job)
+{
+	jks_array_destroy(&job->paths);
+	free(job);
+}
+
+static void prefetch_worker(gpointer data, gpointer userdata)
+{
+	struct prefetch_job *job = data;
+	size_t size = 0;
+	(void)userdata;
+	for (size_t i = 0; i < job->paths.size; ++i)
+	{
+		if (g_atomic_int_get(&g_generation) != job->generation)
+			break;
+		if (size >= PREFETCH_BUDGET)
+			break;
+		struct wow_mpq_file *file = file_cache_get(g_explorer->file_cache, *JKS_ARRAY_GET(&job->paths, i, char*));
+		if (!file)
+			continue;
+		size += file->size;
+		file_cache_release(g_explorer->file_cache, file);
+	}
+	job_delete(job);
+}
+
+static gpointer create_pool(gpointer data)
+{
+	(void)data;
+	g_pool = g_thread_pool_new(prefetch_worker, NULL, 1, FALSE, NULL);
+	return g_pool;
+}
+
+static bool push_path(struct prefetch_job *job, char *path)
+{
+	if (!jks_array_push_back(&job->paths, &path))
+	{
+		fprintf(stderr, "prefetch path allocation failed\n");
+		free(path);
+		return false;
+	}
+	return true;
+}
+
+void prefetch_start(struct node *node, struct jks_array *refs)
+{
+	static GOnce once = G_ONCE_INIT;
+	g_once(&once, create_pool, NULL);
+	gint generation = g_atomic_int_add(&g_generation, 1) + 1;
+	if (!g_pool)
+		return;
+	struct prefetch_job *job = malloc(sizeof(*job));
+	if (!job)
+	{
+		fprintf(stderr, "prefetch job allocation failed\n");
+		return;
+	}
+	job->generation = generation;
+	jks_array_init(&job->paths, sizeof(char*), path_delete, NULL);
+	for (size_t i = 0; refs && i < refs->size; ++i)
+	{
+		char *path = *JKS_ARRAY_GET(refs, i, char*);
+		*JKS_ARRAY_GET(refs, i, char*) = NULL;
+		if (!path)
+			continue;
+		if (!push_path(job, path))
+			break;
+	}
+	struct node *parent = node->parent;
+	for (uint32_t i = node->index + 1, n = 0; parent && i < parent->childs_nb && n < PREFETCH_SIBLINGS; ++i)
+	{
+		struct node *sibling = parent->childs[i];
+		if (node_is_dir(sibling))
+			continue;
+		char path[512];
+		node_get_path(sibling, path, sizeof(path));
+		char *dup = strdup(path);
+		if (!dup || !push_path(job, dup))
+			break;
+		n++;
+	}
+	if (!job->paths.size)
+	{
+		job_delete(job);
+		return;
+	}
+	g_thread_pool_push(g_pool, job, NULL);
+}
+
+void prefetch_cancel(void)
+{
+	g_atomic_int_inc(&g_generation);
+}
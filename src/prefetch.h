@@ -0,0 +1,17 @@
+#ifndef EXPLORER_PREFETCH_H
+#define EXPLORER_PREFETCH_H
+
+#include <jks/array.h>
+
+struct node;
+
+/* warm the file cache in the background with what is likely to be opened
+ * next: the files referenced by the current one (textures, wmo groups)
+ * then the following siblings of the node
+ * refs is an array of char* which is taken over (and left empty)
+ * a new prefetch (or a cancel) stops the running one
+ */
+void prefetch_start(struct node *node, struct jks_array *refs);
+void prefetch_cancel(void);
+
+#endif
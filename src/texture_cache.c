@@ -0,0 +1,100 @@
+#include "texture_cache.h"
+#include "explorer.h"
+
+#include <inttypes.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+
+struct texture_cache_entry
+{
+	GdkPixbuf *pixbuf;
+	size_t size;
+	char key[];
+};
+
+static void entry_delete(struct texture_cache_entry *entry)
+{
+	g_object_unref(entry->pixbuf);
+	free(entry);
+}
+
+static void make_key(char *key, size_t size, const char *path, uint32_t mipmap_id)
+{
+	snprintf(key, size, "%s:%" PRIu32, path, mipmap_id);
+	normalize_mpq_filename(key, size);
+}
+
+struct texture_cache *texture_cache_new(size_t budget)
+{
+	struct texture_cache *cache = malloc(sizeof(*cache));
+	if (!cache)
+	{
+		fprintf(stderr, "texture cache allocation failed\n");
+		return NULL;
+	}
+	cache->entries = g_hash_table_new(g_str_hash, g_str_equal);
+	g_queue_init(&cache->lru);
+	cache->budget = budget;
+	cache->size = 0;
+	return cache;
+}
+
+void texture_cache_delete(struct texture_cache *cache)
+{
+	if (!cache)
+		return;
+	for (GList *link = cache->lru.head; link; link = link->next)
+		entry_delete(link->data);
+	g_queue_clear(&cache->lru);
+	g_hash_table_destroy(cache->entries);
+	free(cache);
+}
+
+GdkPixbuf *texture_cache_get(struct texture_cache *cache, const char *path, uint32_t mipmap_id)
+{
+	char key[512];
+	make_key(key, sizeof(key), path, mipmap_id);
+	GList *link = g_hash_table_lookup(cache->entries, key);
+	if (!link)
+		return NULL;
+	g_queue_unlink(&cache->lru, link);
+	g_queue_push_head_link(&cache->lru, link);
+	return g_object_ref(((struct texture_cache_entry*)link->data)->pixbuf);
+}
+
+static void evict(struct texture_cache *cache)
+{
+	/* the most recent entry is kept even when it is over budget alone */
+	while (cache->size > cache->budget && cache->lru.length > 1)
+	{
+		GList *link = g_queue_pop_tail_link(&cache->lru);
+		struct texture_cache_entry *entry = link->data;
+		g_hash_table_remove(cache->entries, entry->key);
+		cache->size -= entry->size;
+		entry_delete(entry);
+		g_list_free_1(link);
+	}
+}
+
+void texture_cache_put(struct texture_cache *cache, const char *path, uint32_t mipmap_id, GdkPixbuf *pixbuf)
+{
+	char key[512];
+	make_key(key, sizeof(key), path, mipmap_id);
+	if (g_hash_table_contains(cache->entries, key))
+		return;
+	size_t key_len = strlen(key) + 1;
+	struct texture_cache_entry *entry = malloc(sizeof(*entry) + key_len);
+	if (!entry)
+	{
+		fprintf(stderr, "texture cache entry allocation failed\n");
+		return;
+	}
+	memcpy(entry->key, key, key_len);
+	entry->pixbuf = g_object_ref(pixbuf);
+	entry->size = gdk_pixbuf_get_byte_length(pixbuf);
+	g_queue_push_head(&cache->lru, entry);
+	g_hash_table_insert(cache->entries, entry->key, cache->lru.head);
+	cache->size += entry->size;
+	evict(cache);
+}
@@ -0,0 +1,26 @@
+#ifndef EXPLORER_TEXTURE_CACHE_H
+#define EXPLORER_TEXTURE_CACHE_H
+
+#include <gtk/gtk.h>
+
+#include <stdint.h>
+#include <stddef.h>
+
+/* byte budgeted LRU cache of the decoded textures, keyed by mpq path and mipmap
+ * pixbufs handed out are new references, evicted ones stay alive until unref
+ * main thread only
+ */
+struct texture_cache
+{
+	GHashTable *entries; /* key to GList link of the lru */
+	GQueue lru; /* most recently used first */
+	size_t budget;
+	size_t size;
+};
+
+struct texture_cache *texture_cache_new(size_t budget);
+void texture_cache_delete(struct texture_cache *cache);
+GdkPixbuf *texture_cache_get(struct texture_cache *cache, const char *path, uint32_t mipmap_id);
+void texture_cache_put(struct texture_cache *cache, const char *path, uint32_t mipmap_id, GdkPixbuf *pixbuf);
+
+#endif
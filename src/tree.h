@@ -12,7 +12,7 @@ struct tree
 	struct explorer *explorer;
 	GtkTreeViewColumn *column;
 	GtkCellRenderer *renderer;
-	GtkTreeStore *store;
+	GtkTreeModel *model;
 	GtkWidget *treeview;
 };
 
@@ -0,0 +1,75 @@
+#include "utils/arena.h"
+
+#include <stdalign.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+
+#define ARENA_ALIGN alignof(max_align_t)
+
+struct arena_block
+{
+	struct arena_block *next;
+	alignas(max_align_t) char data[];
+};
+
+void arena_init(struct arena *arena, size_t block_size)
+{
+	arena->blocks = NULL;
+	arena->block_size = block_size;
+	arena->pos = 0;
+	arena->size = 0;
+}
+
+void arena_destroy(struct arena *arena)
+{
+	struct arena_block *block = arena->blocks;
+	while (block)
+	{
+		struct arena_block *next = block->next;
+		free(block);
+		block = next;
+	}
+	arena->blocks = NULL;
+	arena->pos = 0;
+	arena->size = 0;
+}
+
+/* the alignment is applied to the position rather than to the size, so that
+ * the strings can be packed back to back between the aligned allocations
+ */
+static void *arena_bump(struct arena *arena, size_t size, size_t align)
+{
+	size_t pos = (arena->pos + align - 1) & ~(align - 1);
+	if (!arena->blocks || pos + size > arena->size)
+	{
+		size_t block_size = size > arena->block_size ? size : arena->block_size;
+		struct arena_block *block = malloc(sizeof(*block) + block_size);
+		if (!block)
+		{
+			fprintf(stderr, "arena block allocation failed\n");
+			return NULL;
+		}
+		block->next = arena->blocks;
+		arena->blocks = block;
+		arena->size = block_size;
+		pos = 0;
+	}
+	void *ptr = &arena->blocks->data[pos];
+	arena->pos = pos + size;
+	return ptr;
+}
+
+void *arena_alloc(struct arena *arena, size_t size)
+{
+	return arena_bump(arena, size, ARENA_ALIGN);
+}
+
+char *arena_strdup(struct arena *arena, const char *str)
+{
+	size_t len = strlen(str) + 1;
+	char *ret = arena_bump(arena, len, 1);
+	if (ret)
+		memcpy(ret, str, len);
+	return ret;
+}
@@ -0,0 +1,25 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stddef.h>
+
+struct arena_block;
+
+/* bump allocator: allocations are only released all at once by arena_destroy
+ * arena_alloc returns max_align_t aligned memory, arena_strdup packs the
+ * strings without padding
+ */
+struct arena
+{
+	struct arena_block *blocks;
+	size_t block_size;
+	size_t pos;
+	size_t size;
+};
+
+void arena_init(struct arena *arena, size_t block_size);
+void arena_destroy(struct arena *arena);
+void *arena_alloc(struct arena *arena, size_t size);
+char *arena_strdup(struct arena *arena, const char *str);
+
+#endif
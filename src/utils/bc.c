@@ -1,79 +1,174 @@
 #include "utils/bc.h"
 
+#include <stdbool.h>
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+# include <immintrin.h>
+# define BC_X86
+#endif
+
 #define RGB5TO8(v) ((((v) * 527) + 23) >> 6)
 #define RGB6TO8(v) ((((v) * 259) + 33) >> 6)
 
-static void unpack_bc1_block(uint32_t bx, uint32_t by, uint32_t width, uint32_t height, const uint8_t *in, uint8_t *out)
+/* a block is decoded by building its 4 colors palette (RGBA) and 16 alpha
+ * values once, then expanding the 2 bits color indices of each row through
+ * a kernel picked at load time for the running cpu
+ */
+typedef void (*bc_block_fn_t)(uint8_t *out, uint32_t pitch, const uint8_t *palette, uint32_t color_bits, const uint8_t *alphas);
+
+static void write_block_c(uint8_t *out, uint32_t pitch, const uint8_t *palette, uint32_t color_bits, const uint8_t *alphas)
+{
+	for (uint32_t y = 0; y < 4; ++y)
+	{
+		uint8_t *row = &out[y * pitch];
+		for (uint32_t x = 0; x < 4; ++x)
+		{
+			memcpy(&row[x * 4], &palette[(color_bits & 3) * 4], 4);
+			color_bits >>= 2;
+		}
+		if (alphas)
+		{
+			row[3] = alphas[y * 4 + 0];
+			row[7] = alphas[y * 4 + 1];
+			row[11] = alphas[y * 4 + 2];
+			row[15] = alphas[y * 4 + 3];
+		}
+	}
+}
+
+#ifdef BC_X86
+
+/* pshufb masks of the 4 texels of a row, indexed by the row color bits */
+static uint8_t g_color_shuffles[256][16] __attribute__((aligned(16)));
+
+#define ALPHA_SHUFFLE -128, -128, -128, 0, -128, -128, -128, 1, -128, -128, -128, 2, -128, -128, -128, 3
+
+__attribute__((target("ssse3")))
+static void write_block_ssse3(uint8_t *out, uint32_t pitch, const uint8_t *palette, uint32_t color_bits, const uint8_t *alphas)
+{
+	__m128i colors = _mm_loadu_si128((const __m128i*)palette);
+	__m128i alpha_shuffle = _mm_setr_epi8(ALPHA_SHUFFLE);
+	for (uint32_t y = 0; y < 4; ++y)
+	{
+		__m128i texels = _mm_shuffle_epi8(colors, _mm_load_si128((const __m128i*)g_color_shuffles[color_bits & 0xFF]));
+		if (alphas)
+		{
+			int32_t a;
+			memcpy(&a, &alphas[y * 4], 4);
+			texels = _mm_or_si128(texels, _mm_shuffle_epi8(_mm_cvtsi32_si128(a), alpha_shuffle));
+		}
+		_mm_storeu_si128((__m128i*)&out[y * pitch], texels);
+		color_bits >>= 8;
+	}
+}
+
+__attribute__((target("avx2")))
+static void write_block_avx2(uint8_t *out, uint32_t pitch, const uint8_t *palette, uint32_t color_bits, const uint8_t *alphas)
+{
+	__m256i colors = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i*)palette));
+	__m256i alpha_shuffle = _mm256_setr_epi8(ALPHA_SHUFFLE, ALPHA_SHUFFLE);
+	for (uint32_t y = 0; y < 4; y += 2)
+	{
+		__m256i shuffle = _mm256_inserti128_si256(_mm256_castsi128_si256(_mm_load_si128((const __m128i*)g_color_shuffles[color_bits & 0xFF])),
+		                                          _mm_load_si128((const __m128i*)g_color_shuffles[(color_bits >> 8) & 0xFF]), 1);
+		__m256i texels = _mm256_shuffle_epi8(colors, shuffle);
+		if (alphas)
+		{
+			int32_t a0;
+			int32_t a1;
+			memcpy(&a0, &alphas[y * 4], 4);
+			memcpy(&a1, &alphas[y * 4 + 4], 4);
+			texels = _mm256_or_si256(texels, _mm256_shuffle_epi8(_mm256_setr_epi32(a0, 0, 0, 0, a1, 0, 0, 0), alpha_shuffle));
+		}
+		_mm_storeu_si128((__m128i*)&out[y * pitch], _mm256_castsi256_si128(texels));
+		_mm_storeu_si128((__m128i*)&out[(y + 1) * pitch], _mm256_extracti128_si256(texels, 1));
+		color_bits >>= 16;
+	}
+}
+
+#undef ALPHA_SHUFFLE
+
+#endif
+
+static bc_block_fn_t g_write_block = write_block_c;
+
+__attribute__((constructor))
+static void bc_init(void)
+{
+#ifdef BC_X86
+	for (uint32_t v = 0; v < 256; ++v)
+	{
+		for (uint32_t x = 0; x < 4; ++x)
+		{
+			uint8_t color = ((v >> (x * 2)) & 3) * 4;
+			for (uint32_t c = 0; c < 4; ++c)
+				g_color_shuffles[v][x * 4 + c] = color + c;
+		}
+	}
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2"))
+		g_write_block = write_block_avx2;
+	else if (__builtin_cpu_supports("ssse3"))
+		g_write_block = write_block_ssse3;
+#endif
+}
+
+/* opaque is the alpha of the plain colors, 0 when the alpha comes from
+ * the block alpha values; bc1 blocks with color1 <= color2 have 3 colors
+ * and a transparent black
+ */
+static void build_palette(const uint8_t *in, bool bc1, uint8_t opaque, uint8_t *palette)
 {
-	(void)height;
-	uint32_t idx = (by * width + bx) * 4;
-	uint32_t idx_inc = width * 4 - 16;
-	uint32_t color_bits = in[4] | (in[5] << 8) | (in[6] << 16) | (in[7] << 24);
 	uint16_t color1 = (in[1] << 8) | in[0];
+	uint16_t color2 = (in[3] << 8) | in[2];
 	uint8_t r1 = RGB5TO8(in[1] >> 3);
 	uint8_t g1 = RGB6TO8((color1 >> 5) & 0x3F);
 	uint8_t b1 = RGB5TO8(in[0] & 0x1F);
-	uint16_t color2 = (in[3] << 8) | in[2];
 	uint8_t r2 = RGB5TO8(in[3] >> 3);
 	uint8_t g2 = RGB6TO8((color2 >> 5) & 0x3F);
 	uint8_t b2 = RGB5TO8(in[2] & 0x1F);
-	for (uint32_t y = 0; y < 4; ++y)
+	palette[0] = r1;
+	palette[1] = g1;
+	palette[2] = b1;
+	palette[3] = opaque;
+	palette[4] = r2;
+	palette[5] = g2;
+	palette[6] = b2;
+	palette[7] = opaque;
+	if (!bc1 || color1 > color2)
 	{
-		for (uint32_t x = 0; x < 4; ++x)
-		{
-			switch (color_bits & 3)
-			{
-				case 0:
-					out[idx++] = r1;
-					out[idx++] = g1;
-					out[idx++] = b1;
-					out[idx++] = 0xff;
-					break;
-				case 1:
-					out[idx++] = r2;
-					out[idx++] = g2;
-					out[idx++] = b2;
-					out[idx++] = 0xff;
-					break;
-				case 2:
-					if (color1 > color2)
-					{
-						out[idx++] = (2 * r1 + r2) / 3;
-						out[idx++] = (2 * g1 + g2) / 3;
-						out[idx++] = (2 * b1 + b2) / 3;
-						out[idx++] = 0xff;
-					}
-					else
-					{
-						out[idx++] = (r1 + r2) / 2;
-						out[idx++] = (g1 + g2) / 2;
-						out[idx++] = (b1 + b2) / 2;
-						out[idx++] = 0xff;
-					}
-					break;
-				case 3:
-					if (color1 > color2)
-					{
-						out[idx++] = (2 * r2 + r1) / 3;
-						out[idx++] = (2 * g2 + g1) / 3;
-						out[idx++] = (2 * b2 + b1) / 3;
-						out[idx++] = 0xff;
-					}
-					else
-					{
-						out[idx++] = 0;
-						out[idx++] = 0;
-						out[idx++] = 0;
-						out[idx++] = 0;
-					}
-					break;
-			}
-			color_bits >>= 2;
-		}
-		idx += idx_inc;
+		palette[8] = (2 * r1 + r2) / 3;
+		palette[9] = (2 * g1 + g2) / 3;
+		palette[10] = (2 * b1 + b2) / 3;
+		palette[11] = opaque;
+		palette[12] = (2 * r2 + r1) / 3;
+		palette[13] = (2 * g2 + g1) / 3;
+		palette[14] = (2 * b2 + b1) / 3;
+		palette[15] = opaque;
+	}
+	else
+	{
+		palette[8] = (r1 + r2) / 2;
+		palette[9] = (g1 + g2) / 2;
+		palette[10] = (b1 + b2) / 2;
+		palette[11] = opaque;
+		palette[12] = 0;
+		palette[13] = 0;
+		palette[14] = 0;
+		palette[15] = 0;
 	}
 }
 
+static void unpack_bc1_block(uint32_t bx, uint32_t by, uint32_t width, uint32_t height, const uint8_t *in, uint8_t *out)
+{
+	(void)height;
+	uint8_t palette[16];
+	build_palette(in, true, 0xFF, palette);
+	uint32_t color_bits = in[4] | (in[5] << 8) | (in[6] << 16) | ((uint32_t)in[7] << 24);
+	g_write_block(&out[(by * width + bx) * 4], width * 4, palette, color_bits, NULL);
+}
+
 void unpack_bc1(uint32_t width, uint32_t height, const uint8_t *in, uint8_t *out)
 {
 	uint32_t bx = (width + 3) & (~0x3);
@@ -91,60 +186,17 @@ void unpack_bc1(uint32_t width, uint32_t height, const uint8_t *in, uint8_t *out
 static void unpack_bc2_block(uint32_t bx, uint32_t by, uint32_t width, uint32_t height, const uint8_t *in, uint8_t *out)
 {
 	(void)height;
-	uint32_t idx = (by * width + bx) * 4;
-	uint32_t idx_inc = width * 4 - 16;
-	uint32_t color_bits = in[12] | (in[13] << 8) | (in[14] << 16) | (in[15] << 24);
-	uint16_t color1 = (in[9] << 8) | in[8];
-	uint8_t r1 = RGB5TO8(in[9] >> 3);
-	uint8_t g1 = RGB6TO8((color1 >> 5) & 0x3F);
-	uint8_t b1 = RGB5TO8(in[8] & 0x1F);
-	uint16_t color2 = (in[11] << 8) | in[10];
-	uint8_t r2 = RGB5TO8(in[11] >> 3);
-	uint8_t g2 = RGB6TO8((color2 >> 5) & 0x3F);
-	uint8_t b2 = RGB5TO8(in[10] & 0x1F);
-	uint32_t alpha_idx = 0;
-	for (uint32_t y = 0; y < 4; ++y)
+	uint8_t palette[16];
+	uint8_t alphas[16];
+	build_palette(&in[8], false, 0, palette);
+	for (uint32_t i = 0; i < 16; i += 2)
 	{
-		for (uint32_t x = 0; x < 4; ++x)
-		{
-			switch (color_bits & 3)
-			{
-				case 0:
-					out[idx++] = r1;
-					out[idx++] = g1;
-					out[idx++] = b1;
-					break;
-				case 1:
-					out[idx++] = r2;
-					out[idx++] = g2;
-					out[idx++] = b2;
-					break;
-				case 2:
-					out[idx++] = (2 * r1 + r2) / 3;
-					out[idx++] = (2 * g1 + g2) / 3;
-					out[idx++] = (2 * b1 + b2) / 3;
-					break;
-				case 3:
-					out[idx++] = (2 * r2 + r1) / 3;
-					out[idx++] = (2 * g2 + g1) / 3;
-					out[idx++] = (2 * b2 + b1) / 3;
-					break;
-			}
-			color_bits >>= 2;
-			if (x & 1)
-			{
-				out[idx] = in[alpha_idx++] & 0xF0;
-				out[idx] |= out[idx] >> 4;
-			}
-			else
-			{
-				out[idx] = in[alpha_idx] & 0x0F;
-				out[idx] |= out[idx] << 4;
-			}
-			idx++;
-		}
-		idx += idx_inc;
+		uint8_t v = in[i / 2];
+		alphas[i + 0] = (v & 0x0F) | (v << 4);
+		alphas[i + 1] = (v & 0xF0) | (v >> 4);
 	}
+	uint32_t color_bits = in[12] | (in[13] << 8) | (in[14] << 16) | ((uint32_t)in[15] << 24);
+	g_write_block(&out[(by * width + bx) * 4], width * 4, palette, color_bits, alphas);
 }
 
 void unpack_bc2(uint32_t width, uint32_t height, const uint8_t *in, uint8_t *out)
@@ -164,81 +216,43 @@ void unpack_bc2(uint32_t width, uint32_t height, const uint8_t *in, uint8_t *out
 static void unpack_bc3_block(uint32_t bx, uint32_t by, uint32_t width, uint32_t height, const uint8_t *in, uint8_t *out)
 {
 	(void)height;
-	uint32_t idx = (by * width + bx) * 4;
-	uint32_t idx_inc = width * 4 - 16;
-	uint32_t color_bits = in[12] | (in[13] << 8) | (in[14] << 16) | (in[15] << 24);
-	uint16_t color1 = (in[9] << 8) | in[8];
-	uint8_t r1 = RGB5TO8(in[9] >> 3);
-	uint8_t g1 = RGB6TO8((color1 >> 5) & 0x3F);
-	uint8_t b1 = RGB5TO8(in[8] & 0x1F);
-	uint16_t color2 = (in[11] << 8) | in[10];
-	uint8_t r2 = RGB5TO8(in[11] >> 3);
-	uint8_t g2 = RGB6TO8((color2 >> 5) & 0x3F);
-	uint8_t b2 = RGB5TO8(in[10] & 0x1F);
-	uint32_t alpha_bits1 = (in[4] << 16) | (in[3] << 8) | in[2];
-	uint32_t alpha_bits2 = (in[7] << 16) | (in[6] << 8) | in[5];
-	uint8_t alphas[8];
-	alphas[0] = in[0];
-	alphas[1] = in[1];
-	if (alphas[0] > alphas[1])
+	uint8_t palette[16];
+	uint8_t alphas[16];
+	uint8_t values[8];
+	build_palette(&in[8], false, 0, palette);
+	values[0] = in[0];
+	values[1] = in[1];
+	if (values[0] > values[1])
 	{
-		alphas[2] = (6 * alphas[0] + 1 * alphas[1]) / 7;
-		alphas[3] = (5 * alphas[0] + 2 * alphas[1]) / 7;
-		alphas[4] = (4 * alphas[0] + 3 * alphas[1]) / 7;
-		alphas[5] = (3 * alphas[0] + 4 * alphas[1]) / 7;
-		alphas[6] = (2 * alphas[0] + 5 * alphas[1]) / 7;
-		alphas[7] = (1 * alphas[0] + 6 * alphas[1]) / 7;
+		values[2] = (6 * values[0] + 1 * values[1]) / 7;
+		values[3] = (5 * values[0] + 2 * values[1]) / 7;
+		values[4] = (4 * values[0] + 3 * values[1]) / 7;
+		values[5] = (3 * values[0] + 4 * values[1]) / 7;
+		values[6] = (2 * values[0] + 5 * values[1]) / 7;
+		values[7] = (1 * values[0] + 6 * values[1]) / 7;
 	}
 	else
 	{
-		alphas[2] = (4 * alphas[0] + 1 * alphas[1]) / 5;
-		alphas[3] = (3 * alphas[0] + 2 * alphas[1]) / 5;
-		alphas[4] = (2 * alphas[0] + 3 * alphas[1]) / 5;
-		alphas[5] = (1 * alphas[0] + 4 * alphas[1]) / 5;
-		alphas[6] = 0;
-		alphas[7] = 0xFF;
+		values[2] = (4 * values[0] + 1 * values[1]) / 5;
+		values[3] = (3 * values[0] + 2 * values[1]) / 5;
+		values[4] = (2 * values[0] + 3 * values[1]) / 5;
+		values[5] = (1 * values[0] + 4 * values[1]) / 5;
+		values[6] = 0;
+		values[7] = 0xFF;
 	}
-	for (uint32_t y = 0; y < 4; ++y)
+	uint64_t alpha_bits = (uint64_t)in[2]
+	                    | ((uint64_t)in[3] << 8)
+	                    | ((uint64_t)in[4] << 16)
+	                    | ((uint64_t)in[5] << 24)
+	                    | ((uint64_t)in[6] << 32)
+	                    | ((uint64_t)in[7] << 40);
+	for (uint32_t i = 0; i < 16; ++i)
 	{
-		for (uint32_t x = 0; x < 4; ++x)
-		{
-			switch (color_bits & 3)
-			{
-				case 0:
-					out[idx++] = r1;
-					out[idx++] = g1;
-					out[idx++] = b1;
-					break;
-				case 1:
-					out[idx++] = r2;
-					out[idx++] = g2;
-					out[idx++] = b2;
-					break;
-				case 2:
-					out[idx++] = (2 * r1 + r2) / 3;
-					out[idx++] = (2 * g1 + g2) / 3;
-					out[idx++] = (2 * b1 + b2) / 3;
-					break;
-				case 3:
-					out[idx++] = (2 * r2 + r1) / 3;
-					out[idx++] = (2 * g2 + g1) / 3;
-					out[idx++] = (2 * b2 + b1) / 3;
-					break;
-			}
-			color_bits >>= 2;
-			if (y < 2)
-			{
-				out[idx++] = alphas[alpha_bits1 & 7];
-				alpha_bits1 >>= 3;
-			}
-			else
-			{
-				out[idx++] = alphas[alpha_bits2 & 7];
-				alpha_bits2 >>= 3;
-			}
-		}
-		idx += idx_inc;
+		alphas[i] = values[alpha_bits & 7];
+		alpha_bits >>= 3;
 	}
+	uint32_t color_bits = in[12] | (in[13] << 8) | (in[14] << 16) | ((uint32_t)in[15] << 24);
+	g_write_block(&out[(by * width + bx) * 4], width * 4, palette, color_bits, alphas);
 }
 
 void unpack_bc3(uint32_t width, uint32_t height, const uint8_t *in, uint8_t *out)
@@ -1,3 +1,4 @@
+#include "utils/parallel.h"
 #include "utils/blp.h"
 #include "utils/bc.h"
 
@@ -5,123 +6,296 @@
 
 #include <inttypes.h>
 #include <stdlib.h>
+#include <string.h>
 #include <stdio.h>
 
-bool blp_decode_rgba(const struct wow_blp_file *file, uint8_t mipmap_id, uint32_t *width, uint32_t *height, uint8_t **data)
+/* pixel rows decoded by a single task, multiple of the 4 rows of BC blocks */
+#define DECODE_ROWS 64
+
+struct decode_task
+{
+	const struct wow_blp_file *file;
+	uint8_t mipmap_id;
+	struct blp_rgba *rgba;
+	uint32_t y0;
+	uint32_t y1;
+};
+
+static bool check_format(const struct wow_blp_file *file)
 {
 	if (file->header.type != 1)
 	{
 		fprintf(stderr, "unsupported BLP type %" PRIu32 "\n", file->header.type);
 		return false;
 	}
-	if (mipmap_id >= file->mipmaps_nb)
-	{
-		fprintf(stderr, "invalid mipmap id\n");
-		return false;
-	}
-	const struct wow_blp_mipmap *mipmap = &file->mipmaps[mipmap_id];
-	*width = mipmap->width;
-	*height = mipmap->height;
 	switch (file->header.compression)
 	{
 		case 1:
-		{
-			*data = malloc(*width * *height * 4);
-			if (!*data)
-			{
-				fprintf(stderr, "failed to malloc data\n");
-				break;
-			}
-			const uint8_t *indexes = mipmap->data;
-			const uint8_t *alphas = indexes + *width * *height;
-			uint32_t idx = 0;
-			for (uint32_t i = 0; i < *width * *height; ++i)
-			{
-				uint32_t p = file->header.palette[indexes[i]];
-				uint8_t *r = &(*data)[idx++];
-				uint8_t *g = &(*data)[idx++];
-				uint8_t *b = &(*data)[idx++];
-				uint8_t *a = &(*data)[idx++];
-				*r = p >> 16;
-				*g = p >> 8;
-				*b = p >> 0;
-				switch (file->header.alpha_depth)
-				{
-					case 0:
-						*a = 0xff;
-						break;
-					case 1:
-						*a = ((alphas[i / 8] >> (i % 8)) & 1) * 0xff;
-						break;
-					case 4:
-						*a = ((alphas[i / 2] >> ((i % 2) * 4)) & 0xf);
-						*a |= *a << 4;
-						break;
-					case 8:
-						*a = alphas[i];
-						break;
-					default:
-						*a = 0xff;
-						fprintf(stderr, "unsupported BLP alpha depth: %" PRIu32 "\n", file->header.alpha_depth);
-						break;
-				}
-			}
-			break;
-		}
+			if (file->header.alpha_depth != 0
+			 && file->header.alpha_depth != 1
+			 && file->header.alpha_depth != 4
+			 && file->header.alpha_depth != 8)
+				fprintf(stderr, "unsupported BLP alpha depth: %" PRIu32 "\n", (uint32_t)file->header.alpha_depth);
+			return true;
+		case 3:
+			return true;
 		case 2:
-		{
-			size_t size = *width * *height * 4;
-			if (*width < 4)
-				size += (4 - *width) * *height * 4;
-			if (*height < 4)
-				size += (4 - *height) * *width * 4;
 			switch (file->header.alpha_type)
 			{
 				case 0:
-					*data = malloc(size);
-					if (*data)
-						unpack_bc1(*width, *height, mipmap->data, *data);
-					else
-						fprintf(stderr, "failed to malloc BC1\n");
-					break;
 				case 1:
-					*data = malloc(size);
-					if (data)
-						unpack_bc2(*width, *height, mipmap->data, *data);
-					else
-						fprintf(stderr, "failed to malloc BC2\n");
-					break;
 				case 7:
-					*data = malloc(size);
-					if (*data)
-						unpack_bc3(*width, *height, mipmap->data, *data);
-					else
-						fprintf(stderr, "failed to malloc BC3\n");
-					break;
-				default:
-					return false;
+					return true;
 			}
 			break;
-		}
-		case 3:
-		{
-			*data = malloc(*width * *height * 4);
-			if (!*data)
+	}
+	fprintf(stderr, "unsupported BLP compression %" PRIu32 " (alpha type %" PRIu32 ")\n", (uint32_t)file->header.compression, (uint32_t)file->header.alpha_type);
+	return false;
+}
+
+static bool alloc_rgba(const struct wow_blp_file *file, uint8_t mipmap_id, struct blp_rgba *rgba)
+{
+	const struct wow_blp_mipmap *mipmap = &file->mipmaps[mipmap_id];
+	rgba->width = mipmap->width;
+	rgba->height = mipmap->height;
+	size_t size = rgba->width * rgba->height * 4;
+	/* BC blocks are always written as 4x4 */
+	if (file->header.compression == 2)
+	{
+		if (rgba->width < 4)
+			size += (4 - rgba->width) * rgba->height * 4;
+		if (rgba->height < 4)
+			size += (4 - rgba->height) * rgba->width * 4;
+	}
+	rgba->data = malloc(size);
+	if (!rgba->data)
+	{
+		fprintf(stderr, "failed to malloc data\n");
+		return false;
+	}
+	return true;
+}
+
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+# define ALPHA_SHIFT 0
+#else
+# define ALPHA_SHIFT 24
+#endif
+
+/* palette pre-swizzled to RGBA so that a pixel is a single 32 bits store */
+static void build_colors(const struct wow_blp_file *file, uint32_t *colors, uint8_t alpha)
+{
+	for (uint32_t i = 0; i < 256; ++i)
+	{
+		uint32_t p = file->header.palette[i];
+		uint8_t rgba[4] = {p >> 16, p >> 8, p >> 0, alpha};
+		memcpy(&colors[i], rgba, 4);
+	}
+}
+
+static uint8_t get_alpha(uint8_t depth, const uint8_t *alphas, uint32_t i)
+{
+	uint8_t a;
+	switch (depth)
+	{
+		case 1:
+			return ((alphas[i / 8] >> (i % 8)) & 1) * 0xff;
+		case 4:
+			a = (alphas[i / 2] >> ((i % 2) * 4)) & 0xf;
+			return a | (a << 4);
+		case 8:
+			return alphas[i];
+	}
+	return 0xff;
+}
+
+/* used for the unaligned head and tail of the specialized loops */
+static void decode_palette_pixels(const uint32_t *colors, uint8_t depth, const uint8_t *indexes, const uint8_t *alphas, uint32_t *out, uint32_t begin, uint32_t end)
+{
+	for (uint32_t i = begin; i < end; ++i)
+		out[i] = colors[indexes[i]] | ((uint32_t)get_alpha(depth, alphas, i) << ALPHA_SHIFT);
+}
+
+static void decode_palette(const struct wow_blp_file *file, const struct wow_blp_mipmap *mipmap, uint8_t *data, uint32_t begin, uint32_t end)
+{
+	const uint8_t *indexes = mipmap->data;
+	const uint8_t *alphas = indexes + mipmap->width * mipmap->height;
+	uint32_t *out = (uint32_t*)data;
+	uint32_t colors[256];
+	uint8_t depth = file->header.alpha_depth;
+	uint32_t i;
+	switch (depth)
+	{
+		case 1:
+			/* 8 pixels per alpha byte */
+			build_colors(file, colors, 0);
+			i = (begin + 7) & ~7u;
+			if (i > end)
+				i = end;
+			decode_palette_pixels(colors, depth, indexes, alphas, out, begin, i);
+			for (; i + 8 <= end; i += 8)
 			{
-				fprintf(stderr, "failed to malloc data\n");
-				break;
+				uint32_t v = alphas[i / 8];
+				for (uint32_t j = 0; j < 8; ++j)
+					out[i + j] = colors[indexes[i + j]] | ((-((v >> j) & 1) & 0xff) << ALPHA_SHIFT);
 			}
-			for (uint32_t i = 0; i < *width * *height * 4; i += 4)
+			decode_palette_pixels(colors, depth, indexes, alphas, out, i, end);
+			break;
+		case 4:
+			/* 16 pixels per 8 alpha bytes */
+			build_colors(file, colors, 0);
+			i = (begin + 15) & ~15u;
+			if (i > end)
+				i = end;
+			decode_palette_pixels(colors, depth, indexes, alphas, out, begin, i);
+			for (; i + 16 <= end; i += 16)
 			{
-				(*data)[i + 0] = mipmap->data[i + 2];
-				(*data)[i + 1] = mipmap->data[i + 1];
-				(*data)[i + 2] = mipmap->data[i + 0];
-				(*data)[i + 3] = mipmap->data[i + 3];
+				const uint8_t *a = &alphas[i / 2];
+				for (uint32_t j = 0; j < 16; j += 2)
+				{
+					uint32_t v = a[j / 2];
+					out[i + j + 0] = colors[indexes[i + j + 0]] | (((v & 0x0F) * 0x11) << ALPHA_SHIFT);
+					out[i + j + 1] = colors[indexes[i + j + 1]] | (((v >> 4) * 0x11) << ALPHA_SHIFT);
+				}
 			}
+			decode_palette_pixels(colors, depth, indexes, alphas, out, i, end);
+			break;
+		case 8:
+			build_colors(file, colors, 0);
+			for (i = begin; i < end; ++i)
+				out[i] = colors[indexes[i]] | ((uint32_t)alphas[i] << ALPHA_SHIFT);
 			break;
-		}
 		default:
+			build_colors(file, colors, 0xff);
+			for (i = begin; i < end; ++i)
+				out[i] = colors[indexes[i]];
+			break;
+	}
+}
+
+static void decode_bgra(const struct wow_blp_mipmap *mipmap, uint8_t *data, uint32_t begin, uint32_t end)
+{
+	for (uint32_t i = begin * 4; i < end * 4; i += 4)
+	{
+		data[i + 0] = mipmap->data[i + 2];
+		data[i + 1] = mipmap->data[i + 1];
+		data[i + 2] = mipmap->data[i + 0];
+		data[i + 3] = mipmap->data[i + 3];
+	}
+}
+
+/* BC blocks rows are independent: a strip of rows is decoded as a smaller
+ * image of the same width
+ */
+static void decode_bc(const struct wow_blp_file *file, const struct wow_blp_mipmap *mipmap, uint8_t *data, uint32_t y0, uint32_t y1)
+{
+	uint32_t blocks_width = (mipmap->width + 3) / 4;
+	uint32_t block_size = file->header.alpha_type ? 16 : 8;
+	const uint8_t *in = &mipmap->data[(y0 / 4) * blocks_width * block_size];
+	uint8_t *out = &data[y0 * mipmap->width * 4];
+	switch (file->header.alpha_type)
+	{
+		case 0:
+			unpack_bc1(mipmap->width, y1 - y0, in, out);
+			break;
+		case 1:
+			unpack_bc2(mipmap->width, y1 - y0, in, out);
+			break;
+		case 7:
+			unpack_bc3(mipmap->width, y1 - y0, in, out);
+			break;
+	}
+}
+
+static void decode_task(void *userdata, size_t i)
+{
+	struct decode_task *task = &((struct decode_task*)userdata)[i];
+	const struct wow_blp_mipmap *mipmap = &task->file->mipmaps[task->mipmap_id];
+	switch (task->file->header.compression)
+	{
+		case 1:
+			decode_palette(task->file, mipmap, task->rgba->data, task->y0 * mipmap->width, task->y1 * mipmap->width);
+			break;
+		case 2:
+			decode_bc(task->file, mipmap, task->rgba->data, task->y0, task->y1);
+			break;
+		case 3:
+			decode_bgra(mipmap, task->rgba->data, task->y0 * mipmap->width, task->y1 * mipmap->width);
+			break;
+	}
+}
+
+static uint32_t tasks_count(const struct blp_rgba *rgba)
+{
+	return (rgba->height + DECODE_ROWS - 1) / DECODE_ROWS;
+}
+
+static void add_tasks(const struct wow_blp_file *file, uint8_t mipmap_id, struct blp_rgba *rgba, struct decode_task *tasks, size_t *tasks_nb)
+{
+	for (uint32_t y = 0; y < rgba->height; y += DECODE_ROWS)
+	{
+		struct decode_task *task = &tasks[(*tasks_nb)++];
+		task->file = file;
+		task->mipmap_id = mipmap_id;
+		task->rgba = rgba;
+		task->y0 = y;
+		task->y1 = y + DECODE_ROWS < rgba->height ? y + DECODE_ROWS : rgba->height;
+	}
+}
+
+static bool decode_mipmaps(const struct wow_blp_file *file, uint8_t first, uint8_t count, struct blp_rgba *rgbas)
+{
+	size_t tasks_nb = 0;
+	for (uint8_t i = 0; i < count; ++i)
+	{
+		if (!alloc_rgba(file, first + i, &rgbas[i]))
+		{
+			for (uint8_t j = 0; j < i; ++j)
+				free(rgbas[j].data);
 			return false;
+		}
+		tasks_nb += tasks_count(&rgbas[i]);
+	}
+	struct decode_task *tasks = malloc(sizeof(*tasks) * (tasks_nb ? tasks_nb : 1));
+	if (!tasks)
+	{
+		fprintf(stderr, "failed to malloc decode tasks\n");
+		for (uint8_t i = 0; i < count; ++i)
+			free(rgbas[i].data);
+		return false;
+	}
+	tasks_nb = 0;
+	for (uint8_t i = 0; i < count; ++i)
+		add_tasks(file, first + i, &rgbas[i], tasks, &tasks_nb);
+	if (tasks_nb == 1)
+		decode_task(tasks, 0);
+	else
+		parallel_for(tasks_nb, decode_task, tasks);
+	free(tasks);
+	return true;
+}
+
+bool blp_decode_rgba(const struct wow_blp_file *file, uint8_t mipmap_id, uint32_t *width, uint32_t *height, uint8_t **data)
+{
+	if (!check_format(file))
+		return false;
+	if (mipmap_id >= file->mipmaps_nb)
+	{
+		fprintf(stderr, "invalid mipmap id\n");
+		return false;
 	}
+	struct blp_rgba rgba;
+	if (!decode_mipmaps(file, mipmap_id, 1, &rgba))
+		return false;
+	*width = rgba.width;
+	*height = rgba.height;
+	*data = rgba.data;
 	return true;
 }
+
+bool blp_decode_rgba_mipmaps(const struct wow_blp_file *file, struct blp_rgba *mipmaps)
+{
+	if (!check_format(file))
+		return false;
+	return decode_mipmaps(file, 0, file->mipmaps_nb, mipmaps);
+}
@@ -6,6 +6,18 @@
 
 struct wow_blp_file;
 
+struct blp_rgba
+{
+	uint32_t width;
+	uint32_t height;
+	uint8_t *data;
+};
+
 bool blp_decode_rgba(const struct wow_blp_file *file, uint8_t mipmap_id, uint32_t *width, uint32_t *height, uint8_t **data);
 
+/* decode the whole mipmap chain at once, mipmaps must hold file->mipmaps_nb entries
+ * on success each data must be freed by the caller
+ */
+bool blp_decode_rgba_mipmaps(const struct wow_blp_file *file, struct blp_rgba *mipmaps);
+
 #endif
@@ -0,0 +1,158 @@
+#include "utils/dbc_layout.h"
+
+#include <libwow/dbc.h>
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+
+#define DECODER(name, type, field) \
+static union dbc_value decode_##name(const uint8_t *ptr) \
+{ \
+	type v; \
+	memcpy(&v, ptr, sizeof(v)); \
+	return (union dbc_value){.field = v}; \
+}
+
+DECODER(i8, int8_t, i)
+DECODER(u8, uint8_t, u)
+DECODER(i16, int16_t, i)
+DECODER(u16, uint16_t, u)
+DECODER(i32, int32_t, i)
+DECODER(u32, uint32_t, u)
+DECODER(i64, int64_t, i)
+DECODER(u64, uint64_t, u)
+DECODER(flt, float, f)
+DECODER(str, uint32_t, str)
+
+#undef DECODER
+
+static bool compile_column(struct dbc_layout_column *column, enum wow_dbc_type type, uint32_t *offset)
+{
+	column->type = type;
+	column->offset = *offset;
+	switch (type)
+	{
+		case WOW_DBC_TYPE_I8:
+			column->kind = DBC_VALUE_INT;
+			column->decode = decode_i8;
+			*offset += 1;
+			return true;
+		case WOW_DBC_TYPE_U8:
+			column->kind = DBC_VALUE_UINT;
+			column->decode = decode_u8;
+			*offset += 1;
+			return true;
+		case WOW_DBC_TYPE_I16:
+			column->kind = DBC_VALUE_INT;
+			column->decode = decode_i16;
+			*offset += 2;
+			return true;
+		case WOW_DBC_TYPE_U16:
+			column->kind = DBC_VALUE_UINT;
+			column->decode = decode_u16;
+			*offset += 2;
+			return true;
+		case WOW_DBC_TYPE_I32:
+			column->kind = DBC_VALUE_INT;
+			column->decode = decode_i32;
+			*offset += 4;
+			return true;
+		case WOW_DBC_TYPE_U32:
+			column->kind = DBC_VALUE_UINT;
+			column->decode = decode_u32;
+			*offset += 4;
+			return true;
+		case WOW_DBC_TYPE_I64:
+			column->kind = DBC_VALUE_INT;
+			column->decode = decode_i64;
+			*offset += 8;
+			return true;
+		case WOW_DBC_TYPE_U64:
+			column->kind = DBC_VALUE_UINT;
+			column->decode = decode_u64;
+			*offset += 8;
+			return true;
+		case WOW_DBC_TYPE_FLT:
+			column->kind = DBC_VALUE_FLOAT;
+			column->decode = decode_flt;
+			*offset += 4;
+			return true;
+		case WOW_DBC_TYPE_STR:
+			column->kind = DBC_VALUE_STRING;
+			column->decode = decode_str;
+			*offset += 4;
+			return true;
+		case WOW_DBC_TYPE_LSTR:
+			/* 16 locales and a flags field, the third locale is shown */
+			column->kind = DBC_VALUE_STRING;
+			column->decode = decode_str;
+			column->offset += 8;
+			*offset += 4 * 17;
+			return true;
+		case WOW_DBC_TYPE_END:
+			break;
+	}
+	return false;
+}
+
+bool dbc_layout_init(struct dbc_layout *layout, const struct wow_dbc_def *def, const struct wow_dbc_file *file)
+{
+	uint32_t columns_nb = 0;
+	if (def)
+	{
+		while (def[columns_nb].type != WOW_DBC_TYPE_END)
+			columns_nb++;
+	}
+	else
+	{
+		columns_nb = file->header.record_size / 4;
+	}
+	layout->columns = malloc(sizeof(*layout->columns) * (columns_nb ? columns_nb : 1));
+	if (!layout->columns)
+	{
+		fprintf(stderr, "dbc layout allocation failed\n");
+		return false;
+	}
+	uint32_t offset = 0;
+	layout->columns_nb = 0;
+	for (uint32_t i = 0; i < columns_nb; ++i)
+	{
+		if (!compile_column(&layout->columns[layout->columns_nb], def ? def[i].type : WOW_DBC_TYPE_U32, &offset))
+			break;
+		layout->columns_nb++;
+	}
+	return true;
+}
+
+void dbc_layout_destroy(struct dbc_layout *layout)
+{
+	free(layout->columns);
+	layout->columns = NULL;
+	layout->columns_nb = 0;
+}
+
+const uint8_t *dbc_layout_record(const struct wow_dbc_file *file, uint32_t record)
+{
+	return wow_dbc_get_row(file, record).ptr;
+}
+
+union dbc_value dbc_layout_get(const struct dbc_layout *layout, const struct wow_dbc_file *file, uint32_t record, uint32_t column)
+{
+	const struct dbc_layout_column *col = &layout->columns[column];
+	return col->decode(&dbc_layout_record(file, record)[col->offset]);
+}
+
+const char *dbc_layout_get_str(const struct dbc_layout *layout, const struct wow_dbc_file *file, uint32_t record, uint32_t column)
+{
+	struct wow_dbc_row row = wow_dbc_get_row(file, record);
+	return wow_dbc_get_str(&row, layout->columns[column].offset);
+}
+
+void dbc_layout_scan(const struct dbc_layout *layout, const struct wow_dbc_file *file, uint32_t column, struct dbc_column_scan *scan)
+{
+	scan->column = &layout->columns[column];
+	scan->stride = file->header.record_size;
+	scan->count = file->header.record_count;
+	scan->ptr = scan->count ? &dbc_layout_record(file, 0)[scan->column->offset] : NULL;
+}
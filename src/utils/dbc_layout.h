@@ -0,0 +1,67 @@
+#ifndef DBC_LAYOUT_H
+#define DBC_LAYOUT_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+
+struct wow_dbc_file;
+struct wow_dbc_def;
+
+enum dbc_value_kind
+{
+	DBC_VALUE_INT,
+	DBC_VALUE_UINT,
+	DBC_VALUE_FLOAT,
+	DBC_VALUE_STRING, /* u32 offset in the strings block */
+};
+
+union dbc_value
+{
+	int64_t i;
+	uint64_t u;
+	float f;
+	uint32_t str;
+};
+
+typedef union dbc_value (*dbc_decode_t)(const uint8_t *ptr);
+
+struct dbc_layout_column
+{
+	uint32_t type; /* enum wow_dbc_type */
+	enum dbc_value_kind kind;
+	uint32_t offset; /* of the decoded value in the record */
+	dbc_decode_t decode;
+};
+
+/* columns of a dbc definition compiled once: offsets, value kinds and decoders
+ * without definition the records are split in u32 columns
+ */
+struct dbc_layout
+{
+	struct dbc_layout_column *columns;
+	uint32_t columns_nb;
+};
+
+/* one column across all the records, read as a strided scan of the records block */
+struct dbc_column_scan
+{
+	const struct dbc_layout_column *column;
+	const uint8_t *ptr; /* value of the first record */
+	uint32_t stride;
+	uint32_t count;
+};
+
+bool dbc_layout_init(struct dbc_layout *layout, const struct wow_dbc_def *def, const struct wow_dbc_file *file);
+void dbc_layout_destroy(struct dbc_layout *layout);
+const uint8_t *dbc_layout_record(const struct wow_dbc_file *file, uint32_t record);
+union dbc_value dbc_layout_get(const struct dbc_layout *layout, const struct wow_dbc_file *file, uint32_t record, uint32_t column);
+const char *dbc_layout_get_str(const struct dbc_layout *layout, const struct wow_dbc_file *file, uint32_t record, uint32_t column);
+void dbc_layout_scan(const struct dbc_layout *layout, const struct wow_dbc_file *file, uint32_t column, struct dbc_column_scan *scan);
+
+static inline union dbc_value dbc_scan_get(const struct dbc_column_scan *scan, uint32_t record)
+{
+	return scan->column->decode(&scan->ptr[(size_t)record * scan->stride]);
+}
+
+#endif
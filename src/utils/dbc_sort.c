@@ -0,0 +1,180 @@
+#include "utils/dbc_layout.h"
+#include "utils/dbc_sort.h"
+
+#include <libwow/dbc.h>
+
+#include <glib.h>
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+
+struct radix_item
+{
+	uint64_t key;
+	uint32_t record;
+};
+
+struct collate_item
+{
+	const char *key;
+	uint32_t record;
+};
+
+/* records order is the tie breaker of every sort, restore it first */
+static bool sort_records(const struct wow_dbc_file *file, uint32_t *records, uint32_t count)
+{
+	uint8_t *present = calloc(file->header.record_count ? file->header.record_count : 1, 1);
+	if (!present)
+		return false;
+	for (uint32_t i = 0; i < count; ++i)
+		present[records[i]] = 1;
+	uint32_t n = 0;
+	for (uint32_t i = 0; i < file->header.record_count; ++i)
+	{
+		if (present[i])
+			records[n++] = i;
+	}
+	free(present);
+	return true;
+}
+
+/* unsigned keys with the same order as the values */
+static uint64_t radix_key(const struct dbc_column_scan *scan, uint32_t record)
+{
+	union dbc_value value = dbc_scan_get(scan, record);
+	switch (scan->column->kind)
+	{
+		case DBC_VALUE_INT:
+			return (uint64_t)value.i ^ (UINT64_C(1) << 63);
+		case DBC_VALUE_FLOAT:
+		{
+			uint32_t bits;
+			memcpy(&bits, &value.f, sizeof(bits));
+			return (bits & 0x80000000) ? (uint32_t)~bits : (bits | 0x80000000);
+		}
+		default:
+			break;
+	}
+	return value.u;
+}
+
+/* lsd radix sort by bytes, stable; bytes equal across all the keys are skipped */
+static bool radix_sort(struct radix_item *items, uint32_t count)
+{
+	struct radix_item *tmp = malloc(sizeof(*tmp) * count);
+	if (!tmp)
+		return false;
+	struct radix_item *src = items;
+	struct radix_item *dst = tmp;
+	for (uint32_t shift = 0; shift < 64; shift += 8)
+	{
+		uint32_t histogram[256] = {0};
+		for (uint32_t i = 0; i < count; ++i)
+			histogram[(src[i].key >> shift) & 0xFF]++;
+		if (histogram[(src[0].key >> shift) & 0xFF] == count)
+			continue;
+		uint32_t offset = 0;
+		for (uint32_t i = 0; i < 256; ++i)
+		{
+			uint32_t n = histogram[i];
+			histogram[i] = offset;
+			offset += n;
+		}
+		for (uint32_t i = 0; i < count; ++i)
+			dst[histogram[(src[i].key >> shift) & 0xFF]++] = src[i];
+		struct radix_item *swap = src;
+		src = dst;
+		dst = swap;
+	}
+	if (src != items)
+		memcpy(items, src, sizeof(*items) * count);
+	free(tmp);
+	return true;
+}
+
+static bool sort_numeric(const struct dbc_layout *layout, const struct wow_dbc_file *file, uint32_t column, bool descending, uint32_t *records, uint32_t count)
+{
+	struct radix_item *items = malloc(sizeof(*items) * count);
+	if (!items)
+		return false;
+	struct dbc_column_scan scan;
+	dbc_layout_scan(layout, file, column, &scan);
+	for (uint32_t i = 0; i < count; ++i)
+	{
+		items[i].key = radix_key(&scan, records[i]);
+		if (descending)
+			items[i].key = ~items[i].key;
+		items[i].record = records[i];
+	}
+	if (!radix_sort(items, count))
+	{
+		free(items);
+		return false;
+	}
+	for (uint32_t i = 0; i < count; ++i)
+		records[i] = items[i].record;
+	free(items);
+	return true;
+}
+
+static gint compare_collate(gconstpointer a, gconstpointer b, gpointer userdata)
+{
+	const struct collate_item *ia = a;
+	const struct collate_item *ib = b;
+	int ret = strcmp(ia->key, ib->key);
+	if (ret && *(const bool*)userdata)
+		ret = -ret;
+	if (!ret)
+		ret = (ia->record > ib->record) - (ia->record < ib->record);
+	return ret;
+}
+
+static bool sort_strings(const struct dbc_layout *layout, const struct wow_dbc_file *file, uint32_t column, bool descending, uint32_t *records, uint32_t count)
+{
+	struct collate_item *items = malloc(sizeof(*items) * count);
+	if (!items)
+		return false;
+	/* the strings are deduplicated in the block, compute each key once */
+	GHashTable *keys = g_hash_table_new_full(g_direct_hash, g_direct_equal, NULL, g_free);
+	for (uint32_t i = 0; i < count; ++i)
+	{
+		gpointer offset = GUINT_TO_POINTER(dbc_layout_get(layout, file, records[i], column).str + 1);
+		char *key = g_hash_table_lookup(keys, offset);
+		if (!key)
+		{
+			const char *str = dbc_layout_get_str(layout, file, records[i], column);
+			key = g_utf8_validate(str, -1, NULL) ? g_utf8_collate_key(str, -1) : g_strdup(str);
+			g_hash_table_insert(keys, offset, key);
+		}
+		items[i].key = key;
+		items[i].record = records[i];
+	}
+	g_qsort_with_data(items, count, sizeof(*items), compare_collate, &descending);
+	for (uint32_t i = 0; i < count; ++i)
+		records[i] = items[i].record;
+	g_hash_table_destroy(keys);
+	free(items);
+	return true;
+}
+
+bool dbc_sort(const struct dbc_layout *layout, const struct wow_dbc_file *file, int32_t column, bool descending, uint32_t *records, uint32_t count)
+{
+	if (!count)
+		return true;
+	if (!sort_records(file, records, count))
+	{
+		fprintf(stderr, "dbc sort allocation failed\n");
+		return false;
+	}
+	if (column < 0 || (uint32_t)column >= layout->columns_nb)
+		return true;
+	bool ret;
+	if (layout->columns[column].kind == DBC_VALUE_STRING)
+		ret = sort_strings(layout, file, column, descending, records, count);
+	else
+		ret = sort_numeric(layout, file, column, descending, records, count);
+	if (!ret)
+		fprintf(stderr, "dbc sort allocation failed\n");
+	return ret;
+}
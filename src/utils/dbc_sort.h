@@ -0,0 +1,18 @@
+#ifndef DBC_SORT_H
+#define DBC_SORT_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+struct wow_dbc_file;
+struct dbc_layout;
+
+/* sort records by the values of a column, equal values keep the records order
+ * integers and floats go through a radix sort of order preserving keys,
+ * strings through a sort of their utf8 collation keys
+ * a negative column sorts by record index
+ * only reads the layout and the file, so it can run on any thread
+ */
+bool dbc_sort(const struct dbc_layout *layout, const struct wow_dbc_file *file, int32_t column, bool descending, uint32_t *records, uint32_t count);
+
+#endif
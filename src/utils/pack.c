@@ -0,0 +1,397 @@
+#include "utils/pack.h"
+
+#include <zlib.h>
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <stdio.h>
+#include <time.h>
+
+#define PACK_BUFFER (1024 * 1024)
+
+struct zip_entry
+{
+	char *name;
+	uint32_t crc;
+	uint32_t size;
+	uint32_t packed_size;
+	uint16_t method;
+	uint64_t offset;
+};
+
+struct pack
+{
+	enum pack_format format;
+	FILE *fp;
+	char *buffer;
+	uint64_t offset;
+	uint64_t mtime;
+	uint16_t dos_time;
+	uint16_t dos_date;
+	struct zip_entry *entries;
+	size_t entries_nb;
+	size_t entries_capacity;
+	bool failed;
+};
+
+static void put_u16(uint8_t *data, uint16_t v)
+{
+	data[0] = v;
+	data[1] = v >> 8;
+}
+
+static void put_u32(uint8_t *data, uint32_t v)
+{
+	data[0] = v;
+	data[1] = v >> 8;
+	data[2] = v >> 16;
+	data[3] = v >> 24;
+}
+
+static void put_u64(uint8_t *data, uint64_t v)
+{
+	put_u32(data, v);
+	put_u32(data + 4, v >> 32);
+}
+
+static void write_data(struct pack *pack, const void *data, size_t size)
+{
+	if (pack->failed || !size)
+		return;
+	if (fwrite(data, 1, size, pack->fp) != size)
+	{
+		fprintf(stderr, "failed to write archive: %s\n", strerror(errno));
+		pack->failed = true;
+		return;
+	}
+	pack->offset += size;
+}
+
+struct pack *pack_new(const char *path, enum pack_format format)
+{
+	struct pack *pack = calloc(1, sizeof(*pack));
+	if (!pack)
+	{
+		fprintf(stderr, "pack allocation failed\n");
+		return NULL;
+	}
+	pack->format = format;
+	pack->fp = fopen(path, "wb");
+	if (!pack->fp)
+	{
+		fprintf(stderr, "failed to open '%s': %s\n", path, strerror(errno));
+		free(pack);
+		return NULL;
+	}
+	/* large sequential writes, the entries are mostly small */
+	pack->buffer = malloc(PACK_BUFFER);
+	if (pack->buffer)
+		setvbuf(pack->fp, pack->buffer, _IOFBF, PACK_BUFFER);
+	time_t now = time(NULL);
+	struct tm tm;
+	localtime_r(&now, &tm);
+	pack->mtime = now;
+	pack->dos_time = (tm.tm_hour << 11) | (tm.tm_min << 5) | (tm.tm_sec / 2);
+	pack->dos_date = ((tm.tm_year - 80) << 9) | ((tm.tm_mon + 1) << 5) | tm.tm_mday;
+	return pack;
+}
+
+static void tar_checksum(uint8_t *header)
+{
+	memset(&header[148], ' ', 8);
+	uint32_t sum = 0;
+	for (size_t i = 0; i < 512; ++i)
+		sum += header[i];
+	snprintf((char*)&header[148], 8, "%06o", sum);
+	header[155] = ' ';
+}
+
+static void tar_header(struct pack *pack, const char *name, size_t size, char type)
+{
+	uint8_t header[512];
+	memset(header, 0, sizeof(header));
+	size_t len = strlen(name);
+	if (len <= 100)
+	{
+		memcpy(&header[0], name, len);
+	}
+	else
+	{
+		/* ustar splits the name on a slash, prefix in front */
+		const char *slash = NULL;
+		for (const char *it = name; *it; ++it)
+		{
+			if (*it == '/' && (size_t)(it - name) <= 155 && len - (it - name) - 1 <= 100)
+			{
+				slash = it;
+				break;
+			}
+		}
+		if (slash)
+		{
+			memcpy(&header[345], name, slash - name);
+			memcpy(&header[0], slash + 1, len - (slash - name) - 1);
+		}
+		else
+		{
+			/* the pax header holding the full name comes first */
+			memcpy(&header[0], name, 100);
+		}
+	}
+	snprintf((char*)&header[100], 8, "%07o", 0644);
+	snprintf((char*)&header[108], 8, "%07o", 0);
+	snprintf((char*)&header[116], 8, "%07o", 0);
+	snprintf((char*)&header[124], 12, "%011llo", (unsigned long long)size);
+	snprintf((char*)&header[136], 12, "%011llo", (unsigned long long)pack->mtime);
+	header[156] = type;
+	memcpy(&header[257], "ustar", 6);
+	memcpy(&header[263], "00", 2);
+	tar_checksum(header);
+	write_data(pack, header, sizeof(header));
+}
+
+static void tar_pad(struct pack *pack, size_t size)
+{
+	static const uint8_t zeros[512];
+	if (size % 512)
+		write_data(pack, zeros, 512 - size % 512);
+}
+
+static bool tar_fits(const char *name)
+{
+	size_t len = strlen(name);
+	if (len <= 100)
+		return true;
+	for (const char *it = name; *it; ++it)
+	{
+		if (*it == '/' && (size_t)(it - name) <= 155 && len - (it - name) - 1 <= 100)
+			return true;
+	}
+	return false;
+}
+
+static void tar_add(struct pack *pack, const char *name, const uint8_t *data, size_t size)
+{
+	if (!tar_fits(name))
+	{
+		/* "<length> path=<name>\n", the length counting its own digits */
+		char record[8192];
+		size_t base = strlen(" path=\n") + strlen(name);
+		size_t len = base + 1;
+		while (len != base + snprintf(NULL, 0, "%zu", len))
+			len = base + snprintf(NULL, 0, "%zu", len);
+		if (len < sizeof(record))
+		{
+			snprintf(record, sizeof(record), "%zu path=%s\n", len, name);
+			tar_header(pack, "././@PaxHeader", len, 'x');
+			write_data(pack, record, len);
+			tar_pad(pack, len);
+		}
+	}
+	tar_header(pack, name, size, '0');
+	write_data(pack, data, size);
+	tar_pad(pack, size);
+}
+
+static bool zip_add(struct pack *pack, const char *name, const uint8_t *data, size_t size, uint32_t crc, const uint8_t *packed, size_t packed_size)
+{
+	if (size >= UINT32_MAX)
+	{
+		fprintf(stderr, "'%s' is too large for a zip entry\n", name);
+		return false;
+	}
+	if (pack->entries_nb == pack->entries_capacity)
+	{
+		size_t capacity = pack->entries_capacity ? pack->entries_capacity * 2 : 1024;
+		struct zip_entry *entries = realloc(pack->entries, sizeof(*entries) * capacity);
+		if (!entries)
+		{
+			fprintf(stderr, "zip entries allocation failed\n");
+			return false;
+		}
+		pack->entries = entries;
+		pack->entries_capacity = capacity;
+	}
+	struct zip_entry *entry = &pack->entries[pack->entries_nb];
+	entry->name = strdup(name);
+	if (!entry->name)
+	{
+		fprintf(stderr, "zip entry allocation failed\n");
+		return false;
+	}
+	entry->crc = crc;
+	entry->size = size;
+	entry->method = packed ? 8 : 0;
+	entry->packed_size = packed ? packed_size : size;
+	entry->offset = pack->offset;
+	pack->entries_nb++;
+	size_t name_len = strlen(name);
+	uint8_t header[30];
+	put_u32(&header[0], 0x04034B50);
+	put_u16(&header[4], 20); /* version needed */
+	put_u16(&header[6], 0); /* flags */
+	put_u16(&header[8], entry->method);
+	put_u16(&header[10], pack->dos_time);
+	put_u16(&header[12], pack->dos_date);
+	put_u32(&header[14], crc);
+	put_u32(&header[18], entry->packed_size);
+	put_u32(&header[22], entry->size);
+	put_u16(&header[26], name_len);
+	put_u16(&header[28], 0); /* extra length */
+	write_data(pack, header, sizeof(header));
+	write_data(pack, name, name_len);
+	if (packed)
+		write_data(pack, packed, packed_size);
+	else
+		write_data(pack, data, size);
+	return true;
+}
+
+bool pack_add(struct pack *pack, const char *name, const uint8_t *data, size_t size, uint32_t crc, const uint8_t *packed, size_t packed_size)
+{
+	if (pack->failed)
+		return false;
+	switch (pack->format)
+	{
+		case PACK_TAR:
+			tar_add(pack, name, data, size);
+			break;
+		case PACK_ZIP:
+			if (!zip_add(pack, name, data, size, crc, packed, packed_size))
+				return false;
+			break;
+	}
+	return !pack->failed;
+}
+
+static void zip_finish(struct pack *pack)
+{
+	uint64_t cd_offset = pack->offset;
+	for (size_t i = 0; i < pack->entries_nb; ++i)
+	{
+		const struct zip_entry *entry = &pack->entries[i];
+		bool zip64 = entry->offset >= UINT32_MAX;
+		size_t name_len = strlen(entry->name);
+		uint8_t header[46 + 12];
+		put_u32(&header[0], 0x02014B50);
+		put_u16(&header[4], (3 << 8) | 45); /* unix, 4.5 */
+		put_u16(&header[6], zip64 ? 45 : 20);
+		put_u16(&header[8], 0);
+		put_u16(&header[10], entry->method);
+		put_u16(&header[12], pack->dos_time);
+		put_u16(&header[14], pack->dos_date);
+		put_u32(&header[16], entry->crc);
+		put_u32(&header[20], entry->packed_size);
+		put_u32(&header[24], entry->size);
+		put_u16(&header[28], name_len);
+		put_u16(&header[30], zip64 ? 12 : 0);
+		put_u16(&header[32], 0); /* comment length */
+		put_u16(&header[34], 0); /* disk */
+		put_u16(&header[36], 0); /* internal attributes */
+		put_u32(&header[38], 0100644u << 16);
+		put_u32(&header[42], zip64 ? UINT32_MAX : entry->offset);
+		write_data(pack, header, 46);
+		write_data(pack, entry->name, name_len);
+		if (zip64)
+		{
+			put_u16(&header[46], 0x0001);
+			put_u16(&header[48], 8);
+			put_u64(&header[50], entry->offset);
+			write_data(pack, &header[46], 12);
+		}
+	}
+	uint64_t cd_size = pack->offset - cd_offset;
+	if (pack->entries_nb >= 0xFFFF || cd_offset >= UINT32_MAX || cd_size >= UINT32_MAX)
+	{
+		uint64_t record_offset = pack->offset;
+		uint8_t record[56 + 20];
+		put_u32(&record[0], 0x06064B50);
+		put_u64(&record[4], 44);
+		put_u16(&record[12], (3 << 8) | 45);
+		put_u16(&record[14], 45);
+		put_u32(&record[16], 0);
+		put_u32(&record[20], 0);
+		put_u64(&record[24], pack->entries_nb);
+		put_u64(&record[32], pack->entries_nb);
+		put_u64(&record[40], cd_size);
+		put_u64(&record[48], cd_offset);
+		put_u32(&record[56], 0x07064B50);
+		put_u32(&record[60], 0);
+		put_u64(&record[64], record_offset);
+		put_u32(&record[72], 1);
+		write_data(pack, record, sizeof(record));
+	}
+	uint8_t end[22];
+	put_u32(&end[0], 0x06054B50);
+	put_u16(&end[4], 0);
+	put_u16(&end[6], 0);
+	put_u16(&end[8], pack->entries_nb >= 0xFFFF ? 0xFFFF : pack->entries_nb);
+	put_u16(&end[10], pack->entries_nb >= 0xFFFF ? 0xFFFF : pack->entries_nb);
+	put_u32(&end[12], cd_size >= UINT32_MAX ? UINT32_MAX : cd_size);
+	put_u32(&end[16], cd_offset >= UINT32_MAX ? UINT32_MAX : cd_offset);
+	put_u16(&end[20], 0);
+	write_data(pack, end, sizeof(end));
+}
+
+bool pack_finish(struct pack *pack)
+{
+	if (!pack)
+		return false;
+	switch (pack->format)
+	{
+		case PACK_TAR:
+		{
+			static const uint8_t zeros[1024];
+			write_data(pack, zeros, sizeof(zeros));
+			break;
+		}
+		case PACK_ZIP:
+			zip_finish(pack);
+			break;
+	}
+	if (fclose(pack->fp))
+	{
+		fprintf(stderr, "failed to close archive: %s\n", strerror(errno));
+		pack->failed = true;
+	}
+	bool ret = !pack->failed;
+	for (size_t i = 0; i < pack->entries_nb; ++i)
+		free(pack->entries[i].name);
+	free(pack->entries);
+	free(pack->buffer);
+	free(pack);
+	return ret;
+}
+
+bool pack_deflate(const uint8_t *data, size_t size, uint8_t **packed, size_t *packed_size)
+{
+	if (size >= UINT32_MAX)
+		return false;
+	z_stream stream;
+	memset(&stream, 0, sizeof(stream));
+	if (deflateInit2(&stream, Z_DEFAULT_COMPRESSION, Z_DEFLATED, -15, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+		return false;
+	/* not worth it when the output isn't smaller */
+	uLong bound = size ? size - 1 : 0;
+	uint8_t *out = malloc(bound ? bound : 1);
+	if (!out)
+	{
+		deflateEnd(&stream);
+		return false;
+	}
+	stream.next_in = (Bytef*)data;
+	stream.avail_in = size;
+	stream.next_out = out;
+	stream.avail_out = bound;
+	int ret = deflate(&stream, Z_FINISH);
+	deflateEnd(&stream);
+	if (ret != Z_STREAM_END)
+	{
+		free(out);
+		return false;
+	}
+	*packed = out;
+	*packed_size = stream.total_out;
+	return true;
+}
@@ -0,0 +1,34 @@
+#ifndef PACK_H
+#define PACK_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+
+enum pack_format
+{
+	PACK_TAR,
+	PACK_ZIP,
+};
+
+/* sequential writer of tar (ustar, pax headers for long names) and zip
+ * (stored or deflated entries, zip64 past 4GB or 65535 entries) archives
+ * entries are written as they are added, only the zip central directory is
+ * kept in memory
+ */
+struct pack;
+
+struct pack *pack_new(const char *path, enum pack_format format);
+
+/* packed is the raw deflate stream of data, NULL to store it */
+bool pack_add(struct pack *pack, const char *name, const uint8_t *data, size_t size, uint32_t crc, const uint8_t *packed, size_t packed_size);
+
+/* write the archive trailer and close it, pack is freed in any case */
+bool pack_finish(struct pack *pack);
+
+/* raw deflate of data for zip entries, false if it doesn't make it smaller
+ * thread safe, packed must be freed
+ */
+bool pack_deflate(const uint8_t *data, size_t size, uint8_t **packed, size_t *packed_size);
+
+#endif
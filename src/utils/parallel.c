@@ -0,0 +1,105 @@
+#include "utils/parallel.h"
+
+#include <glib.h>
+
+#include <stdlib.h>
+#include <stdio.h>
+
+struct parallel_job
+{
+	parallel_fn_t fn;
+	void *userdata;
+	gint count;
+	gint next;
+	gint done;
+	gint refs;
+	GMutex mutex;
+	GCond cond;
+};
+
+static GOnce g_pool_once = G_ONCE_INIT;
+
+static void job_unref(struct parallel_job *job)
+{
+	if (!g_atomic_int_dec_and_test(&job->refs))
+		return;
+	g_mutex_clear(&job->mutex);
+	g_cond_clear(&job->cond);
+	free(job);
+}
+
+static void job_run(struct parallel_job *job)
+{
+	gint i;
+	while ((i = g_atomic_int_add(&job->next, 1)) < job->count)
+	{
+		job->fn(job->userdata, i);
+		if (g_atomic_int_add(&job->done, 1) + 1 == job->count)
+		{
+			g_mutex_lock(&job->mutex);
+			g_cond_broadcast(&job->cond);
+			g_mutex_unlock(&job->mutex);
+		}
+	}
+}
+
+static void worker(gpointer data, gpointer userdata)
+{
+	(void)userdata;
+	struct parallel_job *job = data;
+	job_run(job);
+	job_unref(job);
+}
+
+static gpointer pool_init(gpointer data)
+{
+	(void)data;
+	GThreadPool *pool = g_thread_pool_new(worker, NULL, g_get_num_processors(), FALSE, NULL);
+	if (!pool)
+		fprintf(stderr, "failed to create thread pool\n");
+	return pool;
+}
+
+size_t parallel_threads(void)
+{
+	return g_get_num_processors();
+}
+
+void parallel_for(size_t count, parallel_fn_t fn, void *userdata)
+{
+	if (!count)
+		return;
+	GThreadPool *pool = g_once(&g_pool_once, pool_init, NULL);
+	struct parallel_job *job = NULL;
+	if (count > 1 && pool)
+		job = malloc(sizeof(*job));
+	if (!job)
+	{
+		for (size_t i = 0; i < count; ++i)
+			fn(userdata, i);
+		return;
+	}
+	job->fn = fn;
+	job->userdata = userdata;
+	job->count = count;
+	job->next = 0;
+	job->done = 0;
+	job->refs = 1;
+	g_mutex_init(&job->mutex);
+	g_cond_init(&job->cond);
+	size_t helpers = count - 1;
+	if (helpers > parallel_threads())
+		helpers = parallel_threads();
+	for (size_t i = 0; i < helpers; ++i)
+	{
+		g_atomic_int_inc(&job->refs);
+		if (!g_thread_pool_push(pool, job, NULL))
+			job_unref(job);
+	}
+	job_run(job);
+	g_mutex_lock(&job->mutex);
+	while (g_atomic_int_get(&job->done) < job->count)
+		g_cond_wait(&job->cond, &job->mutex);
+	g_mutex_unlock(&job->mutex);
+	job_unref(job);
+}
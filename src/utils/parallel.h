@@ -0,0 +1,15 @@
+#ifndef PARALLEL_H
+#define PARALLEL_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+typedef void (*parallel_fn_t)(void *userdata, size_t i);
+
+/* run fn(userdata, i) for each i in [0, count) on the shared worker pool
+ * the calling thread takes part in the work, so it is safe to call from a worker
+ */
+void parallel_for(size_t count, parallel_fn_t fn, void *userdata);
+size_t parallel_threads(void);
+
+#endif